@@ -26,6 +26,7 @@ struct _hashmap
     Tree_2_3 *tree;
     func_copy_kv copy_kv;
     func_free_kv free_kv;
+    HmAllocator allocator;
 };
 
 /* для связывания hashmap в виду остутствия замыканий и методов */
@@ -36,32 +37,66 @@ typedef struct _hm_context
 } HmContext;
 
 
-static TreeKey _copy_kv (HmContext* context);
-static void    _free_kv (HmContext* context);
+static void *  _default_alloc (size_t size, void *ctx);
+static void    _default_free  (void *ptr, size_t size, void *ctx);
+
+static const HmAllocator default_allocator = { _default_alloc, _default_free, NULL };
+
+static TreeKey _copy_kv   (HmContext* context);
+static void    _free_kv   (HmContext* context);
+static void    _update_kv (HmContext* stored, const HmContext* context);
 
 
 HashMap * hm_create(func_cmp_kv cmp_kv, func_copy_kv copy_kv, func_free_kv free_kv)
 {
     log_trace("%s", __func__);
+
+    return hm_create_ex(cmp_kv, copy_kv, free_kv, NULL);
+}
+
+
+HashMap * hm_create_ex(func_cmp_kv cmp_kv, func_copy_kv copy_kv, func_free_kv free_kv,
+                       const HmAllocator *allocator)
+{
+    log_trace("%s", __func__);
     
     if (!cmp_kv)
     {
         log_error("Error! Need to state key/value functions --> [Necessarily: compare]; [Optional: copy, free]");
         exit(EXIT_FAILURE);
     }
-    
-    Tree_2_3 *tree = tree_create((func_cmp_key)cmp_kv, (func_copy_key)_copy_kv, (func_free_key)_free_kv);
-    HashMap *hashmap = malloc(sizeof(*hashmap));
+
+    if (allocator == NULL)
+        allocator = &default_allocator;
+
+    if (allocator->alloc == NULL || allocator->free == NULL)
+    {
+        log_warn("Try create hashmap with incomplete allocator!");
+        return NULL;
+    }
+
+    TreeAllocator tree_allocator = { allocator->alloc, allocator->free, allocator->ctx };
+    Tree_2_3 *tree = tree_create_ex((func_cmp_key)cmp_kv, (func_copy_key)_copy_kv, (func_free_key)_free_kv,
+                                    &tree_allocator);
+    HashMap *hashmap = allocator->alloc(sizeof(*hashmap), allocator->ctx);
 
     if (!tree || !hashmap)
     {
         log_warn("Can't allocate required memory to create hashmap!");
+
+        if (tree)
+            tree_destroy(&tree);
+
+        if (hashmap)
+            allocator->free(hashmap, sizeof(*hashmap), allocator->ctx);
+
         return NULL;
     }
 
     hashmap->tree = tree;
     hashmap->copy_kv = copy_kv;
     hashmap->free_kv = free_kv;
+    hashmap->allocator = *allocator;
 
     return hashmap;
 }
@@ -73,8 +108,10 @@ void hm_destroy(HashMap **hashmap)
 
     ASSERT_NULL_HASHMAP(!hashmap || !*hashmap);  // NULL hashmap(not exists)
 
+    HmAllocator allocator = (*hashmap)->allocator;
+
     tree_destroy(&(*hashmap)->tree);
-    free(*hashmap);
+    allocator.free(*hashmap, sizeof(**hashmap), allocator.ctx);
 
     *hashmap = NULL;
 }
@@ -104,14 +141,20 @@ bool hm_insert_kv(HashMap *hashmap, HmKey key, HmValue value)
     };
 
 
-    if (tree_search_key(hashmap->tree, (TreeKey)&kv))
+    bool inserted = false;
+    const Node_2_3 *leaf = tree_find_or_insert(hashmap->tree, (TreeKey)&kv, &inserted);
+
+    if (leaf == NULL)
+        return false;
+
+    /* The key is equal, so the pair is changed in place without rebalancing */
+    if (!inserted)
     {
         log_debug("Change value for existing key in hashmap");
-        // подумать, можно ли безопасно изменить только значение для ключа
-        tree_remove_key(hashmap->tree, (TreeKey)&kv);
+        _update_kv((HmContext*)node_get_key(leaf), &kv);
     }
-    
-    return tree_insert_key(hashmap->tree, (TreeKey)&kv);
+
+    return true;
 }
 
 
@@ -182,6 +225,17 @@ int hm_length(const HashMap *hashmap)
 }
 
 
+/* Pairs of tree start with KeyVal, so the hash gets them as KeyVal */
+void hm_set_bloom_filter(HashMap *hashmap, func_hash_kv hash_kv, int bits_per_key)
+{
+    log_trace("%s", __func__);
+
+    ASSERT_NULL_HASHMAP(hashmap == NULL);     // NULL hashmap(not exists)
+
+    tree_set_bloom_filter(hashmap->tree, (func_hash_key)hash_kv, bits_per_key);
+}
+
+
 void hm_print(const HashMap *hashmap, func_print_kv print_key)
 {
     log_trace("%s", __func__);
@@ -195,11 +249,30 @@ void hm_print(const HashMap *hashmap, func_print_kv print_key)
 /* ---------- static functions ---------------------------------------------- */
 
 
+static void * _default_alloc(size_t size, void *ctx)
+{
+    (void)ctx;
+
+    return malloc(size);
+}
+
+
+static void _default_free(void *ptr, size_t size, void *ctx)
+{
+    (void)size;
+    (void)ctx;
+
+    free(ptr);
+}
+
+
+
 static TreeKey _copy_kv(HmContext* context)
 {
     log_trace("%s", __func__);
 
-    HmContext* key = malloc(sizeof(HmContext));
+    const HmAllocator *allocator = &context->hm->allocator;
+    HmContext* key = allocator->alloc(sizeof(HmContext), allocator->ctx);
 
 
     if (!key)
@@ -233,5 +306,25 @@ static void _free_kv(HmContext* context)
     if (hm->free_kv)
         hm->free_kv(&kv);
 
-    free(context);
+    hm->allocator.free(context, sizeof(HmContext), hm->allocator.ctx);
+}
+
+
+/* Context is owned by hashmap (made by _copy_kv), so it can be changed */
+static void _update_kv(HmContext* stored, const HmContext* context)
+{
+    log_trace("%s", __func__);
+
+    const HashMap *hm = context->hm;
+    KeyVal old = stored->kv;
+    KeyVal kv = context->kv;
+
+
+    if (hm->copy_kv)
+        stored->kv = hm->copy_kv(&kv);
+    else
+        stored->kv = kv;
+
+    if (hm->free_kv)
+        hm->free_kv(&old);
 }
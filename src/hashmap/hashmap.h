@@ -1,6 +1,8 @@
 #pragma once
 
 #include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
 
 
 #define KEY_VAL(k, v)      ((KeyVal){ .key=k, .value=v })
@@ -25,6 +27,16 @@ typedef int      (*func_cmp_kv)     (const KeyVal*, const KeyVal*);   /* functio
 typedef KeyVal   (*func_copy_kv)    (const KeyVal*);                  /* function type to copy KeyVal value */
 typedef void     (*func_free_kv)    (const KeyVal*);                  /* function free allocated memory and resourses */
 typedef void     (*func_print_kv)   (const KeyVal*);                  /* function to print KeyVal value */
+typedef uint64_t (*func_hash_kv)    (const KeyVal*);                  /* function to hash key, equal keys must have equal hashes */
+
+
+/* Memory of hashmap, its tree and stored KeyVal, see hm_create_ex() */
+typedef struct
+{
+    void * (*alloc) (size_t size, void *ctx);             /* NULL if memory can't be allocated */
+    void   (*free)  (void *ptr, size_t size, void *ctx);  /* size is the one passed to alloc */
+    void *ctx;                                            /* passed to both functions */
+} HmAllocator;
 
 
 /**
@@ -49,6 +61,12 @@ typedef void     (*func_print_kv)   (const KeyVal*);                  /* functio
  * @note Key ownership depends on func_copy and func_free.
  */
 HashMap * hm_create     (func_cmp_kv func_cmp, func_copy_kv func_copy, func_free_kv func_free);
+
+/* Same as hm_create(), but the hashmap, nodes of its tree and stored KeyVal
+ * are allocated by <allocator>, NULL - malloc/free. Keys and values themselves
+ * are allocated by func_copy. See tree_create_ex() */
+HashMap * hm_create_ex  (func_cmp_kv func_cmp, func_copy_kv func_copy, func_free_kv func_free,
+                         const HmAllocator *allocator);
 void      hm_destroy    (HashMap **hashmap);
 void      hm_clear      (HashMap *hashmap);
  
@@ -59,4 +77,8 @@ HmValue   hm_get_value  (const HashMap *hashmap, HmKey key);
 bool      hm_is_contain (const HashMap *hashmap, HmKey key);
 int       hm_length     (const HashMap *hashmap);
 
+/* Attach Bloom filter of keys, so missing keys are mostly rejected without search.
+ * NULL hash removes the filter, bits_per_key 0 - default. See tree_set_bloom_filter() */
+void      hm_set_bloom_filter (HashMap *hashmap, func_hash_kv hash_kv, int bits_per_key);
+
 void hm_print (const HashMap *hashmap, func_print_kv print_key); /* Print hashmap. Need to pass a custom function to print the key/value */
@@ -1,6 +1,7 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <stdbool.h>
+#include <string.h>
 
 #include "tree_2_3.h"
 
@@ -9,11 +10,64 @@
 
 #define DELETE_CORRECT  NULL
 
-#define get_cmp_func(node)  (node->tree->cmp_key)
-#define get_copy_func(node) (node->tree->copy_key)
-#define get_free_func(node) (node->tree->free_key)
+#define get_cmp_func(tree)  (tree->cmp_key)
+#define get_copy_func(tree) (tree->copy_key)
+#define get_free_func(tree) (tree->free_key)
 
 #define MAX(a, b)   ((a) > (b) ? (a) : (b))
+#define MIN(a, b)   ((a) < (b) ? (a) : (b))
+
+/* Default part of dead leafs, after which the lazy tree is compacted */
+#define DEAD_RATIO      0.25
+
+/* If one tree is bigger than the other in so many times,
+   set operations use galloping search instead of linear merge */
+#define GALLOP_RATIO    8
+
+/* Frozen keys fill cache lines, descendants of key <k> three levels
+   below are keys [8k, 8k + 8) - one line, requested in advance */
+#define CACHE_LINE      64
+#define FROZEN_STRIDE   (CACHE_LINE / sizeof(TreeKey))
+
+/* Blocked Bloom filter: all bits of a key are set in one block of cache line.
+   Filter is rebuilt when removed keys are more than half of added ones */
+#define BLOOM_BLOCK_BITS    (CACHE_LINE * 8)
+#define BLOOM_BLOCK_WORDS   (CACHE_LINE / sizeof(uint64_t))
+#define BLOOM_BITS_PER_KEY  10
+#define BLOOM_MAX_PROBES    8
+#define BLOOM_MIN_CAPACITY  1024
+
+/* Lookups of batch descending together, their nodes are requested
+   in advance and arrive while the others are compared */
+#define BATCH_GROUP         16
+
+/* Lookup cache: a set of entries { hash, leaf } fills one cache line */
+#define CACHE_WAYS          4
+#define CACHE_ENTRIES       1024
+
+/* String keys: shorter common prefix isn't worth a reference to base,
+   longer chain of bases makes compare slower */
+#define STRING_TAG          '\xFF'
+#define STRING_MIN_SHARED   16
+#define STRING_MAX_DEPTH    4
+
+/* Counters of work done by operations, see tree_get_op_stats().
+ * Without TREE_OP_STATS they compile to nothing. The counters are
+ * kept apart from tree, so they are counted through const tree too */
+#ifdef TREE_OP_STATS
+#define OP_STAT_ADD(tree, counter, n)   ((tree)->op_stats->counter += (n))
+#else
+#define OP_STAT_ADD(tree, counter, n)   ((void)0)
+#endif
+
+#define OP_STAT_INC(tree, counter)      OP_STAT_ADD(tree, counter, 1)
+
+/* Prefetch of children on descent, disabled by TREE_NO_PREFETCH */
+#if defined(__GNUC__) && !defined(TREE_NO_PREFETCH)
+#define PREFETCH(addr)                  __builtin_prefetch(addr)
+#else
+#define PREFETCH(addr)                  ((void)(addr))
+#endif
 
 
 /* -------- Data structs --------------------------------------------------- */
@@ -38,7 +92,7 @@ enum nodetype
 struct _node
 {
     enum nodetype type;
-    const struct _tree *tree;
+    struct _node *parent;  /* inner node above, isn't kept for root of tree */
 
     union
     {
@@ -51,12 +105,17 @@ struct _node
 
             TreeKey second_min;
             TreeKey third_min;
+
+            unsigned long size;    /* count of leafs in subtree */
+            unsigned long inners;  /* count of inner nodes in subtree, with this one */
+            double aggregate;      /* combined values of alive keys of subtree */
         };
 
         /* If nodetype is LEAF */
         struct
         {
             TreeKey key;
+            bool dead;  /* removed in lazy mode, key is kept until compaction */
 
             /* To access the function working with the key
                it is possible to use a pointer to the tree
@@ -70,23 +129,179 @@ struct _node
 };
 
 
+/* Hook of intrusive tree is used as leaf */
+_Static_assert(sizeof(TreeHook) >= sizeof(struct _node) && _Alignof(TreeHook) >= _Alignof(struct _node),
+               "TreeHook can't hold a node");
+
+
+/* Bloom filter of keys of tree, bits of removed keys stay until rebuild,
+   so it answers "maybe" for some missing keys but never "no" for stored */
+struct _bloom
+{
+    uint64_t *blocks;       /* aligned to cache line */
+    size_t count_blocks;
+
+    size_t capacity;        /* count of keys the filter is sized for */
+    size_t added;           /* keys added since rebuild */
+    size_t removed;         /* of them removed, their bits stay */
+
+    int bits_per_key;
+    int probes;
+    func_hash_key hash_key;
+};
+
+
+/* Recently found leafs by hash of key, in each set the most recent is first.
+   Leafs aren't moved between nodes, so an entry is valid until its key is removed */
+struct _cache_entry
+{
+    uint64_t hash;
+    struct _node *leaf;     /* NULL if entry is free */
+};
+
+struct _lookup_cache
+{
+    struct _cache_entry *entries;   /* count_sets * CACHE_WAYS, aligned to cache line */
+    size_t count_sets;              /* power of two */
+    func_hash_key hash_key;
+
+    unsigned long hits;
+    unsigned long misses;
+};
+
+
+/* Key of string tree, front-coded against a neighbor key: the first <shared>
+   bytes are taken from base, only the rest is stored. TreeKey points to tag,
+   which no UTF-8 string starts with, so stored keys and C strings are told apart.
+   Base is kept by refs while keys based on it exist, even if it is removed */
+struct _string_key
+{
+    struct _string_key *base;   /* NULL for full key */
+    uint32_t shared;
+    uint32_t length;            /* without terminating NUL */
+    uint32_t refs;              /* the owner and keys based on this one */
+    uint8_t depth;              /* count of bases in chain */
+    char tag;                   /* STRING_TAG */
+    char bytes[];               /* own bytes [shared, length), no NUL */
+};
+
+/* String as spans of own bytes of the keys in chain, from the root base */
+struct string_view
+{
+    const char *bytes[STRING_MAX_DEPTH + 1];
+    uint32_t start[STRING_MAX_DEPTH + 2];   /* span <i> is [start[i], start[i+1]) */
+    int count;
+    uint32_t length;                        /* UINT32_MAX for C string */
+};
+
+
 struct _tree
 {
     struct _node *root;
-    unsigned long elements;
+    unsigned long elements;  /* count of alive keys */
+    int height;              /* levels of nodes, all leafs are at the bottom one */
+
+    /* Lazy deletion: removed leafs are only marked as dead */
+    bool lazy_delete;
+    double dead_ratio;
+    unsigned long dead;
+
+    /* Leafs are hooks in objects of user, see tree_create_intrusive() */
+    bool intrusive;
 
     /* Functions for working with key value */
     func_cmp_key    cmp_key;
     func_copy_key   copy_key;
     func_free_key   free_key;
+
+    /* Memory of nodes and tree struct */
+    TreeAllocator   allocator;
+
+    /* Memory of keys, counted if size function is set */
+    func_size_key   size_key;
+    size_t key_bytes;
+
+    /* Aggregate of values of keys kept in inner nodes, see tree_set_aggregate() */
+    func_value_key  value_key;
+    func_combine    combine;
+    double identity;
+
+    /* Filter for fast rejection of missing keys, NULL if it isn't set */
+    struct _bloom *bloom;
+
+    /* Cache of hot keys for search, NULL if it isn't set */
+    struct _lookup_cache *cache;
+
+#ifdef TREE_OP_STATS
+    /* Counters of operations, apart from tree to be updated by read-only ones */
+    TreeOpStats *op_stats;
+#endif
+};
+
+
+/* Read-only tree: keys in Eytzinger order, children of key <k> are
+   keys <2k> and <2k + 1>, so there are no pointers between nodes */
+struct _tree_frozen
+{
+    TreeKey *keys;  /* from index 1, keys[0] isn't used */
+    size_t count;
+
+    /* Kept for thaw */
+    bool lazy_delete;
+    double dead_ratio;
+    bool intrusive;
+
+    func_cmp_key    cmp_key;
+    func_copy_key   copy_key;
+    func_free_key   free_key;
+    func_size_key   size_key;
+    TreeAllocator   allocator;
+
+    func_value_key  value_key;
+    func_combine    combine;
+    double          identity;
+
+    /* Filter and cache are made again by thaw, NULL hash if they weren't set */
+    func_hash_key   bloom_hash;
+    int             bloom_bits;
+    func_hash_key   cache_hash;
+    int             cache_entries;
+};
+
+
+/* Kind of operation over the sets of keys of two trees */
+enum set_operation
+{
+    SET_UNION,
+    SET_INTERSECTION,
+    SET_DIFFERENCE
+};
+
+
+/* Kind of neighbor of key */
+enum bound
+{
+    BOUND_LOWER,        /* first key >= given */
+    BOUND_UPPER,        /* first key >  given */
+    BOUND_FLOOR,        /* last  key <= given */
+    BOUND_PREDECESSOR   /* last  key <  given */
 };
 
 
+/* Part of tree: root of subtree, his height and minimal key */
+typedef struct _branch
+{
+    struct _node *root;
+    int height;
+    TreeKey min;
+} Branch;
+
+
 /* -------- Static functions ----------------------------------------------- */
 
 
 /* Comparison function to respect established value conventions in compare_t */
-static inline int comparator(func_cmp_key fn_cmp, TreeKey a, TreeKey b)
+static inline int comparator(TreeKey a, TreeKey b, const Tree_2_3 *tree)
 {
     log_trace("%s", __func__);
 
@@ -95,7 +310,9 @@ static inline int comparator(func_cmp_key fn_cmp, TreeKey a, TreeKey b)
         log_warn("a: %p, b: %p", (void*)a, (void*)b);
     }
 
-    int res = fn_cmp(a, b);
+    OP_STAT_INC(tree, compares);
+
+    int res = tree->cmp_key(a, b);
 
     return (res < 0) ? LESS : (res == 0) ? EQUAL : GREATER;
 }
@@ -130,6 +347,21 @@ static TreeKey get_min(const Node_2_3 *root)
 }
 
 
+/* Return address bigger node in node/tree */
+static const Node_2_3 * get_max_node(const Node_2_3 *root)
+{
+    log_trace("%s", __func__);
+
+    if (root == NULL)
+        return NULL;
+
+    while (root->type != LEAF)
+        root = root->third ? root->third : root->second;
+
+    return root;
+}
+
+
 /* Getter for comparing function associated with TreeKey type 
 static func_cmp_key get_cmp_func(struct _node *node)
 {
@@ -169,12 +401,12 @@ static func_free_key get_free_func(struct _node *node)
 /* Return true if <node a> bigger than <node b>
  * if node be  NULL he was considered greater than others
  * when sorting, all empty nodes will be on the "right" */
-static bool bigger_than(struct _node *a, struct _node *b)
+static bool bigger_than(struct _node *a, struct _node *b, const Tree_2_3 *tree)
 {
     log_trace("%s", __func__);
 
     if (a && b)
-        return GREATER == comparator(get_cmp_func(a), get_min(a), get_min(b));
+        return GREATER == comparator(get_min(a), get_min(b), tree);
     else
     if (!a && b) // only <a> is Null
         return true;
@@ -185,13 +417,13 @@ static bool bigger_than(struct _node *a, struct _node *b)
 
 /* Sort elements to ascending order
  * if (*a > *b) they switch places */
-static void min_max(Node_2_3 **a, Node_2_3 **b)
+static void min_max(Node_2_3 **a, Node_2_3 **b, const Tree_2_3 *tree)
 {
     log_trace("%s", __func__);
 
     Node_2_3 *tmp;
 
-    if (bigger_than(*a, *b))
+    if (bigger_than(*a, *b, tree))
     {
         tmp = *a;
         *a = *b;
@@ -200,6 +432,17 @@ static void min_max(Node_2_3 **a, Node_2_3 **b)
 }
 
 
+/* Each level of descent is a dependent load, so all children are
+ * requested before the separators are compared and the next one is
+ * already on the way. Prefetch of NULL doesn't fault */
+static inline void prefetch_children(const Node_2_3 *node)
+{
+    PREFETCH(node->first);
+    PREFETCH(node->second);
+    PREFETCH(node->third);
+}
+
+
 /* Count children of node */
 static int child_cnt(Node_2_3 *node)
 {
@@ -212,650 +455,3980 @@ static int child_cnt(Node_2_3 *node)
 }
 
 
-/* Make and return node with EMPTY type */
-static Node_2_3 * new_empty_node(const Tree_2_3 *tree)
+/* Height of subtree, counted by the way to his minimal leaf */
+static int spine_height(const Node_2_3 *node)
 {
     log_trace("%s", __func__);
 
-    Node_2_3 *tmp = calloc(sizeof(Node_2_3), 1);
+    int height = 0;
 
-    if (tmp == NULL)
+    while (node != NULL)
     {
-        log_fatal("Cannot allocate required memory!");
-        exit(EXIT_FAILURE);
+        height++;
+        node = (node->type == LEAF) ? NULL : node->first;
     }
 
-    tmp->tree = tree;
+    return height;
+}
+
 
-    return tmp;
+/* Parent of node, NULL for root. The root can keep an old link
+ * after the tree shrinks or is split, so it's never followed */
+static inline Node_2_3 * parent_of(const Node_2_3 *node, const Tree_2_3 *tree)
+{
+    return node == tree->root ? NULL : node->parent;
 }
 
 
-/* Make and return node with INNER type */
-static Node_2_3 * new_inner_node(const Tree_2_3 *tree)
+/* Count of leafs in subtree */
+static unsigned long node_size(const Node_2_3 *node)
 {
     log_trace("%s", __func__);
 
-    Node_2_3 *tmp = new_empty_node(tree);
+    if (node == NULL)
+        return 0;
 
-    tmp->type = INNER;
+    if (node->type == LEAF)
+        return 1;
 
-    return tmp;
+    return node->size;
 }
 
 
-/* Make and return node with LEAF type */
-static Node_2_3 * new_leaf_node(TreeKey value, const Tree_2_3 *tree)
+static unsigned long node_inners(const Node_2_3 *node)
 {
     log_trace("%s", __func__);
 
-    Node_2_3 *tmp = new_empty_node(tree);
+    if (node == NULL || node->type == LEAF)
+        return 0;
 
-    tmp->type = LEAF;
-    
-    /* if the copy function is defined, then a copy of the element is made
-     * otherwise the element is simply stored as an pointer */
-    if (tree->copy_key)
-        tmp->key = tree->copy_key(value);
-    else
-        tmp->key = value;
+    return node->inners;
+}
 
-    /* Each leaf contains pointers to functions
-       for working with the key */
-    tmp->cmp_key  = tree->cmp_key;
-    tmp->copy_key = tree->copy_key;
-    tmp->free_key = tree->free_key;
 
-    return tmp;
+/* Combined values of alive keys of subtree */
+static double node_aggregate(const Node_2_3 *node, const Tree_2_3 *tree)
+{
+    if (node == NULL)
+        return tree->identity;
+
+    if (node->type == INNER)
+        return node->aggregate;
+
+    return node->dead ? tree->identity : tree->value_key(node->key);
 }
 
 
-/* Releases resources allocated for the key */
-static void free_key(Node_2_3 *node)
+/* Recount leafs, inner nodes and aggregate of inner node by his children */
+static void update_size(Node_2_3 *node, const Tree_2_3 *tree)
 {
     log_trace("%s", __func__);
 
-    func_free_key free_fn = get_free_func(node);
-    
-    if (free_fn)
-        free_fn(node->key);
+    node->size = node_size(node->first) + node_size(node->second) + node_size(node->third);
+    node->inners = 1 + node_inners(node->first) + node_inners(node->second) + node_inners(node->third);
+
+    /* Every change of children is finished here, so the links up are set too */
+    if (node->first)
+        node->first->parent = node;
+
+    if (node->second)
+        node->second->parent = node;
+
+    if (node->third)
+        node->third->parent = node;
+
+    if (tree->value_key)
+    {
+        double first = node_aggregate(node->first, tree);
+        double second = node_aggregate(node->second, tree);
+
+        node->aggregate = tree->combine(tree->combine(first, second), node_aggregate(node->third, tree));
+    }
 }
 
 
-/* Releases resources allocated for the node and key */
-static void free_node(Node_2_3 *node)
+/* Add (or subtract) memory of key to counter of tree */
+static void count_key(Tree_2_3 *tree, TreeKey key, bool added)
 {
-    log_trace("%s", __func__);
+    if (tree->size_key == NULL)
+        return;
 
-    free_key(node);
-    free(node);
+    if (added)
+        tree->key_bytes += tree->size_key(key);
+    else
+        tree->key_bytes -= tree->size_key(key);
 }
 
 
-/* Sorted node in asc order and make it valid */
-static void validate_node(Node_2_3 *node)
+static void * default_alloc(size_t size, void *ctx)
+{
+    (void)ctx;
+
+    return malloc(size);
+}
+
+
+static void default_free(void *ptr, size_t size, void *ctx)
+{
+    (void)size;
+    (void)ctx;
+
+    free(ptr);
+}
+
+
+static const TreeAllocator default_allocator = { default_alloc, default_free, NULL };
+
+
+/* Make and return node with EMPTY type */
+static Node_2_3 * new_empty_node(const Tree_2_3 *tree)
 {
     log_trace("%s", __func__);
 
-    if (node == NULL)
+    Node_2_3 *tmp = tree->allocator.alloc(sizeof(Node_2_3), tree->allocator.ctx);
+
+    if (tmp == NULL)
     {
-        log_error("Try work with nullable node!");
+        log_fatal("Cannot allocate required memory!");
         exit(EXIT_FAILURE);
     }
 
-    min_max(&node->first, &node->second);
+    memset(tmp, 0, sizeof(Node_2_3));
+    OP_STAT_INC(tree, allocations);
 
-    if (node->third != NULL)
+    return tmp;
+}
+
+
+/* Releases memory of node, but not of its key.
+ * Hook of intrusive tree is only marked as unlinked */
+static void release_node(Node_2_3 *node, const Tree_2_3 *tree)
+{
+    if (tree->intrusive && node->type == LEAF)
     {
-        min_max(&node->first, &node->third);
-        min_max(&node->second, &node->third);
+        node->type = EMPTY;
+        return;
     }
 
-    if (get_min(node->second))
-        node->second_min = get_min(node->second);
-
-    if (get_min(node->third))
-        node->third_min  = get_min(node->third);
+    tree->allocator.free(node, sizeof(Node_2_3), tree->allocator.ctx);
 }
 
 
-/* Added node to old_node and made his valid
- * If old_node has place, his "merge" with added, validated and return NULL.
- * Else the two smallest elements are placed in the old node,
- * and the two largest elements are placed in the new node.
- * After that, the new node pops up further recursively.   */
-static Node_2_3 * update_node(Node_2_3 *old_node, Node_2_3 *added)
+/* Releases memory of tree struct, its nodes must be released before */
+static void release_tree(Tree_2_3 *tree)
 {
-    log_trace("%s", __func__);
+    if (tree == NULL)
+        return;
 
-    if (old_node->third == NULL)
-    {
-        old_node->third = added;
-        validate_node(old_node);
+    TreeAllocator allocator = tree->allocator;
 
-        return NULL;
-    }
+#ifdef TREE_OP_STATS
+    free(tree->op_stats);
+#endif
 
-    Node_2_3 *new_node = new_inner_node(old_node->tree);
+    allocator.free(tree, sizeof(*tree), allocator.ctx);
+}
 
-    new_node->second = old_node->third;
-    old_node->third = NULL;
 
-    /* The two smallest elements remain in the old node,
-       and the two largest go to the new node */
-    if (bigger_than(added, old_node->second))
-        new_node->first = added;
-    else
-    {
-        new_node->first = old_node->second;
-        old_node->second = added;
+/* Make and return node with INNER type */
+static Node_2_3 * new_inner_node(const Tree_2_3 *tree)
+{
+    log_trace("%s", __func__);
 
-        validate_node(old_node);
-    }
+    Node_2_3 *tmp = new_empty_node(tree);
 
-    validate_node(new_node);
+    tmp->type = INNER;
 
-    /* Return the "larger" of the nodes */
-    return new_node;
+    return tmp;
 }
 
 
-/* Merge old root and added node in new root of tree */
-static void update_root(Tree_2_3 *tree, Node_2_3 *added)
+static inline bool is_string_key(TreeKey key)
 {
-    log_trace("%s", __func__);
+    return *(const char*)key == STRING_TAG;
+}
 
-    if (!tree)
+
+static inline struct _string_key * string_key(TreeKey key)
+{
+    return (struct _string_key*)((const char*)key - offsetof(struct _string_key, tag));
+}
+
+
+/* Spans of stored key or C string */
+static void view_string(TreeKey key, struct string_view *view)
+{
+    if (!is_string_key(key))
     {
-        log_error("Tree is NULL!");
-        exit(EXIT_FAILURE);
+        *view = (struct string_view){ .bytes = { key }, .start = { 0, UINT32_MAX },
+                                      .count = 1, .length = UINT32_MAX };
+        return;
     }
 
-    if (!tree->root)
+    const struct _string_key *stored = string_key(key);
+    const struct _string_key *chain[STRING_MAX_DEPTH + 1];
+    int count = 0;
+
+    for (const struct _string_key *k = stored; k; k = k->base)
+        chain[count++] = k;
+
+    view->count = count;
+    view->length = stored->length;
+
+    for (int i = 0; i < count; i++)
     {
-        tree->root = added;
-        return;
+        view->bytes[i] = chain[count - 1 - i]->bytes;
+        view->start[i] = chain[count - 1 - i]->shared;
     }
 
-    Node_2_3 *new_root = new_inner_node(tree);
+    view->start[count] = view->length;
+}
 
-    new_root->first = tree->root;
-    new_root->second = added;
-    validate_node(new_root);
 
-    tree->root = new_root;
+static inline bool view_ended(const struct string_view *view, uint32_t pos)
+{
+    return pos >= view->length || (view->length == UINT32_MAX && view->bytes[0][pos] == '\0');
 }
 
 
-/* Delete <child> node from <root> */
-static void delete_child(Node_2_3 *root, Node_2_3 *node)
+/* Byte at pos, -1 after the end. Span <*span> is moved forward */
+static inline int view_byte(const struct string_view *view, int *span, uint32_t pos)
 {
-    log_trace("%s", __func__);
+    if (view_ended(view, pos))
+        return -1;
 
-    if (root->first == node)
-        root->first = NULL;
-    else
-    if (root->second == node)
-        root->second = NULL;
-    else
-    if (root->third == node)
-        root->third = NULL;
+    while (pos >= view->start[*span + 1])
+        (*span)++;
 
-    if (node->type == LEAF)
-        free_node(node);
+    return (unsigned char)view->bytes[*span][pos - view->start[*span]];
 }
 
 
-/* Add child node in root */
-static void add_child(Node_2_3 *root, Node_2_3 *child)
+/* Compare function of string tree, the spans are compared in place,
+ * so stored keys aren't decoded. Bytes are unsigned, as by strcmp() */
+static int compare_strings(TreeKey a, TreeKey b)
 {
-    log_trace("%s", __func__);
+    if (!is_string_key(a) && !is_string_key(b))
+        return strcmp(a, b);
 
-    if (child_cnt(root) == 1)
-    {
-        root->second = update_node(root->first, child);
-    }
-    else
-    if (child_cnt(root) == 2)
-    {
-        if (bigger_than(child, root->second))
-            root->third = update_node(root->second, child);
-        else
-            root->third = update_node(root->first, child);
-    }
-    else
+    struct string_view x, y;
+    uint32_t pos = 0;
+    int i = 0, j = 0;
+
+
+    view_string(a, &x);
+    view_string(b, &y);
+
+    /* stored bytes have no NUL, so strncmp() stops only at the end of C string */
+    while (pos < x.length && pos < y.length)
     {
-        log_error("Can't add child, root node is full!");
-        exit(EXIT_FAILURE);
+        while (i + 1 < x.count && pos >= x.start[i + 1])   i++;
+        while (j + 1 < y.count && pos >= y.start[j + 1])   j++;
+
+        uint32_t n = MIN(x.start[i + 1], y.start[j + 1]) - pos;
+        int res = strncmp(x.bytes[i] + (pos - x.start[i]), y.bytes[j] + (pos - y.start[j]), n);
+
+        if (res != 0)
+            return res;
+
+        pos += n;
     }
 
-    validate_node(root);
+    return (int)!view_ended(&x, pos) - (int)!view_ended(&y, pos);
 }
 
 
-/* If the tree has a leaf with a value, the function deletes it
-   and restores the validity of the tree on the back of the recursion  */
-static Node_2_3 * delete_value(Node_2_3 *root, TreeKey value, bool *finded)
+/* Count of equal first bytes */
+static uint32_t common_prefix(const struct string_view *x, const struct string_view *y)
 {
-    log_trace("%s", __func__);
-    
-    /* Value not in tree */
-    if (root == NULL)
-    {
-        log_debug("The element cannot be deleted because it was not found.");
-        *finded = false;
-        return NULL;
-    }
-    
-    Node_2_3 *deleted = NULL;
-    func_cmp_key compare = get_cmp_func(root);
+    uint32_t pos = 0;
+    int i = 0, j = 0;
 
+    while (view_byte(x, &i, pos) >= 0 && view_byte(x, &i, pos) == view_byte(y, &j, pos))
+        pos++;
 
-    /* Value finded */
-    if (root->type == LEAF)
+    return pos;
+}
+
+
+/* Store string of view front-coded against neighbor (stored key or NULL) */
+static TreeKey encode_string(const struct string_view *view, struct _string_key *neighbor)
+{
+    uint32_t length = 0;
+    uint32_t shared = 0;
+    int span = 0;
+
+
+    while (view_byte(view, &span, length) >= 0)
+        length++;
+
+    if (neighbor)
     {
-        if (EQUAL == comparator(compare, value, root->key))
-        {
-            return root;  // value finded
-        }
-        else
-        {
-            log_warn("The element cannot be deleted, it was not found!");
-            *finded = false;
-            return NULL; // value not in tree
-        }
+        struct string_view other;
+
+        view_string(&neighbor->tag, &other);
+        shared = common_prefix(view, &other);
     }
 
-    /* Try find value in tree */
-    if ( LESS == comparator(compare, value, root->second_min) )
-        deleted = delete_value(root->first, value, finded);
+    /* the prefix is stored by base of neighbor, or chain is too long */
+    while (neighbor && (shared <= neighbor->shared || neighbor->depth == STRING_MAX_DEPTH))
+    {
+        shared = MIN(shared, neighbor->shared);
+        neighbor = neighbor->base;
+    }
+
+    if (neighbor == NULL || shared < STRING_MIN_SHARED)
+    {
+        neighbor = NULL;
+        shared = 0;
+    }
+
+    struct _string_key *key = malloc(sizeof(*key) + (length - shared));
+
+    if (key == NULL)
+    {
+        log_fatal("Cannot allocate required memory!");
+        exit(EXIT_FAILURE);
+    }
+
+    *key = (struct _string_key){
+        .base = neighbor,
+        .shared = shared,
+        .length = length,
+        .refs = 1,
+        .depth = neighbor ? neighbor->depth + 1 : 0,
+        .tag = STRING_TAG
+    };
+
+    if (neighbor)
+        neighbor->refs++;
+
+    span = 0;
+
+    for (uint32_t pos = shared; pos < length; pos++)
+        key->bytes[pos - shared] = (char)view_byte(view, &span, pos);
+
+    return &key->tag;
+}
+
+
+/* Copy function of string tree: stored key is copied as a reference to it */
+static TreeKey copy_string(TreeKey value)
+{
+    struct string_view view;
+
+    view_string(value, &view);
+
+    return encode_string(&view, is_string_key(value) ? string_key(value) : NULL);
+}
+
+
+static void free_string(TreeKey value)
+{
+    struct _string_key *key = string_key(value);
+
+    while (key && --key->refs == 0)
+    {
+        struct _string_key *base = key->base;
+
+        free(key);
+        key = base;
+    }
+}
+
+
+static size_t size_string(TreeKey value)
+{
+    const struct _string_key *key = string_key(value);
+
+    return sizeof(*key) + (key->length - key->shared);
+}
+
+
+/* New string key is coded against the neighbor leaf */
+static TreeKey copy_key_near(TreeKey value, TreeKey neighbor, const Tree_2_3 *tree)
+{
+    if (tree->copy_key != copy_string || neighbor == NULL || is_string_key(value))
+        return tree->copy_key(value);
+
+    struct string_view view;
+
+    view_string(value, &view);
+
+    return encode_string(&view, string_key(neighbor));
+}
+
+
+/* Keys of caller are C strings in string tree, stored keys are told from
+ * them by the first byte, so C string starting with STRING_TAG is refused */
+static bool string_key_refused(func_cmp_key cmp_key, TreeKey key)
+{
+    if (cmp_key != compare_strings || key == NULL || !is_string_key(key))
+        return false;
+
+    log_warn("Try pass key of string tree starting with byte 0xFF!");
+    return true;
+}
+
+
+/* Make and return node with LEAF type, <neighbor> is the key of
+ * adjacent leaf or NULL */
+static Node_2_3 * new_leaf_node(TreeKey value, Tree_2_3 *tree, TreeKey neighbor)
+{
+    log_trace("%s", __func__);
+
+    Node_2_3 *tmp = NULL;
+
+    /* The hook of intrusive tree is the leaf and the key at once */
+    if (tree->intrusive)
+    {
+        tmp = (Node_2_3*)value;
+        memset(tmp, 0, sizeof(*tmp));
+    }
     else
-    if ( !root->third || LESS == comparator(compare, value, root->third_min) )
-        deleted = delete_value(root->second, value, finded);
+        tmp = new_empty_node(tree);
+
+    tmp->type = LEAF;
+    
+    /* if the copy function is defined, then a copy of the element is made
+     * otherwise the element is simply stored as an pointer */
+    if (tree->copy_key)
+        tmp->key = copy_key_near(value, neighbor, tree);
     else
-        deleted = delete_value(root->third, value, finded);
+        tmp->key = value;
 
-    /* When deleting a value results in an incorrect node (with one child)
-       they node will be merge with one of his brothers */
-    if (deleted)
-    {
-        switch (deleted->type)
-        {
-            case LEAF:
-                        delete_child(root, deleted);
-                        validate_node(root);
+    count_key(tree, tmp->key, true);
 
-                        if (child_cnt(root) == 1)
-                            return root;
-                        break;
+    /* Each leaf contains pointers to functions
+       for working with the key */
+    tmp->cmp_key  = tree->cmp_key;
+    tmp->copy_key = tree->copy_key;
+    tmp->free_key = tree->free_key;
 
-            case INNER:
-                        delete_child(root, deleted);
-                        validate_node(root);
-                        add_child(root, deleted->first);
-                        free(deleted);
+    return tmp;
+}
 
-                        if (child_cnt(root) == 1)
-                            return root;
-                        break;
 
-            case EMPTY:
-                        log_error("Tree can't have empty node!");
-                        exit(EXIT_FAILURE);
-            default:
-                        log_error("Undefined type of Node_2_3!");
-                        exit(EXIT_FAILURE);
-        }
+/* Releases resources allocated for the key */
+static void free_key(Node_2_3 *node, Tree_2_3 *tree)
+{
+    log_trace("%s", __func__);
+
+    func_free_key free_fn = get_free_func(tree);
+
+    count_key(tree, node->key, false);
+
+    if (free_fn)
+        free_fn(node->key);
+}
+
+
+/* Releases resources allocated for the node and key */
+static void free_node(Node_2_3 *node, Tree_2_3 *tree)
+{
+    log_trace("%s", __func__);
+
+    free_key(node, tree);
+    release_node(node, tree);
+}
+
+
+/* Sorted node in asc order and make it valid */
+static void validate_node(Node_2_3 *node, const Tree_2_3 *tree)
+{
+    log_trace("%s", __func__);
+
+    if (node == NULL)
+    {
+        log_error("Try work with nullable node!");
+        exit(EXIT_FAILURE);
     }
 
-    return DELETE_CORRECT;
+    min_max(&node->first, &node->second, tree);
+
+    if (node->third != NULL)
+    {
+        min_max(&node->first, &node->third, tree);
+        min_max(&node->second, &node->third, tree);
+    }
+
+    if (get_min(node->second))
+        node->second_min = get_min(node->second);
+
+    if (get_min(node->third))
+        node->third_min  = get_min(node->third);
+
+    update_size(node, tree);
 }
 
 
-/* Looking for the place where the key should be
-   if it is already occupied, it returns null
-   otherwise, inserts the key into the tree and
-   restores its validity on the back of the recursion */
-static Node_2_3 * add_value(Node_2_3 *root, TreeKey value, Tree_2_3 *tree, bool *duplicated)
+/* Added node to old_node and made his valid
+ * If old_node has place, his "merge" with added, validated and return NULL.
+ * Else the two smallest elements are placed in the old node,
+ * and the two largest elements are placed in the new node.
+ * After that, the new node pops up further recursively.   */
+static Node_2_3 * update_node(Node_2_3 *old_node, Node_2_3 *added, const Tree_2_3 *tree)
 {
     log_trace("%s", __func__);
 
-    Node_2_3 *result = NULL;
-    Node_2_3 *new_node = NULL;
-    func_cmp_key compare = tree->cmp_key;
+    if (old_node->third == NULL)
+    {
+        old_node->third = added;
+        validate_node(old_node, tree);
 
-    /* Value not in tree */
-    if (root == NULL)
+        return NULL;
+    }
+
+    Node_2_3 *new_node = new_inner_node(tree);
+
+    OP_STAT_INC(tree, splits);
+
+    new_node->second = old_node->third;
+    old_node->third = NULL;
+
+    /* The two smallest elements remain in the old node,
+       and the two largest go to the new node */
+    if (bigger_than(added, old_node->second, tree))
     {
-        log_warn("Try add value to NULL node!");
-        return new_leaf_node(value, tree);
+        new_node->first = added;
+        update_size(old_node, tree);
+    }
+    else
+    {
+        new_node->first = old_node->second;
+        old_node->second = added;
+
+        validate_node(old_node, tree);
     }
 
-    /* Find place where value must be */
-    if (root->type == LEAF)
+    validate_node(new_node, tree);
+
+    /* Return the "larger" of the nodes */
+    return new_node;
+}
+
+
+/* Merge old root and added node in new root of tree */
+static void update_root(Tree_2_3 *tree, Node_2_3 *added)
+{
+    log_trace("%s", __func__);
+
+    if (!tree)
     {
-        if (EQUAL == comparator(compare, value, root->key))
-        {
-            *duplicated = true;
-            return NULL;  // value in tree, don't duplicated
-        }
-        else
-            return new_leaf_node(value, tree); // value not in tree
+        log_error("Tree is NULL!");
+        exit(EXIT_FAILURE);
     }
 
-    /* Try find value in tree */
-    if ( LESS == comparator(compare, value, root->second_min) )
-        new_node = add_value(root->first, value, tree, duplicated);
+    if (!tree->root)
+    {
+        tree->root = added;
+        tree->height = spine_height(added);
+        return;
+    }
+
+    Node_2_3 *new_root = new_inner_node(tree);
+
+    new_root->first = tree->root;
+    new_root->second = added;
+    validate_node(new_root, tree);
+
+    tree->root = new_root;
+    tree->height++;
+}
+
+
+/* Delete <child> node from <root> */
+static void delete_child(Node_2_3 *root, Node_2_3 *node)
+{
+    log_trace("%s", __func__);
+
+    if (root->first == node)
+        root->first = NULL;
     else
-    if ( !root->third || LESS == comparator(compare, value, root->third_min) )
-        new_node = add_value(root->second, value, tree, duplicated);
+    if (root->second == node)
+        root->second = NULL;
     else
-        new_node = add_value(root->third, value, tree, duplicated);
+    if (root->third == node)
+        root->third = NULL;
+}
 
-    /* If a new node is created when adding an item to children,
-       add this node to the parent and do it recursively */
-    if (new_node != NULL)
-        result = update_node(root, new_node);
 
-    return result;
+/* Add child node in root */
+static void add_child(Node_2_3 *root, Node_2_3 *child, const Tree_2_3 *tree)
+{
+    log_trace("%s", __func__);
+
+    if (child_cnt(root) == 1)
+    {
+        root->second = update_node(root->first, child, tree);
+    }
+    else
+    if (child_cnt(root) == 2)
+    {
+        if (bigger_than(child, root->second, tree))
+            root->third = update_node(root->second, child, tree);
+        else
+            root->third = update_node(root->first, child, tree);
+    }
+    else
+    {
+        log_error("Can't add child, root node is full!");
+        exit(EXIT_FAILURE);
+    }
+
+    validate_node(root, tree);
 }
 
 
-/* Return addres leaf with value or null if value not found */
-static Node_2_3 * search_value(Node_2_3 *root, TreeKey value)
+/* Remove <deleted> child of root, the leaf isn't released. When it results
+   in an incorrect node (with one child) the node will be merge with one of
+   his brothers, then root is returned to be merged by its parent */
+static Node_2_3 * drop_child(Node_2_3 *root, Node_2_3 *deleted, Tree_2_3 *tree)
 {
     log_trace("%s", __func__);
-    
-    if (root == NULL)
-        return NULL;
 
-    func_cmp_key compare = get_cmp_func(root);
-
-    switch (root->type)
+    switch (deleted->type)
     {
         case LEAF:
-                    if (EQUAL == comparator(compare, root->key, value))
-                        return root;
+                    delete_child(root, deleted);
+                    validate_node(root, tree);
                     break;
 
         case INNER:
-                    if (LESS == comparator(compare, value, root->second_min))
-                        return search_value(root->first, value);
-                    else
-                    if ( !root->third || LESS == comparator(compare, value, root->third_min) )
-                        return search_value(root->second, value);
-                    else
-                        return search_value(root->third, value);
+                    OP_STAT_INC(tree, merges);
+
+                    delete_child(root, deleted);
+                    validate_node(root, tree);
+                    add_child(root, deleted->first, tree);
+                    release_node(deleted, tree);
+                    break;
+
+        case EMPTY:
+                    log_error("Tree can't have empty node!");
+                    exit(EXIT_FAILURE);
+        default:
+                    log_error("Undefined type of Node_2_3!");
+                    exit(EXIT_FAILURE);
+    }
+
+    return child_cnt(root) == 1 ? root : DELETE_CORRECT;
+}
+
+
+/* If the tree has a leaf with a value, the function deletes it
+   and restores the validity of the tree on the back of the recursion  */
+static Node_2_3 * delete_value(Node_2_3 *root, TreeKey value, Tree_2_3 *tree, bool *finded)
+{
+    log_trace("%s", __func__);
+    
+    /* Value not in tree */
+    if (root == NULL)
+    {
+        log_debug("The element cannot be deleted because it was not found.");
+        *finded = false;
+        return NULL;
+    }
+
+    OP_STAT_INC(tree, remove_visits);
+    
+    Node_2_3 *deleted = NULL;
+    int cmp_second = LESS;
+    int cmp_third = LESS;
+
+
+    /* Value finded */
+    if (root->type == LEAF)
+    {
+        if (EQUAL == comparator(value, root->key, tree))
+        {
+            return root;  // value finded
+        }
+        else
+        {
+            log_warn("The element cannot be deleted, it was not found!");
+            *finded = false;
+            return NULL; // value not in tree
+        }
+    }
+
+    prefetch_children(root);
+
+    /* Try find value in tree */
+    if ( LESS == (cmp_second = comparator(value, root->second_min, tree)) )
+        deleted = delete_value(root->first, value, tree, finded);
+    else
+    if ( !root->third || LESS == (cmp_third = comparator(value, root->third_min, tree)) )
+        deleted = delete_value(root->second, value, tree, finded);
+    else
+        deleted = delete_value(root->third, value, tree, finded);
+
+    if (!*finded)
+        return NULL;
+
+    /* The deleted key was the minimum of the child, so the separator
+       points to released memory and must be taken from the child again */
+    if (!deleted)
+    {
+        if (cmp_second == EQUAL)
+            root->second_min = get_min(root->second);
+        else
+        if (cmp_third == EQUAL)
+            root->third_min = get_min(root->third);
+
+        update_size(root, tree);
+    }
+
+    if (deleted)
+    {
+        bool is_leaf = deleted->type == LEAF;
+        Node_2_3 *result = drop_child(root, deleted, tree);
+
+        if (is_leaf)
+            free_node(deleted, tree);
+
+        return result;
+    }
+
+    return DELETE_CORRECT;
+}
+
+
+/* Detach the leftmost (or rightmost) leaf of subtree, the children are
+   chosen by place, so keys are compared only by repair of nodes.
+   The leaf isn't released, it's saved in <leaf> */
+static Node_2_3 * detach_extreme(Node_2_3 *root, Tree_2_3 *tree, bool to_right, Node_2_3 **leaf)
+{
+    log_trace("%s", __func__);
+
+    if (root->type == LEAF)
+    {
+        *leaf = root;
+        return root;
+    }
+
+    OP_STAT_INC(tree, remove_visits);
+
+    Node_2_3 *child = !to_right ? root->first : root->third ? root->third : root->second;
+    Node_2_3 *deleted = detach_extreme(child, tree, to_right, leaf);
+
+
+    /* The extreme key isn't a separator of nodes, which keep their children */
+    if (!deleted)
+    {
+        update_size(root, tree);
+        return DELETE_CORRECT;
+    }
+
+    return drop_child(root, deleted, tree);
+}
+
+
+/* Looking for the place where the key should be
+   if it is already occupied, it returns null
+   otherwise, inserts the key into the tree and
+   restores its validity on the back of the recursion.
+   The leaf with value (new or existed) is saved in <leaf> */
+static Node_2_3 * add_value(Node_2_3 *root, TreeKey value, Tree_2_3 *tree, bool *duplicated, Node_2_3 **leaf)
+{
+    log_trace("%s", __func__);
+
+    Node_2_3 *result = NULL;
+    Node_2_3 *new_node = NULL;
+
+    /* Value not in tree */
+    if (root == NULL)
+    {
+        log_warn("Try add value to NULL node!");
+        return *leaf = new_leaf_node(value, tree, NULL);
+    }
+
+    OP_STAT_INC(tree, insert_visits);
+
+    /* Find place where value must be */
+    if (root->type == LEAF)
+    {
+        if (EQUAL == comparator(value, root->key, tree))
+        {
+            *duplicated = true;
+            *leaf = root;
+            return NULL;  // value in tree, don't duplicated
+        }
+        else
+            return *leaf = new_leaf_node(value, tree, root->key); // value not in tree
+    }
+
+    prefetch_children(root);
+
+    /* Try find value in tree */
+    if ( LESS == comparator(value, root->second_min, tree) )
+        new_node = add_value(root->first, value, tree, duplicated, leaf);
+    else
+    if ( !root->third || LESS == comparator(value, root->third_min, tree) )
+        new_node = add_value(root->second, value, tree, duplicated, leaf);
+    else
+        new_node = add_value(root->third, value, tree, duplicated, leaf);
+
+    /* If a new node is created when adding an item to children,
+       add this node to the parent and do it recursively */
+    if (new_node != NULL)
+        result = update_node(root, new_node, tree);
+    else
+    if (!*duplicated)
+        update_size(root, tree);  // split of child could be absorbed below
+
+    return result;
+}
+
+
+/* Return addres leaf with value or null if value not found */
+static Node_2_3 * search_value(Node_2_3 *root, TreeKey value, const Tree_2_3 *tree)
+{
+    log_trace("%s", __func__);
+    
+    if (root == NULL)
+        return NULL;
+
+    OP_STAT_INC(tree, search_visits);
+
+    switch (root->type)
+    {
+        case LEAF:
+                    if (EQUAL == comparator(root->key, value, tree))
+                        return root;
+                    break;
+
+        case INNER:
+                    prefetch_children(root);
+
+                    if (LESS == comparator(value, root->second_min, tree))
+                        return search_value(root->first, value, tree);
+                    else
+                    if ( !root->third || LESS == comparator(value, root->third_min, tree) )
+                        return search_value(root->second, value, tree);
+                    else
+                        return search_value(root->third, value, tree);
+
+        case EMPTY:
+                    log_error("Tree can't have empty node!");
+                    exit(EXIT_FAILURE);
+        default:
+                    log_error("Undefined type of Node_2_3!");
+                    exit(EXIT_FAILURE);
+    }
+
+    /* key not found */
+    return NULL;
+}
+
+
+/* Child of inner node whose subtree may contain value */
+static inline Node_2_3 * child_for_value(const Node_2_3 *node, TreeKey value, const Tree_2_3 *tree)
+{
+    if (LESS == comparator(value, node->second_min, tree))
+        return node->first;
+
+    if (!node->third || LESS == comparator(value, node->third_min, tree))
+        return node->second;
+
+    return node->third;
+}
+
+
+/* Descent of group of lookups level by level (all leafs are on one level).
+ * At each level keys of separators are requested for all nodes of group
+ * first, then nodes of the next level, so misses of one lookup overlap
+ * with work of the others */
+static void search_group(const Tree_2_3 *tree, const TreeKey *values, size_t count, Node_2_3 **found)
+{
+    log_trace("%s", __func__);
+
+    Node_2_3 *nodes[BATCH_GROUP];
+
+    for (size_t i = 0; i < count; i++)
+        nodes[i] = tree->root;
+
+    while (nodes[0]->type == INNER)
+    {
+        for (size_t i = 0; i < count; i++)
+        {
+            PREFETCH(nodes[i]->second_min);
+            PREFETCH(nodes[i]->third_min);
+        }
+
+        for (size_t i = 0; i < count; i++)
+        {
+            OP_STAT_INC(tree, search_visits);
+
+            nodes[i] = child_for_value(nodes[i], values[i], tree);
+            PREFETCH(nodes[i]);
+        }
+    }
+
+    for (size_t i = 0; i < count; i++)
+        PREFETCH(nodes[i]->key);
+
+    for (size_t i = 0; i < count; i++)
+    {
+        OP_STAT_INC(tree, search_visits);
+
+        bool equal = !nodes[i]->dead && EQUAL == comparator(nodes[i]->key, values[i], tree);
+        found[i] = equal ? nodes[i] : NULL;
+    }
+}
+
+
+/* Swap the key of leaf equal to value with a copy of value, separators
+ * pointing to the old key are updated on the back of the recursion.
+ * Return the old key or NULL if value not found, new key is saved to <added> */
+static TreeKey replace_value(Node_2_3 *root, TreeKey value, const Tree_2_3 *tree, TreeKey *added)
+{
+    log_trace("%s", __func__);
+
+    func_copy_key copy = get_copy_func(tree);
+    TreeKey old = NULL;
+
+
+    if (root->type == LEAF)
+    {
+        if (root->dead || EQUAL != comparator(value, root->key, tree))
+            return NULL;
+
+        old = root->key;
+        root->key = *added = copy ? copy(value) : value;
+
+        return old;
+    }
+
+    if ( LESS == comparator(value, root->second_min, tree) )
+        old = replace_value(root->first, value, tree, added);
+    else
+    if ( !root->third || LESS == comparator(value, root->third_min, tree) )
+        old = replace_value(root->second, value, tree, added);
+    else
+        old = replace_value(root->third, value, tree, added);
+
+    if (old != NULL && root->second_min == old)
+        root->second_min = *added;
+
+    if (old != NULL && root->third_min == old)
+        root->third_min = *added;
+
+    /* New key can have other value */
+    if (old != NULL)
+        update_size(root, tree);
+
+    return old;
+}
+
+
+/* Descend to the leaf where value must be. Nearest siblings of the way
+ * are saved to <left> and <right>: if the leaf doesn't suit, neighbor of
+ * value is the maximum of <left> or the minimum of <right> */
+static const Node_2_3 * locate_value(const Node_2_3 *root, TreeKey value, const Tree_2_3 *tree,
+                                     const Node_2_3 **left, const Node_2_3 **right)
+{
+    log_trace("%s", __func__);
+
+    *left = *right = NULL;
+
+    OP_STAT_INC(tree, search_visits);
+
+    while (root->type == INNER)
+    {
+        OP_STAT_INC(tree, search_visits);
+        prefetch_children(root);
+
+        if (LESS == comparator(value, root->second_min, tree))
+        {
+            *right = root->second;
+            root = root->first;
+        }
+        else
+        if ( !root->third || LESS == comparator(value, root->third_min, tree) )
+        {
+            *left = root->first;
+            *right = root->third ? root->third : *right;
+            root = root->second;
+        }
+        else
+        {
+            *left = root->second;
+            root = root->third;
+        }
+    }
+
+    return root;
+}
+
+
+/* Neighbor of value found in one descent and one comparison in leaf */
+static const Node_2_3 * bound_leaf(const Tree_2_3 *tree, TreeKey value, enum bound bound)
+{
+    log_trace("%s", __func__);
+
+    const Node_2_3 *left, *right;
+    const Node_2_3 *leaf = locate_value(tree->root, value, tree, &left, &right);
+    int cmp = comparator(leaf->key, value, tree);
+
+
+    switch (bound)
+    {
+        case BOUND_LOWER:
+                    return (cmp != LESS) ? leaf : get_min_node(right);
+        case BOUND_UPPER:
+                    return (cmp == GREATER) ? leaf : get_min_node(right);
+        case BOUND_FLOOR:
+                    return (cmp != GREATER) ? leaf : get_max_node(left);
+        case BOUND_PREDECESSOR:
+                    return (cmp == LESS) ? leaf : get_max_node(left);
+        default:
+                    log_error("Undefined kind of bound!");
+                    exit(EXIT_FAILURE);
+    }
+}
+
+
+/* Neighbor of value among alive leafs, dead ones are stepped over */
+static const Node_2_3 * find_bound(const Tree_2_3 *tree, TreeKey value, enum bound bound)
+{
+    log_trace("%s", __func__);
+
+    if (tree == NULL || value == NULL || tree_is_empty(tree))
+        return NULL;
+
+    if (string_key_refused(tree->cmp_key, value))
+        return NULL;
+
+    OP_STAT_INC(tree, searches);
+
+    const Node_2_3 *leaf = bound_leaf(tree, value, bound);
+    bool forward = (bound == BOUND_LOWER || bound == BOUND_UPPER);
+
+    while (leaf != NULL && leaf->dead)
+        leaf = bound_leaf(tree, leaf->key, forward ? BOUND_UPPER : BOUND_PREDECESSOR);
+
+    return leaf;
+}
+
+
+/* First free children of tree, than free tree */
+static void tree_free(Node_2_3 *node, Tree_2_3 *tree)
+{
+    log_trace("%s", __func__);
+
+    if (node == NULL)
+        return;
+
+    switch (node->type)
+    {
+        case LEAF:
+                    //get_free_func(tree)(node->key);
+                    free_key(node, tree);
+                    break;
+
+        case INNER:
+                    tree_free(node->first, tree);
+                    tree_free(node->second, tree);
+                    tree_free(node->third, tree);
+                    break;
+
+        case EMPTY:
+                    log_error("Tree can't have empty node!");
+                    exit(EXIT_FAILURE);
+    }
+
+    //free_node(node, tree);
+    release_node(node, tree);
+}
+
+
+/* print all elemnts in tree in ascending order */
+static void print_tree_elements_in_order(Node_2_3 *node, int *num_element, func_print_key print_key)
+{
+    log_trace("%s", __func__);
+
+    if (node == NULL)
+        return;
+
+
+    //static int height = 0;
+
+    if (node->type == LEAF && node->dead)
+        return;
+
+    if (node->type == LEAF)
+    {
+        (*num_element)++;
+        printf("%d) ", *num_element);
+        print_key(node->key);
+        //printf(" height: %u", height+1);
+        putchar('\n');
+
+        return;
+    }
+
+    //height++;
+
+    /* determines the order in which the tree is traversed (ascending) */
+    print_tree_elements_in_order(node->first, num_element, print_key);
+    print_tree_elements_in_order(node->second, num_element, print_key);
+    print_tree_elements_in_order(node->third, num_element, print_key);
+
+   // height--;
+}
+
+
+/* State of walk over the tree in tree_check_invariants() */
+struct invariants_walk
+{
+    const Tree_2_3 *tree;
+    TreeKey prev;           /* key of previous leaf */
+    unsigned long alive;
+    unsigned long dead;
+    bool ok;
+};
+
+
+/* Check subtree on level <depth>, the leafs must be on level <height> */
+static void check_node(const Node_2_3 *node, int depth, struct invariants_walk *walk)
+{
+    log_trace("%s", __func__);
+
+    const Tree_2_3 *tree = walk->tree;
+
+    if (node->type == LEAF)
+    {
+        if (depth != tree->height)
+        {
+            log_error("Leaf on level %d, but height of tree is %d", depth, tree->height);
+            walk->ok = false;
+        }
+
+        if (walk->prev && LESS != comparator(walk->prev, node->key, tree))
+        {
+            log_error("Keys of leafs are not in ascending order");
+            walk->ok = false;
+        }
+
+        walk->prev = node->key;
+
+        if (node->dead)
+            walk->dead++;
+        else
+            walk->alive++;
+
+        return;
+    }
+
+    if (!node->first || !node->second)
+    {
+        log_error("Inner node on level %d has less than two children", depth);
+        walk->ok = false;
+        return;
+    }
+
+    if (node->first->parent != node || node->second->parent != node ||
+        (node->third && node->third->parent != node))
+    {
+        log_error("Child of inner node on level %d has wrong parent", depth);
+        walk->ok = false;
+    }
+
+    check_node(node->first, depth + 1, walk);
+    check_node(node->second, depth + 1, walk);
+
+    if (node->third)
+        check_node(node->third, depth + 1, walk);
+
+    if (EQUAL != comparator(node->second_min, get_min(node->second), tree) ||
+        (node->third && EQUAL != comparator(node->third_min, get_min(node->third), tree)))
+    {
+        log_error("Separator key of inner node on level %d differs from min of child", depth);
+        walk->ok = false;
+    }
+
+    unsigned long size = node_size(node->first) + node_size(node->second) + node_size(node->third);
+    unsigned long inners = 1 + node_inners(node->first) + node_inners(node->second) + node_inners(node->third);
+
+    if (node->size != size || node->inners != inners)
+    {
+        log_error("Counters of inner node on level %d: size %lu (need %lu), inners %lu (need %lu)",
+                  depth, node->size, size, node->inners, inners);
+        walk->ok = false;
+    }
+
+    if (tree->value_key)
+    {
+        double first = node_aggregate(node->first, tree);
+        double second = node_aggregate(node->second, tree);
+        double aggregate = tree->combine(tree->combine(first, second), node_aggregate(node->third, tree));
+
+        if (node->aggregate != aggregate)
+        {
+            log_error("Aggregate of inner node on level %d differs from his children", depth);
+            walk->ok = false;
+        }
+    }
+}
+
+
+/* Insert <child> with minimal key <child_min> at position <pos> of inner <node>.
+ * The place is known, so the keys are not compared. <node_min> is needed only
+ * when child becomes the first one. If there is no place in node, the two smallest
+ * children remain in node, and the two largest go to the returned new node,
+ * whose minimal key is saved in <split_min> */
+static Node_2_3 * insert_child_at(Node_2_3 *node, int pos, Node_2_3 *child, TreeKey child_min,
+                                  TreeKey node_min, TreeKey *split_min, const Tree_2_3 *tree)
+{
+    log_trace("%s", __func__);
+
+    Node_2_3 *children[4] = { node->first, node->second, node->third, NULL };
+    TreeKey mins[4] = { node_min, node->second_min, node->third_min, NULL };
+    int count = child_cnt(node);
+
+
+    for (int i = count; i > pos; i--)
+    {
+        children[i] = children[i-1];
+        mins[i] = mins[i-1];
+    }
+
+    children[pos] = child;
+    mins[pos] = child_min;
+    count++;
+
+    node->first = children[0];
+    node->second = children[1];
+    node->second_min = mins[1];
+
+    if (count <= 3)
+    {
+        node->third = children[2];
+        node->third_min = mins[2];
+        update_size(node, tree);
+
+        return NULL;
+    }
+
+    Node_2_3 *new_node = new_inner_node(tree);
+
+    node->third = NULL;
+    update_size(node, tree);
+
+    new_node->first = children[2];
+    new_node->second = children[3];
+    new_node->second_min = mins[3];
+    update_size(new_node, tree);
+
+    *split_min = mins[2];
+
+    return new_node;
+}
+
+
+/* Hang <added> on the right spine of <node> at the level where
+ * his children have the same height as <added>. Split node pops up */
+static Node_2_3 * attach_right(Node_2_3 *node, int height, Branch added, TreeKey *split_min,
+                               const Tree_2_3 *tree)
+{
+    log_trace("%s", __func__);
+
+    if (height == added.height + 1)
+        return insert_child_at(node, child_cnt(node), added.root, added.min, NULL, split_min, tree);
+
+    Node_2_3 *last = node->third ? node->third : node->second;
+    Node_2_3 *new_node = attach_right(last, height - 1, added, split_min, tree);
+
+    if (new_node == NULL)
+    {
+        update_size(node, tree);
+        return NULL;
+    }
+
+    return insert_child_at(node, child_cnt(node), new_node, *split_min, NULL, split_min, tree);
+}
+
+
+/* Hang <added> on the left spine of <node> with minimal key <node_min>
+ * at the level where his children have the same height as <added> */
+static Node_2_3 * attach_left(Node_2_3 *node, int height, TreeKey node_min, Branch added, TreeKey *split_min,
+                              const Tree_2_3 *tree)
+{
+    log_trace("%s", __func__);
+
+    if (height == added.height + 1)
+        return insert_child_at(node, 0, added.root, added.min, node_min, split_min, tree);
+
+    Node_2_3 *new_node = attach_left(node->first, height - 1, node_min, added, split_min, tree);
+
+    if (new_node == NULL)
+    {
+        update_size(node, tree);
+        return NULL;
+    }
+
+    return insert_child_at(node, 1, new_node, *split_min, NULL, split_min, tree);
+}
+
+
+/* Concatenate two branches, all keys of <left> are smaller than keys of <right>.
+ * Costs O(difference of heights + 1) and doesn't compare the keys */
+static Branch join_branches(Branch left, Branch right, const Tree_2_3 *tree)
+{
+    log_trace("%s", __func__);
+
+    if (left.root == NULL)
+        return right;
+
+    if (right.root == NULL)
+        return left;
+
+
+    Branch result = { .root = left.root, .height = left.height, .min = left.min };
+    Node_2_3 *new_node = NULL;
+    TreeKey split_min = right.min;
+
+    if (left.height > right.height)
+        new_node = attach_right(left.root, left.height, right, &split_min, tree);
+    else
+    if (left.height < right.height)
+    {
+        new_node = attach_left(right.root, right.height, right.min, left, &split_min, tree);
+        result.root = right.root;
+        result.height = right.height;
+    }
+    else /* Same heights, both branches become children of new root */
+        new_node = right.root;
+
+    if (new_node != NULL)
+    {
+        Node_2_3 *new_root = new_inner_node(tree);
+
+        new_root->first = result.root;
+        new_root->second = new_node;
+        new_root->second_min = split_min;
+        update_size(new_root, tree);
+
+        result.root = new_root;
+        result.height++;
+    }
+
+    return result;
+}
+
+
+/* Divide branch into two parts: keys smaller than <key> go to <left>,
+ * other keys go to <right>. Inner nodes on the way to key are released,
+ * remaining children are joined back on the way up */
+static void split_branch(Branch branch, TreeKey key, const Tree_2_3 *tree, Branch *left, Branch *right)
+{
+    log_trace("%s", __func__);
+
+    Node_2_3 *root = branch.root;
+
+    *left = *right = (Branch){ .root = NULL };
+
+
+    if (root->type == LEAF)
+    {
+        if (LESS == comparator(root->key, key, tree))
+            *left = branch;
+        else
+            *right = branch;
+
+        return;
+    }
+
+    Branch children[] = {
+        { .root = root->first,  .height = branch.height - 1, .min = branch.min },
+        { .root = root->second, .height = branch.height - 1, .min = root->second_min },
+        { .root = root->third,  .height = branch.height - 1, .min = root->third_min }
+    };
+    int count = child_cnt(root);
+    int pos = 0;
+    Branch part_left, part_right;
+
+
+    /* Find child where key must be */
+    if (LESS == comparator(key, root->second_min, tree))
+        pos = 0;
+    else
+    if ( !root->third || LESS == comparator(key, root->third_min, tree) )
+        pos = 1;
+    else
+        pos = 2;
+
+    release_node(root, tree);
+
+    split_branch(children[pos], key, tree, &part_left, &part_right);
+
+    for (int i = 0; i < pos; i++)
+        *left = join_branches(*left, children[i], tree);
+
+    *left = join_branches(*left, part_left, tree);
+    *right = part_right;
+
+    for (int i = pos + 1; i < count; i++)
+        *right = join_branches(*right, children[i], tree);
+}
+
+
+/* Finalizer of splitmix64: every bit of user hash changes all bits of result,
+   so a weak hash (as of doubles with zero low bits) doesn't crowd keys */
+static uint64_t mix_hash(uint64_t hash)
+{
+    hash = (hash ^ (hash >> 30)) * 0xBF58476D1CE4E5B9ULL;
+    hash = (hash ^ (hash >> 27)) * 0x94D049BB133111EBULL;
+
+    return hash ^ (hash >> 31);
+}
+
+
+/* Block of key and two hashes for positions of its bits in block */
+static uint64_t * bloom_block(const struct _bloom *bloom, TreeKey key, uint32_t *h1, uint32_t *h2)
+{
+    uint64_t mixed = mix_hash(bloom->hash_key(key));
+    size_t block = ((mixed >> 32) * bloom->count_blocks) >> 32;
+
+    *h1 = (uint32_t)mixed;
+    *h2 = (uint32_t)(mixed >> 17) | 1;
+
+    return bloom->blocks + block * BLOOM_BLOCK_WORDS;
+}
+
+
+static void bloom_add(struct _bloom *bloom, TreeKey key)
+{
+    uint32_t h1, h2;
+    uint64_t *block = bloom_block(bloom, key, &h1, &h2);
+
+    for (int i = 0; i < bloom->probes; i++)
+    {
+        uint32_t bit = (h1 + i * h2) % BLOOM_BLOCK_BITS;
+        block[bit / 64] |= (uint64_t)1 << (bit % 64);
+    }
+}
+
+
+/* false if key is surely not in filter */
+static bool bloom_may_contain(const struct _bloom *bloom, TreeKey key)
+{
+    uint32_t h1, h2;
+    const uint64_t *block = bloom_block(bloom, key, &h1, &h2);
+
+    for (int i = 0; i < bloom->probes; i++)
+    {
+        uint32_t bit = (h1 + i * h2) % BLOOM_BLOCK_BITS;
+
+        if (!(block[bit / 64] & ((uint64_t)1 << (bit % 64))))
+            return false;
+    }
+
+    return true;
+}
+
+
+/* Add alive keys of subtree to filter */
+static void bloom_add_keys(struct _bloom *bloom, const Node_2_3 *node)
+{
+    if (node == NULL)
+        return;
+
+    if (node->type == LEAF)
+    {
+        if (!node->dead)
+            bloom_add(bloom, node->key);
+        return;
+    }
+
+    bloom_add_keys(bloom, node->first);
+    bloom_add_keys(bloom, node->second);
+    bloom_add_keys(bloom, node->third);
+}
+
+
+/* Size the filter for twice the count of keys and fill it anew */
+static void bloom_rebuild(Tree_2_3 *tree)
+{
+    log_trace("%s", __func__);
+
+    struct _bloom *bloom = tree->bloom;
+    size_t capacity = MAX(2 * tree->elements, BLOOM_MIN_CAPACITY);
+    size_t count_blocks = (capacity * bloom->bits_per_key + BLOOM_BLOCK_BITS - 1) / BLOOM_BLOCK_BITS;
+
+    if (count_blocks != bloom->count_blocks)
+    {
+        free(bloom->blocks);
+        bloom->blocks = aligned_alloc(CACHE_LINE, count_blocks * CACHE_LINE);
+
+        if (bloom->blocks == NULL)
+        {
+            log_fatal("Cannot allocate required memory!");
+            exit(EXIT_FAILURE);
+        }
+
+        bloom->count_blocks = count_blocks;
+    }
+
+    memset(bloom->blocks, 0, count_blocks * CACHE_LINE);
+
+    bloom->capacity = capacity;
+    bloom->added = tree->elements;
+    bloom->removed = 0;
+
+    bloom_add_keys(bloom, tree->root);
+}
+
+
+static void bloom_free(struct _bloom *bloom)
+{
+    if (bloom == NULL)
+        return;
+
+    free(bloom->blocks);
+    free(bloom);
+}
+
+
+/* Keep filter on insert of key, grow it if keys are more than it is sized for */
+static void bloom_key_added(Tree_2_3 *tree, TreeKey key)
+{
+    if (tree->bloom == NULL)
+        return;
+
+    bloom_add(tree->bloom, key);
+
+    if (++tree->bloom->added > tree->bloom->capacity)
+        bloom_rebuild(tree);
+}
+
+
+/* Bits of removed key can't be cleared, they are dropped on rebuild */
+static void bloom_key_removed(Tree_2_3 *tree)
+{
+    if (tree->bloom == NULL)
+        return;
+
+    if (++tree->bloom->removed > tree->bloom->added / 2)
+        bloom_rebuild(tree);
+}
+
+
+/* true if tree has filter and value is surely not in tree */
+static bool bloom_rejects(const Tree_2_3 *tree, TreeKey value)
+{
+    if (tree->bloom == NULL || bloom_may_contain(tree->bloom, value))
+        return false;
+
+    OP_STAT_INC(tree, filtered);
+
+    return true;
+}
+
+
+/* Filter of <left> gets keys of joined tree: filters of one size are
+   merged by bits, otherwise the filter is rebuilt */
+static void join_blooms(Tree_2_3 *left, const struct _bloom *right)
+{
+    struct _bloom *bloom = left->bloom;
+
+    if (right == NULL || right->hash_key != bloom->hash_key ||
+        right->count_blocks != bloom->count_blocks || right->probes != bloom->probes)
+    {
+        bloom_rebuild(left);
+        return;
+    }
+
+    for (size_t i = 0; i < bloom->count_blocks * BLOOM_BLOCK_WORDS; i++)
+        bloom->blocks[i] |= right->blocks[i];
+
+    bloom->added += right->added;
+    bloom->removed += right->removed;
+
+    if (bloom->added > bloom->capacity || bloom->removed > bloom->added / 2)
+        bloom_rebuild(left);
+}
+
+
+/* Set of entries for key with <hash> */
+static struct _cache_entry * cache_set(const struct _lookup_cache *cache, uint64_t hash)
+{
+    size_t set = mix_hash(hash) & (cache->count_sets - 1);
+
+    return cache->entries + set * CACHE_WAYS;
+}
+
+
+/* Return cached leaf with value or NULL, hash of value is saved to <hash> */
+static Node_2_3 * cache_lookup(const Tree_2_3 *tree, TreeKey value, uint64_t *hash)
+{
+    struct _lookup_cache *cache = tree->cache;
+
+    if (cache == NULL)
+        return NULL;
+
+    *hash = cache->hash_key(value);
+
+    struct _cache_entry *set = cache_set(cache, *hash);
+
+    for (int i = 0; i < CACHE_WAYS; i++)
+    {
+        struct _cache_entry hit = set[i];
+
+        if (hit.leaf == NULL || hit.hash != *hash || hit.leaf->dead ||
+            EQUAL != comparator(value, hit.leaf->key, tree))
+            continue;
+
+        /* The hit becomes the most recent */
+        memmove(set + 1, set, i * sizeof(*set));
+        set[0] = hit;
+        cache->hits++;
+
+        return hit.leaf;
+    }
+
+    cache->misses++;
+
+    return NULL;
+}
+
+
+/* Save found leaf as the most recent in its set, the least recent is evicted */
+static void cache_store(const Tree_2_3 *tree, uint64_t hash, Node_2_3 *leaf)
+{
+    if (tree->cache == NULL)
+        return;
+
+    struct _cache_entry *set = cache_set(tree->cache, hash);
+
+    memmove(set + 1, set, (CACHE_WAYS - 1) * sizeof(*set));
+    set[0] = (struct _cache_entry){ .hash = hash, .leaf = leaf };
+}
+
+
+/* Drop entries of value before its leaf is removed */
+static void cache_forget(Tree_2_3 *tree, TreeKey value)
+{
+    if (tree->cache == NULL)
+        return;
+
+    uint64_t hash = tree->cache->hash_key(value);
+    struct _cache_entry *set = cache_set(tree->cache, hash);
+
+    for (int i = 0; i < CACHE_WAYS; i++)
+        if (set[i].hash == hash)
+            set[i].leaf = NULL;
+}
+
+
+static void cache_clear(Tree_2_3 *tree)
+{
+    if (tree->cache)
+        memset(tree->cache->entries, 0, tree->cache->count_sets * CACHE_WAYS * sizeof(struct _cache_entry));
+}
+
+
+static void cache_free(struct _lookup_cache *cache)
+{
+    if (cache == NULL)
+        return;
+
+    free(cache->entries);
+    free(cache);
+}
+
+
+/* Hang a new leaf with <value> at the right or left end of not empty tree.
+ * The place is known, so the keys are not compared */
+static Node_2_3 * attach_leaf(Tree_2_3 *tree, TreeKey value, bool to_right)
+{
+    log_trace("%s", __func__);
+
+    TreeKey neighbor = to_right ? get_max_node(tree->root)->key : get_min(tree->root);
+    Node_2_3 *leaf = new_leaf_node(value, tree, neighbor);
+    Branch added = { .root = leaf, .height = 1, .min = leaf->key };
+    Branch whole = { .root = tree->root, .height = tree->height, .min = get_min(tree->root) };
+
+    if (to_right)
+        whole = join_branches(whole, added, tree);
+    else
+        whole = join_branches(added, whole, tree);
+
+    tree->root = whole.root;
+    tree->height = whole.height;
+    tree->elements++;
+
+    bloom_key_added(tree, value);
+
+    return leaf;
+}
+
+
+/* Replace stored key equal to value and release the old one */
+static bool swap_key(Tree_2_3 *tree, TreeKey value)
+{
+    log_trace("%s", __func__);
+
+    TreeKey added = NULL;
+    TreeKey old = replace_value(tree->root, value, tree, &added);
+
+    if (old == NULL)
+        return false;
+
+    count_key(tree, old, false);
+    count_key(tree, added, true);
+
+    /* Without copy function the same pointer can be passed again */
+    if (get_free_func(tree) && old != added)
+        get_free_func(tree)(old);
+
+    return true;
+}
+
+
+/* Dead leaf with key equal to value becomes alive and gets the new key */
+static Node_2_3 * revive_leaf(Tree_2_3 *tree, Node_2_3 *leaf, TreeKey value, bool *duplicated)
+{
+    log_trace("%s", __func__);
+
+    leaf->dead = false;
+    tree->dead--;
+    tree->elements++;
+    *duplicated = false;
+
+    swap_key(tree, value);
+    bloom_key_added(tree, value);
+
+    return leaf;
+}
+
+
+/* Insert value if it's not there, ascending keys are appended without descent.
+ * Return the leaf with value (new or existed) */
+static Node_2_3 * insert_value(Tree_2_3 *tree, TreeKey value, bool *duplicated)
+{
+    log_trace("%s", __func__);
+
+    Node_2_3 *leaf = NULL;
+
+    *duplicated = false;
+
+    /* Empty tree */
+    if (tree_is_empty(tree))
+    {
+        tree->elements++;
+        tree->root = new_leaf_node(value, tree, NULL);
+        tree->height = 1;
+
+        bloom_key_added(tree, value);
+
+        return tree->root;
+    }
+
+    /* Keys often come in ascending order */
+    if (GREATER == comparator(value, get_max_node(tree->root)->key, tree))
+        return attach_leaf(tree, value, true);
+
+    Node_2_3 *new_node = add_value(tree->root, value, tree, duplicated, &leaf);
+
+    if (*duplicated && leaf->dead)
+        return revive_leaf(tree, leaf, value, duplicated);
+
+    if (*duplicated)
+        return leaf;
+
+    tree->elements++;
+
+    /* Check is need to update the root of tree */
+    if (new_node != NULL)
+        update_root(tree, new_node);
+
+    bloom_key_added(tree, value);
+
+    return leaf;
+}
+
+
+/* Insert value in subtree of leaf <hint> or of its lowest ancestor whose range
+ * of keys holds value. Bounds of the range are separators kept in parents,
+ * so a near key costs a few comparisons instead of descent from the root.
+ * Return the leaf with value (new or existed) */
+static Node_2_3 * insert_near(Tree_2_3 *tree, TreeKey value, Node_2_3 *hint, bool *duplicated)
+{
+    log_trace("%s", __func__);
+
+    Node_2_3 *node = hint;
+    Node_2_3 *parent = NULL;
+    Node_2_3 *leaf = NULL;
+
+    /* Once value is inside a bound of node, it is inside that bound of every ancestor */
+    bool above_low = false;
+    bool below_high = false;
+
+    *duplicated = false;
+
+    for (parent = parent_of(node, tree); parent != NULL; node = parent, parent = parent_of(node, tree))
+    {
+        /* The last child takes high bound from parent, the first inner one the low bound.
+         * Low bound of leaf is its own key */
+        TreeKey low = NULL;
+        TreeKey high = NULL;
+
+        if (node == parent->first)
+        {
+            low = node->type == LEAF ? node->key : NULL;
+            high = parent->second_min;
+        }
+        else
+        if (node == parent->second)
+        {
+            low = parent->second_min;
+            high = parent->third ? parent->third_min : NULL;
+        }
+        else
+            low = parent->third_min;
+
+        if (!above_low && low != NULL)
+            above_low = LESS != comparator(value, low, tree);
+
+        if (!below_high && high != NULL)
+            below_high = LESS == comparator(value, high, tree);
+
+        if (above_low && below_high)
+            break;
+
+        OP_STAT_INC(tree, insert_visits);
+    }
+
+    Node_2_3 *new_node = add_value(node, value, tree, duplicated, &leaf);
+
+    if (*duplicated && leaf->dead)
+        return revive_leaf(tree, leaf, value, duplicated);
+
+    if (*duplicated)
+        return leaf;
+
+    /* Restore validity above the subtree, as add_value() does on the back of recursion */
+    for (parent = parent_of(node, tree); parent != NULL; node = parent, parent = parent_of(node, tree))
+    {
+        if (new_node != NULL)
+            new_node = update_node(parent, new_node, tree);
+        else
+            update_size(parent, tree);
+    }
+
+    tree->elements++;
+
+    if (new_node != NULL)
+        update_root(tree, new_node);
+
+    bloom_key_added(tree, value);
+
+    return leaf;
+}
+
+
+/* Save all keys of subtree in ascending order to <keys> */
+static void collect_keys(const Node_2_3 *node, TreeKey *keys, size_t *count)
+{
+    log_trace("%s", __func__);
+
+    if (node == NULL)
+        return;
+
+    if (node->type == LEAF)
+    {
+        if (!node->dead)
+            keys[(*count)++] = node->key;
+        return;
+    }
+
+    collect_keys(node->first, keys, count);
+    collect_keys(node->second, keys, count);
+    collect_keys(node->third, keys, count);
+}
+
+
+/* Call <visit> for keys of subtree in ascending order.
+ * Return false if visitor asked to stop */
+static bool foreach_key(const Node_2_3 *node, func_visit_key visit, void *context)
+{
+    log_trace("%s", __func__);
+
+    if (node == NULL)
+        return true;
+
+    if (node->type == LEAF)
+        return node->dead || visit(node->key, context);
+
+    return foreach_key(node->first, visit, context)  &&
+           foreach_key(node->second, visit, context) &&
+           foreach_key(node->third, visit, context);
+}
+
+
+/* Scan of keys starting with prefix, see tree_prefix_foreach() */
+struct prefix_scan
+{
+    const Tree_2_3 *tree;
+    const char *prefix;
+    size_t len;
+    func_visit_key visit;
+    void *context;
+};
+
+
+static bool has_prefix(TreeKey key, const struct prefix_scan *scan)
+{
+    if (scan->tree->cmp_key != compare_strings)
+        return strncmp(key, scan->prefix, scan->len) == 0;
+
+    struct string_view view;
+    int span = 0;
+
+    view_string(key, &view);
+
+    for (size_t pos = 0; pos < scan->len; pos++)
+    {
+        if (view_byte(&view, &span, pos) != (unsigned char)scan->prefix[pos])
+            return false;
+    }
+
+    return true;
+}
+
+
+/* Visit keys of subtree starting with prefix, keys smaller than <lo>
+ * are skipped (NULL - none), so only the way to <lo> is descended.
+ * Return false when the scan is over: the visitor stopped it or a key
+ * after the prefix is met */
+static bool scan_prefix(const Node_2_3 *node, TreeKey lo, const struct prefix_scan *scan)
+{
+    log_trace("%s", __func__);
+
+    if (node == NULL)
+        return true;
+
+    if (node->type == LEAF)
+    {
+        if (lo && LESS == comparator(node->key, lo, scan->tree))
+            return true;
+
+        if (!has_prefix(node->key, scan))
+            return false;
+
+        return node->dead || scan->visit(node->key, scan->context);
+    }
+
+    const Node_2_3 *children[3] = { node->first, node->second, node->third };
+    TreeKey mins[4] = { NULL, node->second_min, node->third ? node->third_min : NULL, NULL };
+
+
+    for (int i = 0; i < 3 && children[i]; i++)
+    {
+        TreeKey from = mins[i], to = mins[i+1];
+
+        /* Keys of child are smaller than lo */
+        if (lo && to && LESS != comparator(lo, to, scan->tree))
+            continue;
+
+        TreeKey child_lo = (lo && from && LESS != comparator(from, lo, scan->tree)) ? NULL : lo;
+
+        if (!scan_prefix(children[i], child_lo, scan))
+            return false;
+    }
+
+    return true;
+}
+
+
+/* Add memory of keys of all leafs (dead too) of subtree */
+static void count_all_keys(const Node_2_3 *node, Tree_2_3 *tree)
+{
+    log_trace("%s", __func__);
+
+    if (node == NULL)
+        return;
+
+    if (node->type == LEAF)
+    {
+        count_key(tree, node->key, true);
+        return;
+    }
+
+    count_all_keys(node->first, tree);
+    count_all_keys(node->second, tree);
+    count_all_keys(node->third, tree);
+}
+
+
+/* Build inner levels over ordered <nodes> of the same height bottom-up.
+ * The array is reused as buffer for the next level. Return root */
+static Node_2_3 * build_levels(Node_2_3 **nodes, size_t count, const Tree_2_3 *tree)
+{
+    log_trace("%s", __func__);
+
+    if (count == 0)
+        return NULL;
+
+    while (count > 1)
+    {
+        size_t parents = 0;
+
+        for (size_t i = 0; i < count; )
+        {
+            size_t rest = count - i;
+            size_t take = (rest == 2 || rest == 4) ? 2 : 3;  // never leave a single child
+            Node_2_3 *parent = new_inner_node(tree);
+
+            parent->first = nodes[i];
+            parent->second = nodes[i+1];
+            parent->second_min = get_min(parent->second);
+
+            if (take == 3)
+            {
+                parent->third = nodes[i+2];
+                parent->third_min = get_min(parent->third);
+            }
+
+            update_size(parent, tree);
+
+            nodes[parents++] = parent;
+            i += take;
+        }
+
+        count = parents;
+    }
+
+    return nodes[0];
+}
+
+
+/* Make leafs for ordered unique <keys> and build the tree over them */
+static void build_tree(Tree_2_3 *tree, const TreeKey *keys, size_t count)
+{
+    log_trace("%s", __func__);
+
+    if (count == 0)
+        return;
+
+    Node_2_3 **nodes = malloc(sizeof(*nodes) * count);
+
+    if (nodes == NULL)
+    {
+        log_fatal("Cannot allocate required memory!");
+        exit(EXIT_FAILURE);
+    }
+
+    for (size_t i = 0; i < count; i++)
+        nodes[i] = new_leaf_node(keys[i], tree, i ? nodes[i-1]->key : NULL);
+
+    tree->root = build_levels(nodes, count, tree);
+    tree->height = spine_height(tree->root);
+    tree->elements = count;
+
+    free(nodes);
+}
+
+
+/* Release inner nodes and dead leafs, save alive leafs to <leafs> */
+static void collect_alive(Node_2_3 *node, Tree_2_3 *tree, Node_2_3 **leafs, size_t *count)
+{
+    log_trace("%s", __func__);
+
+    if (node == NULL)
+        return;
+
+    if (node->type == LEAF)
+    {
+        if (node->dead)
+            free_node(node, tree);
+        else
+            leafs[(*count)++] = node;
+
+        return;
+    }
+
+    collect_alive(node->first, tree, leafs, count);
+    collect_alive(node->second, tree, leafs, count);
+    collect_alive(node->third, tree, leafs, count);
+
+    release_node(node, tree);
+}
+
+
+/* Rebuild the tree over alive leafs bottom-up, dead keys are released */
+static void compact_tree(Tree_2_3 *tree)
+{
+    log_trace("%s", __func__);
+
+    if (tree->dead == 0)
+        return;
+
+    size_t count = 0;
+    Node_2_3 **leafs = malloc(sizeof(*leafs) * (tree->elements + 1));
+
+    if (leafs == NULL)
+    {
+        log_fatal("Cannot allocate required memory!");
+        exit(EXIT_FAILURE);
+    }
+
+    collect_alive(tree->root, tree, leafs, &count);
+
+    tree->root = build_levels(leafs, count, tree);
+    tree->height = spine_height(tree->root);
+    tree->dead = 0;
+
+    free(leafs);
+}
+
+
+/* Recount aggregates on the way from the leaf up to root,
+ * when the leaf was changed without changing the structure */
+static void refresh_aggregates(Node_2_3 *leaf, const Tree_2_3 *tree)
+{
+    log_trace("%s", __func__);
+
+    for (Node_2_3 *node = parent_of(leaf, tree); node; node = parent_of(node, tree))
+        update_size(node, tree);
+}
+
+
+/* Recount aggregates of all inner nodes of subtree */
+static void aggregate_all(Node_2_3 *node, const Tree_2_3 *tree)
+{
+    log_trace("%s", __func__);
+
+    if (node == NULL || node->type == LEAF)
+        return;
+
+    aggregate_all(node->first, tree);
+    aggregate_all(node->second, tree);
+    aggregate_all(node->third, tree);
+
+    update_size(node, tree);
+}
+
+
+/* Combine values of keys of subtree in [lo, hi], NULL bound is open.
+ * Child <i> holds keys in [mins[i], mins[i+1]), children lying in the range
+ * whole give their aggregates, so only the ways to the bounds are visited */
+static double range_aggregate(const Node_2_3 *node, TreeKey lo, TreeKey hi, const Tree_2_3 *tree)
+{
+    log_trace("%s", __func__);
+
+    if (node == NULL || (lo == NULL && hi == NULL))
+        return node_aggregate(node, tree);
+
+    if (node->type == LEAF)
+    {
+        bool inside = (lo == NULL || LESS != comparator(node->key, lo, tree)) &&
+                      (hi == NULL || GREATER != comparator(node->key, hi, tree));
+
+        return inside ? node_aggregate(node, tree) : tree->identity;
+    }
+
+    const Node_2_3 *children[3] = { node->first, node->second, node->third };
+    TreeKey mins[4] = { NULL, node->second_min, node->third ? node->third_min : NULL, NULL };
+    double result = tree->identity;
+
+
+    for (int i = 0; i < 3 && children[i]; i++)
+    {
+        TreeKey from = mins[i], to = mins[i+1];
+
+        /* Keys of child are smaller than lo */
+        if (lo && to && LESS != comparator(lo, to, tree))
+            continue;
+
+        /* Keys of child and next ones are greater than hi */
+        if (hi && from && GREATER == comparator(from, hi, tree))
+            break;
+
+        TreeKey child_lo = (lo && from && LESS != comparator(from, lo, tree)) ? NULL : lo;
+        TreeKey child_hi = (hi && to && LESS != comparator(hi, to, tree)) ? NULL : hi;
+
+        result = tree->combine(result, range_aggregate(children[i], child_lo, child_hi, tree));
+    }
+
+    return result;
+}
+
+
+/* Remove the minimal (or maximal) alive leaf and return its key,
+ * which isn't released. Dead leafs met on the way are removed too */
+static TreeKey pop_extreme(Tree_2_3 *tree, bool to_right)
+{
+    log_trace("%s", __func__);
+
+    while (tree->root)
+    {
+        Node_2_3 *leaf = NULL;
+
+        OP_STAT_INC(tree, removes);
+
+        if (tree->root->type == LEAF)
+        {
+            leaf = tree->root;
+            tree->root = NULL;
+            tree->height = 0;
+        }
+        else
+        if (detach_extreme(tree->root, tree, to_right, &leaf))
+        {
+            /* the root has only one child left */
+            Node_2_3 *tmp = tree->root->first;
+
+            release_node(tree->root, tree);
+            tree->root = tmp;
+            tree->height--;
+        }
+
+        if (leaf->dead)
+        {
+            tree->dead--;
+            free_node(leaf, tree);
+            continue;
+        }
+
+        TreeKey key = leaf->key;
+
+        cache_forget(tree, key);
+        count_key(tree, key, false);
+        release_node(leaf, tree);
+
+        tree->elements--;
+        bloom_key_removed(tree);
+
+        return key;
+    }
+
+    return NULL;
+}
+
+
+/* Mark the alive leaf as dead, the tree is compacted if dead leafs are too many */
+static void bury_leaf(Tree_2_3 *tree, Node_2_3 *leaf)
+{
+    log_trace("%s", __func__);
+
+    leaf->dead = true;
+    tree->elements--;
+    tree->dead++;
+
+    if (tree->value_key)
+        refresh_aggregates(leaf, tree);
+
+    if (tree->elements == 0 || tree->dead > tree->dead_ratio * (tree->elements + tree->dead))
+        compact_tree(tree);
+
+    bloom_key_removed(tree);
+}
+
+
+/* Mark the leaf with value as dead without changing the structure */
+static bool bury_value(Tree_2_3 *tree, TreeKey value)
+{
+    log_trace("%s", __func__);
+
+    Node_2_3 *leaf = search_value(tree->root, value, tree);
+
+    if (leaf == NULL || leaf->dead)
+        return false;
+
+    bury_leaf(tree, leaf);
+
+    return true;
+}
+
+
+/* Remove the leaf and release it, going up by parents. Nodes are repaired
+ * as by delete_value(), but the way to the leaf isn't searched by key */
+static void unlink_leaf(Tree_2_3 *tree, Node_2_3 *leaf)
+{
+    log_trace("%s", __func__);
+
+    TreeKey key = leaf->key;
+    Node_2_3 *deleted = leaf;
+    Node_2_3 *node = parent_of(leaf, tree);
+
+
+    while (node != NULL)
+    {
+        Node_2_3 *up = parent_of(node, tree);
+
+        OP_STAT_INC(tree, remove_visits);
+
+        if (deleted)
+            deleted = drop_child(node, deleted, tree);
+        else
+        {
+            /* The key was the minimum of child, so the separator is taken again */
+            if (node->second_min == key)
+                node->second_min = get_min(node->second);
+            else
+            if (node->third && node->third_min == key)
+                node->third_min = get_min(node->third);
+
+            update_size(node, tree);
+        }
+
+        node = up;
+    }
+
+    /* The root has only one child left, or the leaf was the root */
+    if (deleted != NULL)
+    {
+        if (tree->root->type == INNER)
+        {
+            Node_2_3 *tmp = tree->root->first;
+
+            release_node(tree->root, tree);
+            tree->root = tmp;
+            tree->height--;
+        }
+        else
+        {
+            tree->root = NULL;
+            tree->height = 0;
+        }
+    }
+
+    free_node(leaf, tree);
+}
+
+
+/* Leaf next to <node> (to the right or left) in order, dead leafs aren't skipped */
+static const Node_2_3 * step_leaf(const Tree_2_3 *tree, const Node_2_3 *node, bool to_right)
+{
+    log_trace("%s", __func__);
+
+    const Node_2_3 *parent = NULL;
+
+    while ((parent = parent_of(node, tree)) != NULL)
+    {
+        const Node_2_3 *brother = NULL;
+
+        if (to_right)
+            brother = (node == parent->first) ? parent->second : (node == parent->second) ? parent->third : NULL;
+        else
+            brother = (node == parent->third) ? parent->second : (node == parent->second) ? parent->first : NULL;
+
+        if (brother)
+            return to_right ? get_min_node(brother) : get_max_node(brother);
+
+        node = parent;
+    }
+
+    return NULL;
+}
+
+
+/* Index of the smallest key in subtree of Eytzinger position <k>, 0 if it's empty */
+static size_t frozen_leftmost(size_t k, size_t count)
+{
+    if (k > count)
+        return 0;
+
+    while (2 * k <= count)
+        k = 2 * k;
+
+    return k;
+}
+
+
+/* Index of the next key in ascending order, 0 after the last one */
+static size_t frozen_next(size_t k, size_t count)
+{
+    if (2 * k + 1 <= count)
+        return frozen_leftmost(2 * k + 1, count);
+
+    /* climb while coming from the right child */
+    while (k & 1)
+        k >>= 1;
+
+    return k >> 1;
+}
+
+
+/* Index of the first key not less than <value>, 0 if there is no such key.
+ * The way is kept in bits of index: the last left turn is the answer */
+static size_t frozen_lower_index(const TreeFrozen *frozen, TreeKey value)
+{
+    log_trace("%s", __func__);
+
+    const TreeKey *keys = frozen->keys;
+    size_t k = 1;
+
+
+    while (k <= frozen->count)
+    {
+        PREFETCH(keys + FROZEN_STRIDE * k);
+        k = 2 * k + (frozen->cmp_key(keys[k], value) < 0);
+    }
+
+    while (k & 1)
+        k >>= 1;
+
+    return k >> 1;
+}
+
+
+/* Place keys in Eytzinger order as they come in ascending order */
+struct frozen_fill
+{
+    TreeFrozen *frozen;
+    size_t k;
+};
+
+
+static bool fill_frozen(TreeKey key, void *context)
+{
+    struct frozen_fill *fill = context;
+
+    fill->frozen->keys[fill->k] = key;
+    fill->k = frozen_next(fill->k, fill->frozen->count);
+
+    return true;
+}
+
+
+/* Return index of the first key in keys[from..count) not less than <key>.
+ * The step grows exponentially, so a long run costs logarithm of its length */
+static size_t gallop(const TreeKey *keys, size_t from, size_t count, TreeKey key, const Tree_2_3 *tree)
+{
+    log_trace("%s", __func__);
+
+    size_t low = from;
+    size_t bound = 1;
+
+
+    while (from + bound - 1 < count && LESS == comparator(keys[from + bound - 1], key, tree))
+    {
+        low = from + bound;
+        bound <<= 1;
+    }
+
+    size_t high = MIN(from + bound - 1, count);
+
+    while (low < high)
+    {
+        size_t mid = low + (high - low) / 2;
+
+        if (LESS == comparator(keys[mid], key, tree))
+            low = mid + 1;
+        else
+            high = mid;
+    }
+
+    return low;
+}
+
+
+/* Merge ordered keys of two sets into <result> according to operation.
+ * When one set is much smaller, skip runs of the other one by galloping */
+static size_t merge_keys(const TreeKey *a, size_t len_a, const TreeKey *b, size_t len_b,
+                         enum set_operation operation, const Tree_2_3 *tree, TreeKey *result)
+{
+    log_trace("%s", __func__);
+
+    bool gallop_a = len_b * GALLOP_RATIO < len_a;
+    bool gallop_b = len_a * GALLOP_RATIO < len_b;
+    size_t i = 0, j = 0, count = 0;
+
+
+    while (i < len_a && j < len_b)
+    {
+        if (gallop_a)
+        {
+            size_t next = gallop(a, i, len_a, b[j], tree);
+
+            if (operation != SET_INTERSECTION)
+                while (i < next)
+                    result[count++] = a[i++];
+
+            i = next;
+            if (i == len_a)
+                break;
+        }
+        else
+        if (gallop_b)
+        {
+            size_t next = gallop(b, j, len_b, a[i], tree);
+
+            if (operation == SET_UNION)
+                while (j < next)
+                    result[count++] = b[j++];
+
+            j = next;
+            if (j == len_b)
+                break;
+        }
+
+        switch (comparator(a[i], b[j], tree))
+        {
+            case LESS:
+                        if (operation != SET_INTERSECTION)
+                            result[count++] = a[i];
+                        i++;
+                        break;
+
+            case GREATER:
+                        if (operation == SET_UNION)
+                            result[count++] = b[j];
+                        j++;
+                        break;
+
+            default:    /* key in both sets */
+                        if (operation != SET_DIFFERENCE)
+                            result[count++] = a[i];
+                        i++;
+                        j++;
+                        break;
+        }
+    }
+
+    if (operation != SET_INTERSECTION)
+        while (i < len_a)
+            result[count++] = a[i++];
+
+    if (operation == SET_UNION)
+        while (j < len_b)
+            result[count++] = b[j++];
+
+    return count;
+}
+
+
+/* Make new tree with keys of set operation over <a> and <b> */
+static Tree_2_3 * set_operation(const Tree_2_3 *a, const Tree_2_3 *b, enum set_operation operation)
+{
+    log_trace("%s", __func__);
+
+    if (a == NULL || b == NULL)
+    {
+        log_warn("Try work with not existing(nullable) tree!");
+        return NULL;
+    }
+
+    if (a->cmp_key != b->cmp_key ||
+        a->copy_key != b->copy_key ||
+        a->free_key != b->free_key ||
+        a->intrusive != b->intrusive)
+    {
+        log_warn("Try combine trees with different key functions!");
+        return NULL;
+    }
+
+    /* Without copy function the result gets the same pointers as sources,
+     * so it borrows keys and mustn't free them */
+    func_free_key free_key = a->copy_key ? a->free_key : NULL;
+    Tree_2_3 *result = tree_create_ex(a->cmp_key, a->copy_key, free_key, &a->allocator);
+
+    if (result == NULL)
+        return NULL;
+
+    tree_set_lazy_delete(result, a->lazy_delete, a->dead_ratio);
+    result->size_key = a->size_key;
+    result->value_key = a->value_key;
+    result->combine = a->combine;
+    result->identity = a->identity;
+
+
+    size_t len_a = 0, len_b = 0;
+    TreeKey *keys_a = malloc(sizeof(TreeKey) * (a->elements + 1));
+    TreeKey *keys_b = malloc(sizeof(TreeKey) * (b->elements + 1));
+    TreeKey *merged = malloc(sizeof(TreeKey) * (a->elements + b->elements + 1));
+
+    if (!keys_a || !keys_b || !merged)
+    {
+        log_fatal("Cannot allocate required memory!");
+        exit(EXIT_FAILURE);
+    }
+
+    collect_keys(a->root, keys_a, &len_a);
+    collect_keys(b->root, keys_b, &len_b);
+
+    size_t count = merge_keys(keys_a, len_a, keys_b, len_b, operation, a, merged);
+    build_tree(result, merged, count);
+
+    free(keys_a);
+    free(keys_b);
+    free(merged);
+
+    return result;
+}
+
+
+/* ------------------------------------------------------------------------- */
+
+
+/** Creates an empty tree with functions to operate on the key value */
+Tree_2_3 * tree_create(func_cmp_key key_cmp, func_copy_key key_copy, func_free_key key_free)
+{
+    log_trace("%s", __func__);
+
+    return tree_create_ex(key_cmp, key_copy, key_free, NULL);
+}
+
+
+Tree_2_3 * tree_create_ex(func_cmp_key key_cmp, func_copy_key key_copy, func_free_key key_free,
+                          const TreeAllocator *allocator)
+{
+    log_trace("%s", __func__);
+
+    if (!key_cmp)
+    {
+        log_error("Need to state key functions --> [Necessarily: compare]; [Optional: copy, free]");
+        exit(EXIT_FAILURE);
+    }
+
+    if (allocator == NULL)
+        allocator = &default_allocator;
+
+    if (allocator->alloc == NULL || allocator->free == NULL)
+    {
+        log_warn("Try create Tree_2_3 with incomplete allocator!");
+        return NULL;
+    }
+
+    Tree_2_3 *tmp = allocator->alloc(sizeof(*tmp), allocator->ctx);
+    
+    /* maybe it's better to exit with an error */
+    if (!tmp)
+    {
+        log_warn("Failed to allocate memory for create Tree_2_3");
+        return NULL;
+    }
+
+    *tmp = (struct _tree){ 
+        .root=NULL,
+        .elements=0,
+        .height=0,
+        .dead_ratio=DEAD_RATIO,
+        .cmp_key=key_cmp, 
+        .copy_key=key_copy, 
+        .free_key=key_free,
+        .allocator=*allocator
+    };
+
+#ifdef TREE_OP_STATS
+    /* not from allocator, so counters don't change memory seen by it */
+    tmp->op_stats = calloc(1, sizeof(TreeOpStats));
+
+    if (!tmp->op_stats)
+    {
+        log_warn("Failed to allocate memory for create Tree_2_3");
+        allocator->free(tmp, sizeof(*tmp), allocator->ctx);
+        return NULL;
+    }
+#endif
+
+    return tmp;
+}
+
+
+Tree_2_3 * tree_create_strings(void)
+{
+    log_trace("%s", __func__);
+
+    Tree_2_3 *tree = tree_create(compare_strings, copy_string, free_string);
+
+    if (tree)
+        tree->size_key = size_string;
+
+    return tree;
+}
+
+
+Tree_2_3 * tree_create_intrusive(func_cmp_key key_cmp, const TreeAllocator *allocator)
+{
+    log_trace("%s", __func__);
+
+    Tree_2_3 *tree = tree_create_ex(key_cmp, NULL, NULL, allocator);
+
+    if (tree)
+        tree->intrusive = true;
+
+    return tree;
+}
+
+
+size_t tree_string_decode(TreeKey key, void *buffer, size_t size)
+{
+    log_trace("%s", __func__);
+
+    if (key == NULL)
+    {
+        log_warn("Try decode nullable key!");
+        return 0;
+    }
+
+    struct string_view view;
+    uint32_t length = 0;
+    int span = 0;
+
+
+    view_string(key, &view);
+
+    while (view_byte(&view, &span, length) >= 0)
+        length++;
+
+    if (buffer == NULL || size < (size_t)length + 1)
+        return (size_t)length + 1;
+
+    span = 0;
+
+    for (uint32_t pos = 0; pos < length; pos++)
+        ((char*)buffer)[pos] = (char)view_byte(&view, &span, pos);
+
+    ((char*)buffer)[length] = '\0';
+
+    return (size_t)length + 1;
+}
+
+
+void tree_string_free(TreeKey key)
+{
+    log_trace("%s", __func__);
+
+    if (key == NULL || !is_string_key(key))
+    {
+        log_warn("Try free not stored key of string tree!");
+        return;
+    }
+
+    free_string(key);
+}
+
+
+/* Insert value in tree if it's not there */
+bool tree_insert_key(Tree_2_3 *tree, TreeKey value)
+{
+    log_trace("%s", __func__);
+
+    /* NULL key */
+    if (value == NULL)
+    {
+        log_warn("Try insert nullable key!");
+        return false;
+    }
+
+    /* NULL tree(not exists) 
+     * TODO: maybe better exit with exception/error? */
+    if (tree == NULL)
+    {
+        log_warn("Try insert element in not existing(nullable) tree!");
+        return false;
+    }
+
+    if (string_key_refused(tree->cmp_key, value))
+        return false;
+
+    OP_STAT_INC(tree, inserts);
+
+    bool duplicated = false;
+
+    insert_value(tree, value, &duplicated);
+
+    if (duplicated)
+    {
+        log_debug("Try insert duplicated value in tree");
+        return false;
+    }
+
+    return true;
+}
+
+
+/* Insert value next to the leaf <hint>, if hint is an end of tree
+ * and value goes after (before) it, the leaf is hanged without descent.
+ * Otherwise the descent starts from the lowest ancestor of hint holding value */
+const Node_2_3 * tree_insert_hint(Tree_2_3 *tree, TreeKey value, const Node_2_3 *hint)
+{
+    log_trace("%s", __func__);
+
+    if (tree == NULL || value == NULL)
+    {
+        log_warn("Try insert nullable key or in not existing(nullable) tree!");
+        return NULL;
+    }
+
+    if (string_key_refused(tree->cmp_key, value))
+        return NULL;
+
+    OP_STAT_INC(tree, inserts);
+
+    /* Ends of tree are found by pointers, so a stale hint costs no comparisons */
+    if (hint != NULL && !tree_is_empty(tree))
+    {
+        if (hint == get_max_node(tree->root) && GREATER == comparator(value, hint->key, tree))
+            return attach_leaf(tree, value, true);
+
+        if (hint == get_min_node(tree->root) && LESS == comparator(value, hint->key, tree))
+            return attach_leaf(tree, value, false);
+    }
+
+    bool duplicated = false;
+    Node_2_3 *leaf = NULL;
+
+    /* Leafs are given out as const only to keep them from the caller.
+     * Unlinked leaf of intrusive tree has no place to start from */
+    if (hint != NULL && hint->type == LEAF && !tree_is_empty(tree))
+        leaf = insert_near(tree, value, (Node_2_3*)hint, &duplicated);
+    else
+        leaf = insert_value(tree, value, &duplicated);
+
+    if (duplicated)
+    {
+        log_debug("Try insert duplicated value in tree");
+        return NULL;
+    }
+
+    return leaf;
+}
+
+
+/* Return the leaf with value, insert value if it's not there */
+const Node_2_3 * tree_find_or_insert(Tree_2_3 *tree, TreeKey value, bool *inserted)
+{
+    log_trace("%s", __func__);
+
+    if (tree == NULL || value == NULL)
+    {
+        log_warn("Try insert nullable key or in not existing(nullable) tree!");
+        return NULL;
+    }
+
+    if (string_key_refused(tree->cmp_key, value))
+        return NULL;
+
+    OP_STAT_INC(tree, inserts);
+
+    bool duplicated = false;
+    Node_2_3 *leaf = insert_value(tree, value, &duplicated);
+
+    if (inserted != NULL)
+        *inserted = !duplicated;
+
+    return leaf;
+}
+
+
+/* Swap the stored key equal to value without changing the structure */
+bool tree_replace_key(Tree_2_3 *tree, TreeKey value)
+{
+    log_trace("%s", __func__);
+
+    if (tree == NULL || value == NULL)
+    {
+        log_warn("Try replace nullable key or in not existing(nullable) tree!");
+        return false;
+    }
+
+    if (string_key_refused(tree->cmp_key, value))
+        return false;
+
+    if (tree_is_empty(tree))
+        return false;
+
+    /* The key of intrusive tree is the leaf itself */
+    if (tree->intrusive)
+    {
+        log_warn("Try replace key in intrusive tree!");
+        return false;
+    }
+
+    return swap_key(tree, value);
+}
+
+
+/* Removes the key from the tree if it contains one */
+bool tree_remove_key(Tree_2_3 *tree, TreeKey value)
+{
+    log_trace("%s", __func__);
+    
+    /* NULL key */
+    if (value == NULL)
+    {
+        log_warn("Try remove nullable key!");
+        return false;
+    }
+
+    /* NULL tree(not exists) 
+     * TODO: maybe better exit with exception/error? */
+    if (tree == NULL)
+    {
+        log_warn("Try remove element in not existing(nullable) tree!");
+        return false;
+    }
+
+    if (string_key_refused(tree->cmp_key, value))
+        return false;
+
+    /* Empty tree */
+    if (tree_is_empty(tree))
+    {
+        log_warn("Try remove element in empty tree!");
+        return false;
+    }
+
+    OP_STAT_INC(tree, removes);
+
+    if (bloom_rejects(tree, value))
+        return false;
+
+    cache_forget(tree, value);
+
+    if (tree->lazy_delete)
+        return bury_value(tree, value);
+
+    /* Key not in tree */
+    // лишняя процедура
+    //if (!search_key(tree, value))
+    //    return;
+
+
+    bool finded = true;
+    Node_2_3 *tmp = NULL;
+    Node_2_3 *deleted = delete_value(tree->root, value, tree, &finded);
+
+
+    if (!finded)
+        return false;
+
+    tree->elements--;
+
+    /* Need to update the root of tree
+     * because he had only one child left */
+    if (deleted != NULL)
+    {
+        if (tree->root->type == INNER)
+        {
+            tmp = tree->root->first;
+            release_node(tree->root, tree);
+            tree->root = tmp;
+            tree->height--;
+        }
+        else /* Make tree empty */
+        {
+            tree_make_empty(tree);
+        }
+    }
+
+    bloom_key_removed(tree);
+
+    return true;
+}
+
+
+/* Removes the leaf got from search, the tree is repaired from the leaf up */
+bool tree_remove_node(Tree_2_3 *tree, const Node_2_3 *node)
+{
+    log_trace("%s", __func__);
+
+    if (tree == NULL || node == NULL)
+    {
+        log_warn("Try remove nullable node or in not existing(nullable) tree!");
+        return false;
+    }
+
+    if (node->type != LEAF)
+    {
+        log_warn("Try remove node which isn't a leaf!");
+        return false;
+    }
+
+    /* Removed already in lazy mode */
+    if (node->dead)
+        return false;
+
+    OP_STAT_INC(tree, removes);
+
+    /* Leafs are given out as const only to keep them from the caller */
+    Node_2_3 *leaf = (Node_2_3*)node;
+
+    cache_forget(tree, leaf->key);
+
+    if (tree->lazy_delete)
+    {
+        bury_leaf(tree, leaf);
+        return true;
+    }
+
+    unlink_leaf(tree, leaf);
+    tree->elements--;
+
+    bloom_key_removed(tree);
+
+    return true;
+}
+
+
+bool tree_link(Tree_2_3 *tree, TreeHook *hook)
+{
+    log_trace("%s", __func__);
+
+    if (tree == NULL || hook == NULL || !tree->intrusive)
+    {
+        log_warn("Try link nullable hook or in not intrusive tree!");
+        return false;
+    }
+
+    return tree_insert_key(tree, hook);
+}
+
+
+bool tree_unlink(Tree_2_3 *tree, TreeHook *hook)
+{
+    log_trace("%s", __func__);
+
+    if (tree == NULL || hook == NULL || !tree->intrusive)
+    {
+        log_warn("Try unlink nullable hook or in not intrusive tree!");
+        return false;
+    }
+
+    const Node_2_3 *leaf = (const Node_2_3*)hook;
+
+    /* The hook of unlinked object isn't a leaf */
+    if (leaf->type != LEAF)
+        return false;
+
+    return tree_remove_node(tree, leaf);
+}
+
+
+TreeKey tree_pop_min(Tree_2_3 *tree)
+{
+    log_trace("%s", __func__);
+
+    if (tree == NULL)
+    {
+        log_warn("Try pop key from not existing(nullable) tree!");
+        return NULL;
+    }
+
+    return pop_extreme(tree, false);
+}
+
+
+TreeKey tree_pop_max(Tree_2_3 *tree)
+{
+    log_trace("%s", __func__);
+
+    if (tree == NULL)
+    {
+        log_warn("Try pop key from not existing(nullable) tree!");
+        return NULL;
+    }
+
+    return pop_extreme(tree, true);
+}
+
+
+/* In lazy mode removed leafs are only marked, the tree is compacted
+ * when part of dead leafs is bigger than <dead_ratio> */
+void tree_set_lazy_delete(Tree_2_3 *tree, bool enabled, double dead_ratio)
+{
+    log_trace("%s", __func__);
+
+    if (tree == NULL)
+    {
+        log_warn("Try set lazy deletion for not existing(nullable) tree!");
+        return;
+    }
+
+    /* Object of user may be released right after unlink */
+    if (tree->intrusive && enabled)
+    {
+        log_warn("Try set lazy deletion for intrusive tree!");
+        return;
+    }
+
+    tree->lazy_delete = enabled;
+    tree->dead_ratio = (dead_ratio > 0 && dead_ratio <= 1) ? dead_ratio : DEAD_RATIO;
+
+    if (!enabled)
+        compact_tree(tree);
+}
+
+
+/* Release dead leafs and rebuild the tree */
+void tree_compact(Tree_2_3 *tree)
+{
+    log_trace("%s", __func__);
+
+    if (tree == NULL)
+    {
+        log_warn("Try compact not existing(nullable) tree!");
+        return;
+    }
+
+    compact_tree(tree);
+}
+
+
+/* Keys already in tree are counted once, than memory is counted on insert and remove */
+void tree_set_size_func(Tree_2_3 *tree, func_size_key size_key)
+{
+    log_trace("%s", __func__);
+
+    if (tree == NULL)
+    {
+        log_warn("Try set size function for not existing(nullable) tree!");
+        return;
+    }
+
+    tree->size_key = size_key;
+    tree->key_bytes = 0;
+
+    if (size_key)
+        count_all_keys(tree->root, tree);
+}
+
+
+/* Counts of nodes by type are taken from the counters of root,
+ * with L leafs and I inner nodes there are I + L - 1 edges, so
+ * 3-nodes are I3 = L - 1 - I */
+void tree_memory_stats(const Tree_2_3 *tree, TreeMemoryStats *stats)
+{
+    log_trace("%s", __func__);
+
+    if (tree == NULL || stats == NULL)
+    {
+        log_warn("Try get memory stats of not existing(nullable) tree!");
+        return;
+    }
+
+    unsigned long leafs = node_size(tree->root);
+    unsigned long inners = node_inners(tree->root);
+
+    *stats = (TreeMemoryStats){
+        .leafs = leafs,
+        .dead = tree->dead,
+        .inner_3 = inners ? leafs - 1 - inners : 0,
+        .node_bytes = (inners + (tree->intrusive ? 0 : leafs)) * sizeof(Node_2_3) + sizeof(*tree),
+        .key_bytes = tree->key_bytes,
+        .filter_bytes = tree->bloom ? tree->bloom->count_blocks * CACHE_LINE + sizeof(*tree->bloom) : 0,
+        .cache_bytes = tree->cache ? tree->cache->count_sets * CACHE_LINE + sizeof(*tree->cache) : 0,
+        .height = tree->height,
+    };
+
+    stats->inner_2 = inners - stats->inner_3;
+    stats->fill_factor = inners ? (double)(inners + leafs - 1) / (3.0 * inners) : 0;
+}
+
+
+/* Counters are kept only if library is built with TREE_OP_STATS */
+bool tree_get_op_stats(const Tree_2_3 *tree, TreeOpStats *stats)
+{
+    log_trace("%s", __func__);
+
+    if (tree == NULL || stats == NULL)
+    {
+        log_warn("Try get operation stats of not existing(nullable) tree!");
+        return false;
+    }
+
+#ifdef TREE_OP_STATS
+    *stats = *tree->op_stats;
+    return true;
+#else
+    *stats = (TreeOpStats){ 0 };
+    return false;
+#endif
+}
+
+
+void tree_reset_op_stats(Tree_2_3 *tree)
+{
+    log_trace("%s", __func__);
+
+    if (tree == NULL)
+    {
+        log_warn("Try reset operation stats of not existing(nullable) tree!");
+        return;
+    }
+
+#ifdef TREE_OP_STATS
+    *tree->op_stats = (TreeOpStats){ 0 };
+#endif
+}
+
+
+/* Count of probes k = ln2 * bits per key gives the least false positives */
+void tree_set_bloom_filter(Tree_2_3 *tree, func_hash_key hash_key, int bits_per_key)
+{
+    log_trace("%s", __func__);
+
+    if (tree == NULL)
+    {
+        log_warn("Try set Bloom filter for not existing(nullable) tree!");
+        return;
+    }
+
+    bloom_free(tree->bloom);
+    tree->bloom = NULL;
+
+    if (hash_key == NULL)
+        return;
+
+    tree->bloom = calloc(1, sizeof(*tree->bloom));
+
+    if (tree->bloom == NULL)
+    {
+        log_fatal("Cannot allocate required memory!");
+        exit(EXIT_FAILURE);
+    }
+
+    bits_per_key = bits_per_key > 0 ? bits_per_key : BLOOM_BITS_PER_KEY;
+
+    tree->bloom->hash_key = hash_key;
+    tree->bloom->bits_per_key = bits_per_key;
+    tree->bloom->probes = MIN(MAX((int)(bits_per_key * 0.69 + 0.5), 1), BLOOM_MAX_PROBES);
+
+    bloom_rebuild(tree);
+}
+
+
+/* Sets are cache lines, so their count is the capacity divided by ways */
+void tree_set_lookup_cache(Tree_2_3 *tree, func_hash_key hash_key, int count_entries)
+{
+    log_trace("%s", __func__);
+
+    if (tree == NULL)
+    {
+        log_warn("Try set lookup cache for not existing(nullable) tree!");
+        return;
+    }
+
+    cache_free(tree->cache);
+    tree->cache = NULL;
+
+    if (hash_key == NULL)
+        return;
+
+    size_t count_sets = 1;
+    size_t need_sets = (count_entries > 0 ? count_entries : CACHE_ENTRIES) / CACHE_WAYS;
+
+    while (count_sets < need_sets)
+        count_sets *= 2;
+
+    tree->cache = calloc(1, sizeof(*tree->cache));
+
+    if (tree->cache == NULL)
+    {
+        log_fatal("Cannot allocate required memory!");
+        exit(EXIT_FAILURE);
+    }
+
+    tree->cache->entries = aligned_alloc(CACHE_LINE, count_sets * CACHE_LINE);
+
+    if (tree->cache->entries == NULL)
+    {
+        log_fatal("Cannot allocate required memory!");
+        exit(EXIT_FAILURE);
+    }
+
+    tree->cache->count_sets = count_sets;
+    tree->cache->hash_key = hash_key;
+
+    cache_clear(tree);
+}
+
+
+bool tree_get_cache_stats(const Tree_2_3 *tree, TreeCacheStats *stats)
+{
+    log_trace("%s", __func__);
+
+    if (tree == NULL || stats == NULL)
+    {
+        log_warn("Try get cache stats of not existing(nullable) tree!");
+        return false;
+    }
+
+    if (tree->cache == NULL)
+    {
+        *stats = (TreeCacheStats){ 0 };
+        return false;
+    }
+
+    *stats = (TreeCacheStats){
+        .hits = tree->cache->hits,
+        .misses = tree->cache->misses,
+        .entries = tree->cache->count_sets * CACHE_WAYS,
+    };
+
+    return true;
+}
+
+
+double tree_aggregate_sum(double a, double b)
+{
+    return a + b;
+}
+
+
+double tree_aggregate_min(double a, double b)
+{
+    return MIN(a, b);
+}
+
+
+double tree_aggregate_max(double a, double b)
+{
+    return MAX(a, b);
+}
+
+
+/* Aggregates of all inner nodes are recounted once, than they are kept by update_size() */
+void tree_set_aggregate(Tree_2_3 *tree, func_value_key value_key, func_combine combine, double identity)
+{
+    log_trace("%s", __func__);
+
+    if (tree == NULL)
+    {
+        log_warn("Try set aggregate for not existing(nullable) tree!");
+        return;
+    }
+
+    if (value_key && combine == NULL)
+    {
+        log_warn("Try set aggregate without combine function!");
+        return;
+    }
+
+    tree->value_key = value_key;
+    tree->combine = combine;
+    tree->identity = identity;
+
+    if (value_key)
+        aggregate_all(tree->root, tree);
+}
+
+
+bool tree_range_aggregate(const Tree_2_3 *tree, TreeKey lo, TreeKey hi, double *result)
+{
+    log_trace("%s", __func__);
+
+    if (tree == NULL || result == NULL)
+    {
+        log_warn("Try get aggregate of not existing(nullable) tree!");
+        return false;
+    }
+
+    if (tree->value_key == NULL)
+    {
+        log_warn("Try get aggregate of tree without aggregate function!");
+        return false;
+    }
+
+    if (string_key_refused(tree->cmp_key, lo) || string_key_refused(tree->cmp_key, hi))
+        return false;
+
+    *result = range_aggregate(tree->root, lo, hi, tree);
+
+    return true;
+}
+
+
+/* Moves keys smaller than <key> to new tree <left>, other keys to new tree <right>.
+ * The source tree stays empty, nodes and keys are moved without copying */
+bool tree_split(Tree_2_3 *tree, TreeKey key, Tree_2_3 **left, Tree_2_3 **right)
+{
+    log_trace("%s", __func__);
+
+    if (tree == NULL || left == NULL || right == NULL)
+    {
+        log_warn("Try split not existing(nullable) tree!");
+        return false;
+    }
+
+    if (key == NULL)
+    {
+        log_warn("Try split tree by nullable key!");
+        return false;
+    }
+
+    if (string_key_refused(tree->cmp_key, key))
+        return false;
+
+    *left = tree_create_ex(tree->cmp_key, tree->copy_key, tree->free_key, &tree->allocator);
+    *right = tree_create_ex(tree->cmp_key, tree->copy_key, tree->free_key, &tree->allocator);
+
+    if (!*left || !*right)
+    {
+        log_warn("Failed to allocate memory for split Tree_2_3");
+
+        release_tree(*left);
+        release_tree(*right);
+        *left = *right = NULL;
+
+        return false;
+    }
+
+    tree_set_lazy_delete(*left, tree->lazy_delete, tree->dead_ratio);
+    tree_set_lazy_delete(*right, tree->lazy_delete, tree->dead_ratio);
+    (*left)->size_key = (*right)->size_key = tree->size_key;
+    (*left)->intrusive = (*right)->intrusive = tree->intrusive;
+
+    /* Aggregates of parts are counted by split with functions of tree */
+    (*left)->value_key = (*right)->value_key = tree->value_key;
+    (*left)->combine = (*right)->combine = tree->combine;
+    (*left)->identity = (*right)->identity = tree->identity;
+
+    if (tree_is_empty(tree))
+        return true;
+
+    compact_tree(tree);
+
+    Branch whole = { .root = tree->root, .height = tree->height, .min = get_min(tree->root) };
+    Branch parts[2];
+
+    split_branch(whole, key, tree, &parts[0], &parts[1]);
+
+    (*left)->root = parts[0].root;
+    (*left)->height = parts[0].height;
+    (*left)->elements = node_size(parts[0].root);
+
+    (*right)->root = parts[1].root;
+    (*right)->height = parts[1].height;
+    (*right)->elements = node_size(parts[1].root);
+
+    /* Memory of keys isn't kept in nodes, so it is counted for the left part */
+    if (tree->size_key)
+    {
+        count_all_keys((*left)->root, *left);
+        (*right)->key_bytes = tree->key_bytes - (*left)->key_bytes;
+    }
+
+    tree->root = NULL;
+    tree->height = 0;
+    tree->elements = 0;
+    tree->key_bytes = 0;
+
+    /* Each part gets the filter of own keys */
+    if (tree->bloom)
+    {
+        tree_set_bloom_filter(*left, tree->bloom->hash_key, tree->bloom->bits_per_key);
+        tree_set_bloom_filter(*right, tree->bloom->hash_key, tree->bloom->bits_per_key);
+        bloom_rebuild(tree);
+    }
+
+    /* Leafs are moved to parts, their caches start empty */
+    if (tree->cache)
+    {
+        int count_entries = tree->cache->count_sets * CACHE_WAYS;
+
+        tree_set_lookup_cache(*left, tree->cache->hash_key, count_entries);
+        tree_set_lookup_cache(*right, tree->cache->hash_key, count_entries);
+        cache_clear(tree);
+    }
+
+    return true;
+}
+
+
+/* Moves all keys of <right> to the end of <left> and destroys <right>.
+ * All keys of <right> must be greater than keys of <left> */
+bool tree_join(Tree_2_3 *left, Tree_2_3 **right)
+{
+    log_trace("%s", __func__);
+
+    if (left == NULL || right == NULL || *right == NULL)
+    {
+        log_warn("Try join not existing(nullable) tree!");
+        return false;
+    }
+
+    if (left == *right)
+    {
+        log_warn("Try join tree with itself!");
+        return false;
+    }
+
+    if (left->cmp_key != (*right)->cmp_key ||
+        left->copy_key != (*right)->copy_key ||
+        left->free_key != (*right)->free_key ||
+        left->intrusive != (*right)->intrusive)
+    {
+        log_warn("Try join trees with different key functions!");
+        return false;
+    }
+
+    /* nodes of right are moved to left and released by its allocator */
+    if (left->allocator.alloc != (*right)->allocator.alloc ||
+        left->allocator.free != (*right)->allocator.free ||
+        left->allocator.ctx != (*right)->allocator.ctx)
+    {
+        log_warn("Try join trees with different allocators!");
+        return false;
+    }
+
+    compact_tree(left);
+    compact_tree(*right);
+
+    if (!tree_is_empty(left) && !tree_is_empty(*right) &&
+        LESS != comparator(tree_get_max(left), tree_get_min(*right), left))
+    {
+        log_warn("Try join trees whose keys are overlapped!");
+        return false;
+    }
+
+
+    Branch first = { .root = left->root, .height = left->height, .min = get_min(left->root) };
+    Branch second = { .root = (*right)->root, .height = (*right)->height, .min = get_min((*right)->root) };
+
+    Branch result = join_branches(first, second, left);
+
+    left->root = result.root;
+    left->height = result.height;
+    left->elements += (*right)->elements;
+    left->key_bytes += (*right)->key_bytes;
+
+    /* Subtrees of right are aggregated by his functions */
+    if (left->value_key && (left->value_key != (*right)->value_key || left->combine != (*right)->combine ||
+                            left->identity != (*right)->identity))
+        aggregate_all(left->root, left);
+
+    if (left->bloom)
+        join_blooms(left, (*right)->bloom);
+
+    bloom_free((*right)->bloom);
+    cache_free((*right)->cache);
+    release_tree(*right);
+    *right = NULL;
+
+    return true;
+}
+
+
+/* New tree with keys which are in <a> or in <b> */
+Tree_2_3 * tree_union(const Tree_2_3 *a, const Tree_2_3 *b)
+{
+    log_trace("%s", __func__);
+
+    return set_operation(a, b, SET_UNION);
+}
+
+
+/* New tree with keys which are both in <a> and in <b> */
+Tree_2_3 * tree_intersection(const Tree_2_3 *a, const Tree_2_3 *b)
+{
+    log_trace("%s", __func__);
+
+    return set_operation(a, b, SET_INTERSECTION);
+}
+
+
+/* New tree with keys of <a> which are not in <b> */
+Tree_2_3 * tree_difference(const Tree_2_3 *a, const Tree_2_3 *b)
+{
+    log_trace("%s", __func__);
+
+    return set_operation(a, b, SET_DIFFERENCE);
+}
+
+
+/* Keys are moved to array, the emptied tree is released without them */
+TreeFrozen * tree_freeze(Tree_2_3 **tree)
+{
+    log_trace("%s", __func__);
+
+    if (tree == NULL || *tree == NULL)
+    {
+        log_warn("Try freeze not existing(nullable) tree!");
+        return NULL;
+    }
+
+    Tree_2_3 *source = *tree;
+    TreeFrozen *frozen = malloc(sizeof(*frozen));
+
+    compact_tree(source);
+
+    /* aligned, so keys [8k, 8k + 8) are one cache line */
+    size_t bytes = (source->elements + 1) * sizeof(TreeKey);
+    TreeKey *keys = aligned_alloc(CACHE_LINE, (bytes + CACHE_LINE - 1) / CACHE_LINE * CACHE_LINE);
+
+    if (frozen == NULL || keys == NULL)
+    {
+        log_warn("Failed to allocate memory for freeze Tree_2_3");
+        free(frozen);
+        free(keys);
+        return NULL;
+    }
+
+    *frozen = (TreeFrozen){
+        .keys = keys,
+        .count = source->elements,
+        .lazy_delete = source->lazy_delete,
+        .dead_ratio = source->dead_ratio,
+        .intrusive = source->intrusive,
+        .cmp_key = source->cmp_key,
+        .copy_key = source->copy_key,
+        .free_key = source->free_key,
+        .size_key = source->size_key,
+        .allocator = source->allocator,
+        .value_key = source->value_key,
+        .combine = source->combine,
+        .identity = source->identity,
+        .bloom_hash = source->bloom ? source->bloom->hash_key : NULL,
+        .bloom_bits = source->bloom ? source->bloom->bits_per_key : 0,
+        .cache_hash = source->cache ? source->cache->hash_key : NULL,
+        .cache_entries = source->cache ? (int)(source->cache->count_sets * CACHE_WAYS) : 0,
+    };
+
+    struct frozen_fill fill = { .frozen = frozen, .k = frozen_leftmost(1, frozen->count) };
+
+    foreach_key(source->root, fill_frozen, &fill);
+
+    /* keys now belong to frozen tree */
+    source->free_key = NULL;
+    source->size_key = NULL;
+    tree_destroy(tree);
+
+    return frozen;
+}
+
+
+/* Keys are collected in ascending order and the tree is built bottom-up over them */
+Tree_2_3 * tree_thaw(TreeFrozen **frozen)
+{
+    log_trace("%s", __func__);
+
+    if (frozen == NULL || *frozen == NULL)
+    {
+        log_warn("Try thaw not existing(nullable) frozen tree!");
+        return NULL;
+    }
+
+    TreeFrozen *source = *frozen;
+    Tree_2_3 *tree = tree_create_ex(source->cmp_key, NULL, source->free_key, &source->allocator);
+    TreeKey *sorted = malloc(sizeof(TreeKey) * (source->count + 1));
+
+    if (tree == NULL || sorted == NULL)
+    {
+        log_warn("Failed to allocate memory for thaw TreeFrozen");
+        release_tree(tree);
+        free(sorted);
+        return NULL;
+    }
+
+    size_t count = 0;
+
+    for (size_t k = frozen_leftmost(1, source->count); k != 0; k = frozen_next(k, source->count))
+        sorted[count++] = source->keys[k];
+
+    /* without copy function the keys are moved to leafs,
+       hooks of intrusive tree are linked again */
+    tree->intrusive = source->intrusive;
+    build_tree(tree, sorted, count);
+
+    tree->copy_key = source->copy_key;
+    tree_set_lazy_delete(tree, source->lazy_delete, source->dead_ratio);
+
+    if (source->size_key)
+        tree_set_size_func(tree, source->size_key);
+
+    if (source->value_key)
+        tree_set_aggregate(tree, source->value_key, source->combine, source->identity);
+
+    if (source->bloom_hash)
+        tree_set_bloom_filter(tree, source->bloom_hash, source->bloom_bits);
+
+    if (source->cache_hash)
+        tree_set_lookup_cache(tree, source->cache_hash, source->cache_entries);
+
+    free(sorted);
+    free(source->keys);
+    free(source);
+    *frozen = NULL;
+
+    return tree;
+}
+
+
+void tree_frozen_destroy(TreeFrozen **frozen)
+{
+    log_trace("%s", __func__);
+
+    if (frozen == NULL || *frozen == NULL)
+    {
+        log_warn("Try destroy not existing(nullable) frozen tree!");
+        return;
+    }
+
+    if ((*frozen)->free_key)
+        for (size_t k = 1; k <= (*frozen)->count; k++)
+            (*frozen)->free_key((*frozen)->keys[k]);
+
+    free((*frozen)->keys);
+    free(*frozen);
+
+    *frozen = NULL;
+}
+
+
+TreeKey tree_frozen_search_key(const TreeFrozen *frozen, TreeKey value)
+{
+    log_trace("%s", __func__);
+
+    if (frozen == NULL || value == NULL)
+        return NULL;
+
+    if (string_key_refused(frozen->cmp_key, value))
+        return NULL;
+
+    size_t k = frozen_lower_index(frozen, value);
+
+    if (k == 0 || frozen->cmp_key(frozen->keys[k], value) != 0)
+        return NULL;
+
+    return frozen->keys[k];
+}
+
+
+TreeKey tree_frozen_lower_bound(const TreeFrozen *frozen, TreeKey value)
+{
+    log_trace("%s", __func__);
+
+    if (frozen == NULL || value == NULL)
+        return NULL;
+
+    if (string_key_refused(frozen->cmp_key, value))
+        return NULL;
+
+    size_t k = frozen_lower_index(frozen, value);
+
+    return k ? frozen->keys[k] : NULL;
+}
+
+
+TreeKey tree_frozen_get_min(const TreeFrozen *frozen)
+{
+    log_trace("%s", __func__);
+
+    if (frozen == NULL || frozen->count == 0)
+        return NULL;
+
+    return frozen->keys[frozen_leftmost(1, frozen->count)];
+}
+
+
+TreeKey tree_frozen_get_max(const TreeFrozen *frozen)
+{
+    log_trace("%s", __func__);
+
+    if (frozen == NULL || frozen->count == 0)
+        return NULL;
+
+    size_t k = 1;
 
-        case EMPTY:
-                    log_error("Tree can't have empty node!");
-                    exit(EXIT_FAILURE);
-        default:
-                    log_error("Undefined type of Node_2_3!");
-                    exit(EXIT_FAILURE);
-    }
+    while (2 * k + 1 <= frozen->count)
+        k = 2 * k + 1;
 
-    /* key not found */
-    return NULL;
+    return frozen->keys[k];
 }
 
 
-/* First free children of tree, than free tree */
-static void tree_free(Node_2_3 *tree)
+int tree_frozen_count_elements(const TreeFrozen *frozen)
 {
     log_trace("%s", __func__);
 
-    if (tree == NULL)
-        return;
+    return frozen ? (int)frozen->count : 0;
+}
 
-    switch (tree->type)
-    {
-        case LEAF:
-                    //get_free_func(tree)(tree->key);
-                    free_key(tree);
-                    break;
 
-        case INNER:
-                    tree_free(tree->first);
-                    tree_free(tree->second);
-                    tree_free(tree->third);
-                    break;
+void tree_frozen_foreach(const TreeFrozen *frozen, func_visit_key visit, void *context)
+{
+    log_trace("%s", __func__);
 
-        case EMPTY:
-                    log_error("Tree can't have empty node!");
-                    exit(EXIT_FAILURE);
+    if (frozen == NULL || visit == NULL)
+    {
+        log_warn("Try iterate not existing(nullable) frozen tree or without visitor!");
+        return;
     }
 
-    //free_node(tree);
-    free(tree);
+    for (size_t k = frozen_leftmost(1, frozen->count); k != 0; k = frozen_next(k, frozen->count))
+        if (!visit(frozen->keys[k], context))
+            return;
 }
 
 
-/* print all elemnts in tree in ascending order */
-static void print_tree_elements_in_order(Node_2_3 *node, int *num_element, func_print_key print_key)
+/* Return addres leaf with value or null if value not found
+ * Wrapper function for finding the key. It is necessary that the user
+ * does not call the root of the tree, but simply passes the tree itself */
+const Node_2_3 * tree_search_key(const Tree_2_3 *tree, TreeKey value)
 {
     log_trace("%s", __func__);
 
-    if (node == NULL)
-        return;
+    if (string_key_refused(tree->cmp_key, value))
+        return NULL;
 
+    OP_STAT_INC(tree, searches);
 
-    //static int height = 0;
+    uint64_t hash = 0;
+    Node_2_3 *leaf = cache_lookup(tree, value, &hash);
 
-    if (node->type == LEAF)
-    {
-        (*num_element)++;
-        printf("%d) ", *num_element);
-        print_key(node->key);
-        //printf(" height: %u", height+1);
-        putchar('\n');
+    if (leaf != NULL)
+        return leaf;
 
-        return;
-    }
+    if (bloom_rejects(tree, value))
+        return NULL;
 
-    //height++;
+    leaf = search_value(tree->root, value, tree);
 
-    /* determines the order in which the tree is traversed (ascending) */
-    print_tree_elements_in_order(node->first, num_element, print_key);
-    print_tree_elements_in_order(node->second, num_element, print_key);
-    print_tree_elements_in_order(node->third, num_element, print_key);
+    if (leaf == NULL || leaf->dead)
+        return NULL;
 
-   // height--;
+    cache_store(tree, hash, leaf);
+
+    return leaf;
 }
 
 
-static int node_height(Node_2_3 *node)
+/* Lookups answered by cache or Bloom filter don't take place in groups */
+size_t tree_search_batch(const Tree_2_3 *tree, const TreeKey *values, size_t count, const Node_2_3 **found)
 {
     log_trace("%s", __func__);
 
-    if (node == NULL)
+    if (tree == NULL || (count > 0 && (values == NULL || found == NULL)))
     {
-        log_debug("Try get height for NULL node");
+        log_warn("Try search batch in not existing(nullable) tree or to nullable array!");
         return 0;
     }
 
-    if (node->type == LEAF)
-    {
-        log_debug("Get to leaf node");
-        return 1;
-    }
-
+    size_t count_found = 0;
+    size_t pending = 0;
+    size_t indexes[BATCH_GROUP];
+    TreeKey group[BATCH_GROUP];
+    uint64_t hashes[BATCH_GROUP];
+    Node_2_3 *leafs[BATCH_GROUP];
 
-    int heights[] = {
-        node_height(node->first),
-        node_height(node->second),
-        node_height(node->third)
-    };
+    OP_STAT_ADD(tree, searches, count);
 
-    if ( ((heights[0] && heights[1]) && (heights[0] != heights[1])) || 
-         ((heights[0] && heights[2]) && (heights[0] != heights[2])) ||
-         ((heights[1] && heights[2]) && (heights[1] != heights[2])) 
-        )
+    for (size_t i = 0; i < count; i++)
     {
-        log_error("Violation of tree consistency. Different heights of the branches were discovered!");
-        log_error("first: %d, second: %d, third: %d", heights[0], heights[1], heights[2]);
-    }
+        uint64_t hash = 0;
+        bool refused = string_key_refused(tree->cmp_key, values[i]);
 
+        found[i] = refused ? NULL : cache_lookup(tree, values[i], &hash);
 
-    return 1 + MAX(heights[0], MAX(heights[1], heights[2]));
-}
+        if (found[i] == NULL && !refused && tree->root != NULL && !bloom_rejects(tree, values[i]))
+        {
+            indexes[pending] = i;
+            group[pending] = values[i];
+            hashes[pending] = hash;
+            pending++;
+        }
 
+        count_found += found[i] != NULL;
 
-/* ------------------------------------------------------------------------- */
+        if (pending < BATCH_GROUP && (pending == 0 || i + 1 < count))
+            continue;
 
+        search_group(tree, group, pending, leafs);
 
-/** Creates an empty tree with functions to operate on the key value */
-Tree_2_3 * tree_create(func_cmp_key key_cmp, func_copy_key key_copy, func_free_key key_free)
-{
-    log_trace("%s", __func__);
+        for (size_t g = 0; g < pending; g++)
+        {
+            found[indexes[g]] = leafs[g];
 
-    if (!key_cmp)
-    {
-        log_error("Need to state key functions --> [Necessarily: compare]; [Optional: copy, free]");
-        exit(EXIT_FAILURE);
-    }
+            if (leafs[g] != NULL)
+            {
+                cache_store(tree, hashes[g], leafs[g]);
+                count_found++;
+            }
+        }
 
-    Tree_2_3 *tmp = malloc(sizeof(*tmp));
-    
-    /* maybe it's better to exit with an error */
-    if (!tmp)
-    {
-        log_warn("Failed to allocate memory for create Tree_2_3");
-        return NULL;
+        pending = 0;
     }
 
-    *tmp = (struct _tree){ 
-        .root=NULL,
-        .elements=0,
-        .cmp_key=key_cmp, 
-        .copy_key=key_copy, 
-        .free_key=key_free
-    };
-
-    return tmp;
+    return count_found;
 }
 
 
-/* Insert value in tree if it's not there */
-bool tree_insert_key(Tree_2_3 *tree, TreeKey value)
+const Node_2_3 * tree_lower_bound(const Tree_2_3 *tree, TreeKey value)
 {
     log_trace("%s", __func__);
 
-    /* NULL key */
-    if (value == NULL)
-    {
-        log_warn("Try insert nullable key!");
-        return false;
-    }
+    return find_bound(tree, value, BOUND_LOWER);
+}
 
-    /* NULL tree(not exists) 
-     * TODO: maybe better exit with exception/error? */
-    if (tree == NULL)
-    {
-        log_warn("Try insert element in not existing(nullable) tree!");
-        return false;
-    }
 
-    /* Empty tree */
-    if (tree_is_empty(tree))
-    {
-        tree->elements++;
-        tree->root = new_leaf_node(value, tree);
-    }
-    else /* Try add element in tree */
-    //if (!search_key(tree, value))
-    {
-        bool duplicated = false;
-        Node_2_3 *new_node = add_value(tree->root, value, tree, &duplicated);
+const Node_2_3 * tree_upper_bound(const Tree_2_3 *tree, TreeKey value)
+{
+    log_trace("%s", __func__);
 
-        if (duplicated)
-        {
-            log_debug("Try insert duplicated value in tree");
-            return false;
-        }
+    return find_bound(tree, value, BOUND_UPPER);
+}
 
-        tree->elements++;
 
-        /* Check is need to update the root of tree */
-        if (new_node != NULL)
-            update_root(tree, new_node);
-    }
+const Node_2_3 * tree_floor(const Tree_2_3 *tree, TreeKey value)
+{
+    log_trace("%s", __func__);
 
-    return true;
+    return find_bound(tree, value, BOUND_FLOOR);
 }
 
 
-/* Removes the key from the tree if it contains one */
-bool tree_remove_key(Tree_2_3 *tree, TreeKey value)
+const Node_2_3 * tree_ceil(const Tree_2_3 *tree, TreeKey value)
 {
     log_trace("%s", __func__);
-    
-    /* NULL key */
-    if (value == NULL)
-    {
-        log_warn("Try remove nullable key!");
-        return false;
-    }
 
-    /* NULL tree(not exists) 
-     * TODO: maybe better exit with exception/error? */
-    if (tree == NULL)
-    {
-        log_warn("Try remove element in not existing(nullable) tree!");
-        return false;
-    }
+    return find_bound(tree, value, BOUND_LOWER);
+}
 
-    /* Empty tree */
-    if (tree_is_empty(tree))
-    {
-        log_warn("Try remove element in empty tree!");
-        return false;
-    }
 
-    /* Key not in tree */
-    // лишняя процедура
-    //if (!search_key(tree, value))
-    //    return;
+const Node_2_3 * tree_successor(const Tree_2_3 *tree, TreeKey value)
+{
+    log_trace("%s", __func__);
 
+    return find_bound(tree, value, BOUND_UPPER);
+}
 
-    bool finded = true;
-    Node_2_3 *tmp = NULL;
-    Node_2_3 *deleted = delete_value(tree->root, value, &finded);
 
+const Node_2_3 * tree_predecessor(const Tree_2_3 *tree, TreeKey value)
+{
+    log_trace("%s", __func__);
 
-    if (!finded)
-        return false;
+    return find_bound(tree, value, BOUND_PREDECESSOR);
+}
 
-    tree->elements--;
 
-    /* Need to update the root of tree
-     * because he had only one child left */
-    if (deleted != NULL)
+/* Alive leaf next to <node> in order, dead leafs are passed over */
+static const Node_2_3 * neighbor_node(const Tree_2_3 *tree, const Node_2_3 *node, bool to_right)
+{
+    log_trace("%s", __func__);
+
+    if (tree == NULL || node == NULL || node->type != LEAF)
     {
-        if (tree->root->type == INNER)
-        {
-            tmp = tree->root->first;
-            free(tree->root);
-            tree->root = tmp;
-        }
-        else /* Make tree empty */
-        {
-            tree_make_empty(tree);
-        }
+        log_warn("Try step from nullable node or not a leaf!");
+        return NULL;
     }
 
-    return true;
+    do
+        node = step_leaf(tree, node, to_right);
+    while (node && node->dead);
+
+    return node;
 }
 
 
-/* Return addres leaf with value or null if value not found
- * Wrapper function for finding the key. It is necessary that the user
- * does not call the root of the tree, but simply passes the tree itself */
-const Node_2_3 * tree_search_key(const Tree_2_3 *tree, TreeKey value)
+const Node_2_3 * tree_next_node(const Tree_2_3 *tree, const Node_2_3 *node)
+{
+    log_trace("%s", __func__);
+
+    return neighbor_node(tree, node, true);
+}
+
+
+const Node_2_3 * tree_prev_node(const Tree_2_3 *tree, const Node_2_3 *node)
 {
     log_trace("%s", __func__);
 
-    return search_value(tree->root, value);
+    return neighbor_node(tree, node, false);
 }
 
 
@@ -912,6 +4485,63 @@ void node_print(const Node_2_3 *node, func_print_key print_key)
 }
 
 
+/* Visit all keys in ascending order until visitor returns false */
+void tree_foreach(const Tree_2_3 *tree, func_visit_key visit, void *context)
+{
+    log_trace("%s", __func__);
+
+    if (tree == NULL || visit == NULL)
+    {
+        log_warn("Try iterate not existing(nullable) tree or without visitor!");
+        return;
+    }
+
+    foreach_key(tree->root, visit, context);
+}
+
+
+/* Keys with prefix are neighbors from the first key >= prefix */
+void tree_prefix_foreach(const Tree_2_3 *tree, const char *prefix, size_t len, func_visit_key visit, void *context)
+{
+    log_trace("%s", __func__);
+
+    if (tree == NULL || visit == NULL || (prefix == NULL && len > 0))
+    {
+        log_warn("Try iterate not existing(nullable) tree, prefix or without visitor!");
+        return;
+    }
+
+    /* Keys are C strings, no key has NUL inside */
+    if (len && memchr(prefix, '\0', len))
+    {
+        log_warn("Try iterate keys by prefix with NUL inside!");
+        return;
+    }
+
+    if (len && string_key_refused(tree->cmp_key, prefix))
+        return;
+
+    char *lo = malloc(len + 1);
+
+    if (lo == NULL)
+    {
+        log_fatal("Cannot allocate required memory!");
+        exit(EXIT_FAILURE);
+    }
+
+    if (len)
+        memcpy(lo, prefix, len);
+
+    lo[len] = '\0';
+
+    struct prefix_scan scan = { tree, prefix, len, visit, context };
+
+    scan_prefix(tree->root, len ? lo : NULL, &scan);
+
+    free(lo);
+}
+
+
 /* Print tree. Need to pass a custom function to print the key */
 void tree_print(const Tree_2_3 *tree, func_print_key print_key)
 {
@@ -940,6 +4570,39 @@ const Node_2_3 * tree_get_root(const Tree_2_3 *tree)
 }
 
 
+/* Walk the whole tree and check all invariants, O(n) */
+bool tree_check_invariants(const Tree_2_3 *tree)
+{
+    log_trace("%s", __func__);
+
+    if (tree == NULL)
+    {
+        log_warn("Try check invariants of not exist(nullable) tree!");
+        return false;
+    }
+
+    struct invariants_walk walk = { .tree = tree, .ok = true };
+
+    if (tree->root)
+        check_node(tree->root, 1, &walk);
+    else
+    if (tree->height != 0)
+    {
+        log_error("Empty tree has height %d", tree->height);
+        walk.ok = false;
+    }
+
+    if (walk.alive != tree->elements || walk.dead != tree->dead)
+    {
+        log_error("Tree has %lu alive and %lu dead leafs, but counters are %lu and %lu",
+                  walk.alive, walk.dead, tree->elements, tree->dead);
+        walk.ok = false;
+    }
+
+    return walk.ok;
+}
+
+
 /* Count of elements(leafs) in tree */
 int tree_count_elements(const Tree_2_3 *tree)
 {
@@ -962,13 +4625,7 @@ int tree_height(const Tree_2_3 *tree)
         return 0;
     }
 
-    if (tree_is_empty(tree))
-    {
-        log_debug("Get height from empty tree");
-        return 0;
-    }
-
-    return node_height(tree->root);
+    return tree->height;
 }
 
 
@@ -1000,7 +4657,12 @@ TreeKey tree_get_min(const Tree_2_3 *tree)
         return NULL;
     }
 
-    return get_min(tree->root);
+    const Node_2_3 *leaf = get_min_node(tree->root);
+
+    if (leaf->dead)
+        leaf = find_bound(tree, leaf->key, BOUND_UPPER);
+
+    return leaf->key;
 }
 
 
@@ -1039,6 +4701,9 @@ TreeKey tree_get_max(const Tree_2_3 *tree)
         }
     }
 
+    if (current->dead)
+        return find_bound(tree, current->key, BOUND_PREDECESSOR)->key;
+
     return current->key;
 }
 
@@ -1048,10 +4713,17 @@ void tree_make_empty(Tree_2_3 *tree)
 {
     log_trace("%s", __func__);
     
-    tree_free(tree->root);
+    tree_free(tree->root, tree);
 
     tree->root = NULL;
+    tree->height = 0;
     tree->elements = 0;
+    tree->dead = 0;
+
+    if (tree->bloom)
+        bloom_rebuild(tree);
+
+    cache_clear(tree);
 }
 
 
@@ -1060,8 +4732,10 @@ void tree_destroy(Tree_2_3 **tree)
 {
     log_trace("%s", __func__);
 
-    tree_free((*tree)->root);
-    free(*tree);
+    tree_free((*tree)->root, *tree);
+    bloom_free((*tree)->bloom);
+    cache_free((*tree)->cache);
+    release_tree(*tree);
 
     *tree = NULL;
 }
@@ -11,17 +11,95 @@
  *****************************************************************************/
 
 #include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
 
 /* points to an address where the true key is saved */
 typedef const void * TreeKey;
 
 typedef struct _node Node_2_3;
 typedef struct _tree Tree_2_3;
+typedef struct _tree_frozen TreeFrozen;
 
 typedef int      (*func_cmp_key)     (TreeKey, TreeKey);  /* function type to compare keys */
 typedef TreeKey  (*func_copy_key)    (TreeKey);           /* function type to copy key_t value */
 typedef void     (*func_free_key)    (TreeKey);           /* function free allocated memory and resourses */
 typedef void     (*func_print_key)   (TreeKey);           /* function to print key_t value */
+typedef bool     (*func_visit_key)   (TreeKey, void*);    /* function to visit key in iteration, return false to stop */
+typedef size_t   (*func_size_key)    (TreeKey);           /* function to get count of bytes used by key */
+typedef uint64_t (*func_hash_key)    (TreeKey);           /* function to hash key, equal keys must have equal hashes */
+typedef double   (*func_value_key)   (TreeKey);           /* function to get value of key for aggregates */
+typedef double   (*func_combine)     (double, double);    /* associative function to combine values */
+
+
+/* Place of leaf inside an object of user, see tree_create_intrusive().
+ * Has the size of node, the fields are private. Zero it before the first use */
+typedef struct _tree_hook
+{
+    int     reserved_type;
+    void   *reserved_links[6];
+    unsigned long reserved_counters[2];
+    double  reserved_aggregate;
+} TreeHook;
+
+/* Object of <type> containing the hook <ptr> as <member> */
+#define TREE_CONTAINER_OF(ptr, type, member) \
+    ((type*)((char*)(ptr) - offsetof(type, member)))
+
+
+/* Memory of nodes and tree struct, see tree_create_ex() */
+typedef struct
+{
+    void * (*alloc) (size_t size, void *ctx);             /* NULL if memory can't be allocated */
+    void   (*free)  (void *ptr, size_t size, void *ctx);  /* size is the one passed to alloc */
+    void *ctx;                                            /* passed to both functions */
+} TreeAllocator;
+
+
+/* Memory used by tree, see tree_memory_stats() */
+typedef struct
+{
+    unsigned long leafs;    /* with dead leafs of lazy mode */
+    unsigned long dead;
+    unsigned long inner_2;  /* inner nodes with 2 children */
+    unsigned long inner_3;  /* inner nodes with 3 children */
+
+    size_t node_bytes;      /* nodes and tree struct */
+    size_t key_bytes;       /* keys by size function, 0 if it isn't set */
+    size_t filter_bytes;    /* Bloom filter, 0 if it isn't set */
+    size_t cache_bytes;     /* lookup cache, 0 if it isn't set */
+
+    double fill_factor;     /* average part of used child slots of inner nodes */
+    int height;
+} TreeMemoryStats;
+
+
+/* Work done by operations, see tree_get_op_stats() */
+typedef struct
+{
+    unsigned long compares;         /* calls of compare function */
+
+    unsigned long searches;         /* operations and nodes visited by their descents */
+    unsigned long search_visits;
+    unsigned long inserts;
+    unsigned long insert_visits;
+    unsigned long removes;
+    unsigned long remove_visits;
+
+    unsigned long splits;           /* full nodes split on insert */
+    unsigned long merges;           /* nodes with one child merged on remove */
+    unsigned long allocations;      /* nodes allocated */
+    unsigned long filtered;         /* searches and removes rejected by Bloom filter */
+} TreeOpStats;
+
+
+/* Work of lookup cache, see tree_set_lookup_cache() */
+typedef struct
+{
+    unsigned long hits;
+    unsigned long misses;
+    size_t entries;         /* capacity of cache */
+} TreeCacheStats;
 
 
 /******************************************************************************
@@ -52,23 +130,414 @@ typedef void     (*func_print_key)   (TreeKey);           /* function to print k
  * @note Key ownership depends on func_copy and func_free.
  */
 Tree_2_3 *       tree_create     (func_cmp_key func_cmp, func_copy_key func_copy, func_free_key func_free);
+
+/**
+ * @brief Creates an empty 2-3 tree, whose nodes and tree struct are
+ * 		  allocated by <allocator>, e.g. arena or memory of NUMA node.
+ *
+ * @param allocator Copied into the tree, NULL - malloc/free.
+ * 					Both functions are required.
+ *
+ * @note Parts of tree_split(), trees made by set operations and tree_thaw()
+ * 		 use the allocator of source tree. Keys are allocated by func_copy.
+ * @note tree_join() refuses trees with different allocators.
+ */
+Tree_2_3 *       tree_create_ex  (func_cmp_key func_cmp, func_copy_key func_copy, func_free_key func_free,
+                                  const TreeAllocator *allocator);
+
+/**
+ * @brief Creates an empty 2-3 tree of NUL-terminated strings, which owns
+ * 		  the keys and stores them front-coded: a key shares its common prefix
+ * 		  with the neighbor leaf, only the rest of bytes is stored.
+ *
+ * Keys are passed to all functions as C strings. Stored keys (node_get_key(),
+ * tree_get_min(), tree_foreach() etc.) are in internal form, compare function
+ * of tree takes both forms and compares stored keys without decoding.
+ * Get the string by tree_string_decode().
+ *
+ * @note Stored keys start with byte 0xFF (it isn't used in UTF-8), so C string
+ * 		 starting with it is refused with a warning by every function taking
+ * 		 a key: inserts fail, searches find nothing.
+ * @note Memory of keys is counted in tree_memory_stats().
+ */
+Tree_2_3 *       tree_create_strings (void);
+
+/**
+ * @brief Creates intrusive tree: objects are linked by TreeHook embedded in
+ * 		  them, the hook becomes the leaf, so linking allocates nothing but
+ * 		  inner nodes (about one per two objects).
+ *
+ * @param key_cmp   Compares two hooks, the objects are got by TREE_CONTAINER_OF().
+ * 					Keys of tree (node_get_key(), tree_pop_min()...) are the hooks,
+ * 					searched key is a hook of an object made for search.
+ * @param allocator Memory of inner nodes and tree struct, NULL - malloc/free.
+ *
+ * @return A pointer to the tree, or NULL on error.
+ *
+ * @note The tree doesn't own the objects, an object must stay in place while
+ * 		 it's linked. tree_destroy() and tree_make_empty() only unlink them.
+ * @note Lazy deletion and tree_replace_key() aren't supported. Parts of
+ * 		 tree_split() and tree_thaw() link the same hooks, trees made by set
+ * 		 operations are ordinary trees with hooks as keys.
+ */
+Tree_2_3 *       tree_create_intrusive (func_cmp_key key_cmp, const TreeAllocator *allocator);
+
+/* Link object by its hook, return false if an equal object is linked already.
+ * Same as tree_insert_key() with the hook as key */
+bool             tree_link           (Tree_2_3 *tree, TreeHook *hook);
+
+/* Unlink object linked in this tree by its hook without search,
+ * return false if it isn't linked */
+bool             tree_unlink         (Tree_2_3 *tree, TreeHook *hook);
+
+/* Write stored key of string tree (or C string not starting with 0xFF) with NUL
+ * to buffer, if it has enough <size>. Return the size of string with NUL.
+ * Can be used as func_save_key */
+size_t           tree_string_decode  (TreeKey key, void *buffer, size_t size);
+
+/* Release stored key of string tree owned by the caller, e.g. by tree_pop_min() */
+void             tree_string_free    (TreeKey key);
 void             tree_destroy    (Tree_2_3 **tree);
 void             tree_make_empty (Tree_2_3 *tree);
 
 bool             tree_insert_key (Tree_2_3 *tree, TreeKey key);
 bool             tree_remove_key (Tree_2_3 *tree, TreeKey key);
+
+/**
+ * @brief Removes the leaf found before (e.g. by tree_search_key()) without
+ * 		  search by key: the nodes keep links to their parents, so the tree
+ * 		  is repaired from the leaf up to the root.
+ *
+ * @param node Leaf of this tree. Leafs stay in place while other keys are
+ * 			   inserted and removed, so the handle is valid until its key is
+ * 			   removed or the tree is destroyed, split, joined or thawed.
+ *
+ * @return true if the key was removed, false if the node isn't a leaf
+ * 		   or it's dead already.
+ *
+ * @note In lazy mode the leaf is marked as dead, as by tree_remove_key().
+ */
+bool             tree_remove_node (Tree_2_3 *tree, const Node_2_3 *node);
+
+/**
+ * @brief Removes the minimal (maximal) key and returns it, so the tree can be
+ * 		  used as a priority queue. The leaf is found by walking the first
+ * 		  (last) children, without search by key.
+ *
+ * @return The key, or NULL if the tree is empty. The key is owned by the
+ * 		   caller: it isn't released by func_free, with func_copy it's the copy.
+ * 		   Keys of string tree are released by tree_string_free().
+ *
+ * @note In lazy mode dead leafs at the end of tree are removed on the way.
+ */
+TreeKey          tree_pop_min    (Tree_2_3 *tree);
+TreeKey          tree_pop_max    (Tree_2_3 *tree);
+
+/**
+ * @brief Turns lazy deletion on or off.
+ *
+ * In lazy mode tree_remove_key() only marks the leaf as dead, without
+ * rebalancing. Search, iteration and neighbor queries skip dead leafs.
+ * The tree is rebuilt when dead leafs are more than <dead_ratio> of all leafs,
+ * or when tree_compact() is called.
+ *
+ * @param enabled    Turning off compacts the tree.
+ * @param dead_ratio Part of dead leafs in (0, 1], otherwise the default 0.25.
+ *
+ * @note Keys of dead leafs are used as separators until compaction, so without
+ * 		 func_copy the caller must keep removed keys alive until tree_compact().
+ */
+void             tree_set_lazy_delete (Tree_2_3 *tree, bool enabled, double dead_ratio);
+void             tree_compact         (Tree_2_3 *tree);
+
+/* Leaf with key or NULL. Read-only unless the lookup cache is attached,
+ * see tree_set_lookup_cache() about concurrent searches */
 const Node_2_3 * tree_search_key (const Tree_2_3 *tree, TreeKey key);
 
+/**
+ * @brief Searches many keys at once, the lookups descend in groups level
+ * 		  by level, so cache misses of one overlap with work of the others.
+ *
+ * @param keys  Keys to search, NULL keys aren't allowed.
+ * @param found Array of <count> results, the leaf with key or NULL.
+ *
+ * @return Count of found keys.
+ *
+ * @note Gives the same results as tree_search_key() for each key,
+ * 		 lookup cache and Bloom filter are used too.
+ */
+size_t           tree_search_batch (const Tree_2_3 *tree, const TreeKey *keys, size_t count, const Node_2_3 **found);
+
+/**
+ * @brief Finds the key or inserts it, in one descent.
+ *
+ * @param inserted Receives true if the key was inserted. Optional.
+ *
+ * @return The leaf with existed or inserted key, or NULL on error.
+ */
+const Node_2_3 * tree_find_or_insert (Tree_2_3 *tree, TreeKey key, bool *inserted);
+
+/**
+ * @brief Swaps the stored key equal to <key> in place, in one descent.
+ *
+ * The new key is copied by func_copy, the old one is released by func_free.
+ * The structure of tree isn't changed, so the key must be equal to the old one.
+ *
+ * @return true if the key was replaced, false if it isn't in tree.
+ */
+bool             tree_replace_key    (Tree_2_3 *tree, TreeKey key);
+
+/**
+ * @brief Ordered neighbor queries, answered in one descent.
+ *
+ * @return The leaf with the neighbor key, or NULL if there is no such key.
+ *
+ * tree_lower_bound, tree_ceil       - first key >= key
+ * tree_upper_bound, tree_successor  - first key >  key
+ * tree_floor                        - last key  <= key
+ * tree_predecessor                  - last key  <  key
+ */
+const Node_2_3 * tree_lower_bound (const Tree_2_3 *tree, TreeKey key);
+const Node_2_3 * tree_upper_bound (const Tree_2_3 *tree, TreeKey key);
+const Node_2_3 * tree_floor       (const Tree_2_3 *tree, TreeKey key);
+const Node_2_3 * tree_ceil        (const Tree_2_3 *tree, TreeKey key);
+const Node_2_3 * tree_successor   (const Tree_2_3 *tree, TreeKey key);
+const Node_2_3 * tree_predecessor (const Tree_2_3 *tree, TreeKey key);
+
+/* Leaf with the next (previous) alive key after the leaf <node>, or NULL at
+ * the end. The step goes up by parents and down again, with no comparison,
+ * so iterating the whole tree costs O(1) per key on average */
+const Node_2_3 * tree_next_node   (const Tree_2_3 *tree, const Node_2_3 *node);
+const Node_2_3 * tree_prev_node   (const Tree_2_3 *tree, const Node_2_3 *node);
+
+/**
+ * @brief Inserts the key next to a known leaf.
+ *
+ * @param tree  Tree to insert.
+ * @param key   Key to insert.
+ * @param hint  Leaf of this tree near the place of key, e.g. returned by the previous call.
+ * 				Optional, the leaf must still be in the tree.
+ * 				If it is the maximal (minimal) leaf and the key goes after (before) it,
+ * 				the key is hanged on the end of tree with one comparison.
+ * 				Otherwise the descent starts from the lowest ancestor of hint whose
+ * 				keys range holds the key, found by parent links. The closer the key
+ * 				to hint, the fewer comparisons.
+ *
+ * @return The leaf with inserted key, or NULL if the key is duplicated or on error.
+ *
+ * @note tree_insert_key() itself appends keys bigger than maximum without descent.
+ */
+const Node_2_3 * tree_insert_hint(Tree_2_3 *tree, TreeKey key, const Node_2_3 *hint);
+
+
+/**
+ * @brief Splits the tree by key in O(log n).
+ *
+ * @param tree  Source tree. After the call it stays empty but valid.
+ * @param key   Keys smaller than it go to <left>, other keys go to <right>.
+ * @param left  Receives a new tree, destroy it via tree_destroy().
+ * @param right Receives a new tree, destroy it via tree_destroy().
+ *
+ * @return true on success, false on error (nothing is moved).
+ *
+ * @note Nodes and keys are moved, not copied.
+ */
+bool             tree_split      (Tree_2_3 *tree, TreeKey key, Tree_2_3 **left, Tree_2_3 **right);
+
+/**
+ * @brief Concatenates two trees in O(log n).
+ *
+ * @param left  Receives all keys of <right>.
+ * @param right All its keys must be greater than keys of <left>.
+ * 				Destroyed and set to NULL on success.
+ *
+ * @return true on success, false if trees have different key functions
+ * 		   or their keys are overlapped (both trees are untouched).
+ */
+bool             tree_join       (Tree_2_3 *left, Tree_2_3 **right);
+
+
+/**
+ * @brief Set operations over the keys of two trees in O(n + m).
+ *
+ * Keys of both trees are merged in one pass, when one tree is much smaller
+ * the other one is skipped by galloping search. The result is built
+ * bottom-up, not by repeated inserts.
+ *
+ * @param a Source tree, its key functions and lazy deletion are used for the result.
+ * @param b Source tree, must have the same key functions as <a>.
+ *
+ * @return A new tree (keys are copied by the copy function of <a>),
+ * 		   or NULL on error. Source trees are not changed.
+ *
+ * @note Without copy function the result borrows keys of sources: it doesn't
+ * 		 free them and mustn't outlive the trees which own them.
+ * @note tree_union takes equal keys from <a>.
+ * @note tree_difference returns keys of <a> which are not in <b>.
+ */
+Tree_2_3 *       tree_union        (const Tree_2_3 *a, const Tree_2_3 *b);
+Tree_2_3 *       tree_intersection (const Tree_2_3 *a, const Tree_2_3 *b);
+Tree_2_3 *       tree_difference   (const Tree_2_3 *a, const Tree_2_3 *b);
+
+
+/**
+ * @brief Converts the tree to read-only layout for trees built once and then queried.
+ *
+ * Keys are placed in array in Eytzinger (breadth-first) order without
+ * child pointers: a descent reads consecutive cache lines, the next
+ * levels are prefetched and the index is updated without branches.
+ *
+ * @param tree Source tree. Keys are moved, not copied.
+ * 			   Destroyed and set to NULL on success.
+ *
+ * @return A pointer to frozen tree, or NULL on error (tree is untouched).
+ *
+ * @note Only keys are kept in array, comparisons still dereference them.
+ */
+TreeFrozen *     tree_freeze     (Tree_2_3 **tree);
+
+/**
+ * @brief Converts frozen tree back to mutable tree in O(n).
+ *
+ * @param frozen Destroyed and set to NULL on success.
+ *
+ * @return A new tree with the same keys and functions, or NULL on error.
+ * 		   Aggregate, lazy deletion, Bloom filter and lookup cache of the
+ * 		   frozen tree are set again: the filter is rebuilt over the keys,
+ * 		   the cache starts empty.
+ */
+Tree_2_3 *       tree_thaw       (TreeFrozen **frozen);
+void             tree_frozen_destroy (TreeFrozen **frozen);
+
+/* Read API of frozen tree, keys are returned instead of leafs */
+TreeKey          tree_frozen_search_key     (const TreeFrozen *frozen, TreeKey key);
+TreeKey          tree_frozen_lower_bound    (const TreeFrozen *frozen, TreeKey key);   /* first key >= given */
+TreeKey          tree_frozen_get_min        (const TreeFrozen *frozen);
+TreeKey          tree_frozen_get_max        (const TreeFrozen *frozen);
+int              tree_frozen_count_elements (const TreeFrozen *frozen);
+void             tree_frozen_foreach        (const TreeFrozen *frozen, func_visit_key visit, void *context);
+
 void             node_print      (const Node_2_3 *node, func_print_key print_key);
 void             tree_print      (const Tree_2_3 *tree, func_print_key print_key);
 
+/**
+ * @brief Reports memory used by tree in O(log n), counters are kept on changes.
+ *
+ * @note Memory of keys is counted only after tree_set_size_func(),
+ * 		 setting it counts keys already in tree once in O(n).
+ * @note tree_split() recounts keys of the parts, if size function is set.
+ */
+void             tree_memory_stats   (const Tree_2_3 *tree, TreeMemoryStats *stats);
+void             tree_set_size_func  (Tree_2_3 *tree, func_size_key size_key);
+
+/**
+ * @brief Copies counters of work done by operations since creation or reset.
+ *
+ * @return true if counters are kept, false if the library is built
+ * 		   without TREE_OP_STATS (<stats> is zeroed).
+ *
+ * @note Without TREE_OP_STATS counting compiles to nothing.
+ * @note Lazy removes are counted as removes, their descents as searches.
+ */
+bool             tree_get_op_stats   (const Tree_2_3 *tree, TreeOpStats *stats);
+void             tree_reset_op_stats (Tree_2_3 *tree);
+
+/**
+ * @brief Attaches Bloom filter of keys, so searches and removes of missing
+ * 		  keys are mostly rejected by one cache line read without descent.
+ *
+ * @param hash_key     Key hash function. NULL removes the filter.
+ * 					   Equal keys (by compare function) must have equal hashes.
+ * @param bits_per_key Size of filter, 0 - default (10 bits, ~1% false positives).
+ *
+ * @note The filter is built over keys already in tree in O(n).
+ * 		 Bits of removed keys stay, the filter is rebuilt when they become
+ * 		 too many or the count of keys outgrows the filter (amortized O(1)).
+ * @note Parts of tree_split() and tree_thaw() get own filters, trees made
+ * 		 by set operations are made without filter.
+ */
+void             tree_set_bloom_filter (Tree_2_3 *tree, func_hash_key hash_key, int bits_per_key);
+
+/**
+ * @brief Attaches set-associative cache of leafs found by tree_search_key(),
+ * 		  so a hot key costs a hash, a probe of one cache line and one compare.
+ *
+ * @param hash_key      Key hash function. NULL removes the cache.
+ * 						Equal keys (by compare function) must have equal hashes.
+ * @param count_entries Capacity, rounded up to power of two, 0 - default (1024).
+ *
+ * @note Entries of removed keys are dropped by tree_remove_key() and tree_remove_node(),
+ * 		 tree_make_empty() and tree_split() clear the whole cache.
+ * @note Hits and misses are counted from attaching of cache.
+ * @note With the cache tree_search_key() and tree_search_batch() write to it
+ * 		 (entries are reordered, hits and misses are counted), though the tree
+ * 		 is passed as const. Threads searching one tree at once must lock it
+ * 		 as for writing or not attach the cache.
+ */
+void             tree_set_lookup_cache (Tree_2_3 *tree, func_hash_key hash_key, int count_entries);
+bool             tree_get_cache_stats  (const Tree_2_3 *tree, TreeCacheStats *stats);  /* false if there is no cache */
+
+/* Combine functions for tree_set_aggregate() */
+double           tree_aggregate_sum (double a, double b);   /* identity 0 */
+double           tree_aggregate_min (double a, double b);   /* identity INFINITY */
+double           tree_aggregate_max (double a, double b);   /* identity -INFINITY */
+
+/**
+ * @brief Keeps aggregate of values of keys in every inner node, so aggregate
+ * 		  over a range of keys is answered from O(log n) nodes.
+ *
+ * @param value_key Value of key. NULL removes the aggregate.
+ * @param combine   Associative function, tree_aggregate_sum/min/max or custom.
+ * 					Values are combined in order of keys, so it may be not commutative.
+ * @param identity  Neutral value of combine, result for empty range.
+ *
+ * @note Aggregates of tree are counted in O(n), then they are kept on the
+ * 		 modified paths by all operations. Lazily removed keys aren't counted.
+ * @note Value of stored key must not change, swap the key by tree_replace_key().
+ * @note Parts of tree_split(), trees made by set operations and tree_thaw() keep the aggregate.
+ */
+void             tree_set_aggregate   (Tree_2_3 *tree, func_value_key value_key, func_combine combine, double identity);
+
+/* Combined values of keys in [lo, hi], NULL bound is open. Return false if aggregate isn't set */
+bool             tree_range_aggregate (const Tree_2_3 *tree, TreeKey lo, TreeKey hi, double *result);
+
+void             tree_foreach    (const Tree_2_3 *tree, func_visit_key visit, void *context);
+
+/**
+ * @brief Visits keys starting with <len> bytes of prefix in ascending order.
+ * 		  The first key >= prefix is found by one descent, then the keys are
+ * 		  visited until the prefix stops matching, so it's O(log n + matches).
+ *
+ * @param prefix First <len> bytes are used, they aren't required to end with NUL.
+ *
+ * @note Keys must be C strings ordered by strcmp(), or the tree is made
+ * 		 by tree_create_strings(). So keys are byte strings without NUL:
+ * 		 prefix with NUL inside (or starting with 0xFF for tree_create_strings())
+ * 		 is refused with a warning and nothing is visited.
+ */
+void             tree_prefix_foreach (const Tree_2_3 *tree, const char *prefix, size_t len,
+                                      func_visit_key visit, void *context);
+
 bool             tree_is_empty       (const Tree_2_3 *tree);
 TreeKey          tree_get_min        (const Tree_2_3 *tree);
 TreeKey          tree_get_max        (const Tree_2_3 *tree);
 const Node_2_3 * tree_get_root       (const Tree_2_3 *tree);
-int              tree_height         (const Tree_2_3 *tree);
+int              tree_height         (const Tree_2_3 *tree);   /* O(1), kept by mutations */
 int              tree_count_elements (const Tree_2_3 *tree);
 
+/**
+ * @brief Walks the whole tree and checks its structure, O(n).
+ * 		  All leafs are on the level equal to height, inner nodes have
+ * 		  two or three children, keys are in strictly ascending order,
+ * 		  separator keys are the mins of children, children link back to
+ * 		  their parents, counters of nodes, aggregates and count of elements
+ * 		  match the leafs.
+ *
+ * @return true if the tree is valid, otherwise every violation is logged
+ * 		   as an error and false is returned.
+ */
+bool             tree_check_invariants (const Tree_2_3 *tree);
+
 TreeKey          node_get_key    (const Node_2_3 *node);
 
 #endif
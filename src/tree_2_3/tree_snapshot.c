@@ -0,0 +1,655 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "tree_snapshot.h"
+
+#include "log/log.h"
+
+
+#define SNAPSHOT_MAGIC      "T23SNAP"
+#define SNAPSHOT_VERSION    1
+#define SNAPSHOT_BYTE_ORDER 0x01020304u
+
+#define ALIGN_8(size)       (((size) + 7) & ~(uint64_t)7)
+
+/* 2-3 tree of 2^64 keys is lower */
+#define SNAPSHOT_MAX_HEIGHT 65
+
+#define FNV_OFFSET          0xcbf29ce484222325ull
+#define FNV_PRIME           0x100000001b3ull
+
+
+/* -------- Data structs --------------------------------------------------- */
+
+
+struct snapshot_header
+{
+    char     magic[8];
+    uint32_t version;
+    uint32_t byte_order;
+
+    uint64_t elements;
+    uint64_t height;      /* 1 - root is a key record */
+    uint64_t root;        /* offset of root record */
+    uint64_t first_key;   /* offset of the smallest key record */
+    uint64_t last_key;    /* offset of the biggest key record */
+    uint64_t file_size;
+
+    uint64_t checksum;         /* of all data after header */
+    uint64_t header_checksum;  /* of header fields above */
+};
+
+
+/* Key record is { uint64_t size; bytes[size]; padding } */
+struct snapshot_node
+{
+    uint64_t count;     /* count of children, 2 or 3 */
+    uint64_t child[3];  /* offsets of children: nodes, or key records on the lowest level */
+    uint64_t min[2];    /* offsets of the minimal key records of second and third children */
+};
+
+
+struct _tree_image
+{
+    const unsigned char *data;
+    size_t size;
+
+    const struct snapshot_header *header;
+    func_cmp_key cmp_key;
+};
+
+
+/* Sequential writer of snapshot body, counts offset and checksum */
+struct writer
+{
+    FILE *file;
+    uint64_t offset;
+    uint64_t checksum;
+    bool failed;
+};
+
+
+/* Context for saving keys while tree iteration */
+struct save_context
+{
+    struct writer *writer;
+    func_save_key save_key;
+
+    unsigned char *buffer;
+    size_t capacity;
+
+    uint64_t *offsets;
+    size_t count;
+};
+
+
+/* -------- Static functions ----------------------------------------------- */
+
+
+static uint64_t fnv_update(uint64_t hash, const void *data, size_t size)
+{
+    const unsigned char *bytes = data;
+
+    for (size_t i = 0; i < size; i++)
+    {
+        hash ^= bytes[i];
+        hash *= FNV_PRIME;
+    }
+
+    return hash;
+}
+
+
+static void write_bytes(struct writer *writer, const void *data, size_t size)
+{
+    if (writer->failed || size == 0)
+        return;
+
+    if (fwrite(data, 1, size, writer->file) != size)
+    {
+        log_error("Can't write snapshot data!");
+        writer->failed = true;
+        return;
+    }
+
+    writer->checksum = fnv_update(writer->checksum, data, size);
+    writer->offset += size;
+}
+
+
+/* Serialize key and write key record, remember his offset */
+static bool save_key_record(TreeKey key, void *context)
+{
+    log_trace("%s", __func__);
+
+    struct save_context *save = context;
+    size_t size = save->save_key(key, save->buffer, save->capacity);
+
+
+    if (size > save->capacity)
+    {
+        unsigned char *tmp = realloc(save->buffer, size);
+
+        if (tmp == NULL)
+        {
+            log_error("Can't allocate memory to serialize key!");
+            save->writer->failed = true;
+            return false;
+        }
+
+        save->buffer = tmp;
+        save->capacity = size;
+        size = save->save_key(key, save->buffer, save->capacity);
+    }
+
+    static const unsigned char padding[8] = {0};
+    uint64_t record_size = size;
+
+    save->offsets[save->count++] = save->writer->offset;
+
+    write_bytes(save->writer, &record_size, sizeof(record_size));
+    write_bytes(save->writer, save->buffer, size);
+    write_bytes(save->writer, padding, ALIGN_8(size) - size);
+
+    return !save->writer->failed;
+}
+
+
+/* Write inner levels over <children> with minimal keys <mins> bottom-up,
+ * arrays are reused for the next level. Return offset of root */
+static uint64_t write_levels(struct writer *writer, uint64_t *children, uint64_t *mins, size_t count, uint64_t *height)
+{
+    log_trace("%s", __func__);
+
+    *height = 1;
+
+    while (count > 1)
+    {
+        size_t parents = 0;
+
+        for (size_t i = 0; i < count; )
+        {
+            size_t rest = count - i;
+            size_t take = (rest == 2 || rest == 4) ? 2 : 3;  // never leave a single child
+            struct snapshot_node node = { .count = take };
+
+            for (size_t j = 0; j < take; j++)
+                node.child[j] = children[i + j];
+
+            node.min[0] = mins[i + 1];
+            node.min[1] = (take == 3) ? mins[i + 2] : 0;
+
+            children[parents] = writer->offset;
+            mins[parents] = mins[i];
+            parents++;
+
+            write_bytes(writer, &node, sizeof(node));
+            i += take;
+        }
+
+        count = parents;
+        (*height)++;
+    }
+
+    return children[0];
+}
+
+
+static bool sync_directory(const char *path)
+{
+    char *dir = strdup(path);
+    char *slash = dir ? strrchr(dir, '/') : NULL;
+    bool result = false;
+
+
+    if (dir == NULL)
+        return false;
+
+    if (slash == dir)
+        slash[1] = '\0';
+    else
+    if (slash)
+        *slash = '\0';
+    else
+        strcpy(dir, ".");
+
+    int fd = open(dir, O_RDONLY);
+
+    if (fd >= 0)
+    {
+        result = (fsync(fd) == 0);
+        close(fd);
+    }
+
+    free(dir);
+
+    return result;
+}
+
+
+static const unsigned char * record_at(const TreeImage *image, uint64_t offset)
+{
+    return image->data + offset;
+}
+
+
+/* Record of <size> bytes at <offset> is aligned and lies in the data after header.
+ * Offsets are read from the file, so they are checked before every use */
+static bool record_fits(const TreeImage *image, uint64_t offset, uint64_t size)
+{
+    return offset >= sizeof(struct snapshot_header) && offset % 8 == 0 &&
+           offset <= image->size && size <= image->size - offset;
+}
+
+
+/* Size of key record with padding, 0 if it doesn't fit to the mapping */
+static uint64_t key_record_size(const TreeImage *image, uint64_t offset)
+{
+    if (!record_fits(image, offset, sizeof(uint64_t)))
+        return 0;
+
+    uint64_t size = *(const uint64_t *)record_at(image, offset);
+
+    if (size > image->size || !record_fits(image, offset, sizeof(uint64_t) + ALIGN_8(size)))
+        return 0;
+
+    return sizeof(uint64_t) + ALIGN_8(size);
+}
+
+
+/* Key stored in record is passed to user functions, NULL if the record is broken */
+static TreeKey key_at(const TreeImage *image, uint64_t offset)
+{
+    if (key_record_size(image, offset) == 0)
+    {
+        log_warn("Snapshot data is corrupted!");
+        return NULL;
+    }
+
+    return (TreeKey)(record_at(image, offset) + sizeof(uint64_t));
+}
+
+
+/* Node of index, NULL if the record is broken */
+static const struct snapshot_node * node_at(const TreeImage *image, uint64_t offset)
+{
+    const struct snapshot_node *node = NULL;
+
+    if (record_fits(image, offset, sizeof(*node)))
+        node = (const struct snapshot_node *)record_at(image, offset);
+
+    if (node == NULL || node->count < 2 || node->count > 3)
+    {
+        log_warn("Snapshot data is corrupted!");
+        return NULL;
+    }
+
+    return node;
+}
+
+
+/* Map file and check his header, compare function is not set */
+static TreeImage * map_image(const char *path)
+{
+    log_trace("%s", __func__);
+
+    int fd = open(path, O_RDONLY);
+    struct stat info;
+
+
+    if (fd < 0)
+    {
+        log_warn("Can't open snapshot %s", path);
+        return NULL;
+    }
+
+    if (fstat(fd, &info) != 0 || (size_t)info.st_size < sizeof(struct snapshot_header))
+    {
+        log_warn("Snapshot %s is too small!", path);
+        close(fd);
+        return NULL;
+    }
+
+    void *data = mmap(NULL, info.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+
+    if (data == MAP_FAILED)
+    {
+        log_warn("Can't map snapshot %s", path);
+        return NULL;
+    }
+
+    const struct snapshot_header *header = data;
+    uint64_t header_checksum = fnv_update(FNV_OFFSET, header, offsetof(struct snapshot_header, header_checksum));
+
+    if (memcmp(header->magic, SNAPSHOT_MAGIC, sizeof(header->magic)) != 0 ||
+        header->version != SNAPSHOT_VERSION ||
+        header->byte_order != SNAPSHOT_BYTE_ORDER ||
+        header->header_checksum != header_checksum ||
+        header->file_size != (uint64_t)info.st_size ||
+        header->height > SNAPSHOT_MAX_HEIGHT ||
+        header->root >= header->file_size ||
+        header->last_key >= header->file_size)
+    {
+        log_warn("Snapshot %s has invalid header!", path);
+        munmap(data, info.st_size);
+        return NULL;
+    }
+
+    TreeImage *image = malloc(sizeof(*image));
+
+    if (image == NULL)
+    {
+        log_warn("Failed to allocate memory for TreeImage");
+        munmap(data, info.st_size);
+        return NULL;
+    }
+
+    *image = (TreeImage){
+        .data = data,
+        .size = info.st_size,
+        .header = header,
+        .cmp_key = NULL
+    };
+
+    return image;
+}
+
+
+static bool insert_image_key(TreeKey key, void *context)
+{
+    log_trace("%s", __func__);
+
+    Tree_2_3 *tree = context;
+
+    if (!tree_insert_key(tree, key))
+    {
+        log_warn("Key from snapshot isn't inserted!");
+    }
+
+    return true;
+}
+
+
+/* ------------------------------------------------------------------------- */
+
+
+/* Write keys in ascending order and index over them, than header */
+bool tree_save(const Tree_2_3 *tree, const char *path, func_save_key save_key)
+{
+    log_trace("%s", __func__);
+
+    if (tree == NULL || path == NULL || save_key == NULL)
+    {
+        log_warn("Need tree, path and key serialization function to save snapshot!");
+        return false;
+    }
+
+    size_t len_path = strlen(path);
+    char *tmp_path = malloc(len_path + sizeof(".tmp"));
+    FILE *file = NULL;
+
+
+    if (tmp_path == NULL)
+    {
+        log_warn("Can't allocate memory to save snapshot!");
+        return false;
+    }
+
+    memcpy(tmp_path, path, len_path);
+    memcpy(tmp_path + len_path, ".tmp", sizeof(".tmp"));
+
+    if ((file = fopen(tmp_path, "wb")) == NULL)
+    {
+        log_warn("Can't open file %s to save snapshot!", tmp_path);
+        free(tmp_path);
+        return false;
+    }
+
+
+    struct snapshot_header header = {
+        .magic = SNAPSHOT_MAGIC,
+        .version = SNAPSHOT_VERSION,
+        .byte_order = SNAPSHOT_BYTE_ORDER,
+        .elements = (uint64_t)tree_count_elements(tree),
+    };
+    struct writer writer = { .file = file, .offset = sizeof(header), .checksum = FNV_OFFSET };
+    struct save_context save = {
+        .writer = &writer,
+        .save_key = save_key,
+        .offsets = malloc(sizeof(uint64_t) * (header.elements + 1)),
+    };
+    uint64_t *mins = malloc(sizeof(uint64_t) * (header.elements + 1));
+
+
+    /* Place for header, it is written when all offsets are known */
+    if (!save.offsets || !mins || fwrite(&header, sizeof(header), 1, file) != 1)
+        writer.failed = true;
+    else
+        tree_foreach(tree, save_key_record, &save);
+
+    if (!writer.failed && save.count > 0)
+    {
+        memcpy(mins, save.offsets, sizeof(uint64_t) * save.count);
+
+        header.first_key = save.offsets[0];
+        header.last_key = save.offsets[save.count - 1];
+        header.root = write_levels(&writer, save.offsets, mins, save.count, &header.height);
+    }
+
+    header.file_size = writer.offset;
+    header.checksum = writer.checksum;
+    header.header_checksum = fnv_update(FNV_OFFSET, &header, offsetof(struct snapshot_header, header_checksum));
+
+    if (!writer.failed)
+        writer.failed = fseek(file, 0, SEEK_SET) != 0 ||
+                        fwrite(&header, sizeof(header), 1, file) != 1 ||
+                        fflush(file) != 0 ||
+                        fsync(fileno(file)) != 0;
+
+    writer.failed |= (fclose(file) != 0);
+
+    if (!writer.failed)
+        writer.failed = rename(tmp_path, path) != 0 || !sync_directory(path);
+    else
+        remove(tmp_path);
+
+    if (writer.failed)
+    {
+        log_warn("Failed to save snapshot to %s", path);
+    }
+
+    free(save.buffer);
+    free(save.offsets);
+    free(mins);
+    free(tmp_path);
+
+    return !writer.failed;
+}
+
+
+/* Map file and check his header */
+TreeImage * tree_open_mmap(const char *path, func_cmp_key cmp_key)
+{
+    log_trace("%s", __func__);
+
+    if (path == NULL || cmp_key == NULL)
+    {
+        log_warn("Need path and compare function to open snapshot!");
+        return NULL;
+    }
+
+    TreeImage *image = map_image(path);
+
+    if (image != NULL)
+        image->cmp_key = cmp_key;
+
+    return image;
+}
+
+
+/* Unmap snapshot and release the image */
+void tree_image_close(TreeImage **image)
+{
+    log_trace("%s", __func__);
+
+    if (image == NULL || *image == NULL)
+        return;
+
+    munmap((void *)(*image)->data, (*image)->size);
+    free(*image);
+
+    *image = NULL;
+}
+
+
+/* Insert all keys of snapshot, the tree copies them from the mapping */
+bool tree_load(Tree_2_3 *tree, const char *path)
+{
+    log_trace("%s", __func__);
+
+    if (tree == NULL || path == NULL)
+    {
+        log_warn("Need tree and path to load snapshot!");
+        return false;
+    }
+
+    TreeImage *image = map_image(path);
+
+    if (image == NULL)
+        return false;
+
+    if (!tree_image_verify(image))
+    {
+        tree_image_close(&image);
+        return false;
+    }
+
+    tree_image_foreach(image, insert_image_key, tree);
+    tree_image_close(&image);
+
+    return true;
+}
+
+
+/* Check the checksum of all data, reads the whole file */
+bool tree_image_verify(const TreeImage *image)
+{
+    log_trace("%s", __func__);
+
+    const struct snapshot_header *header = image->header;
+    uint64_t checksum = fnv_update(FNV_OFFSET, image->data + sizeof(*header), image->size - sizeof(*header));
+
+    if (checksum != header->checksum)
+    {
+        log_warn("Snapshot data is corrupted!");
+        return false;
+    }
+
+    return true;
+}
+
+
+/* Return key from the mapping or NULL if key not found */
+TreeKey tree_image_search_key(const TreeImage *image, TreeKey key)
+{
+    log_trace("%s", __func__);
+
+    const struct snapshot_header *header = image->header;
+    uint64_t offset = header->root;
+
+
+    if (header->elements == 0 || key == NULL)
+        return NULL;
+
+    for (uint64_t level = header->height; level > 1; level--)
+    {
+        const struct snapshot_node *node = node_at(image, offset);
+        TreeKey second_min = node ? key_at(image, node->min[0]) : NULL;
+        TreeKey third_min = (node && node->count == 3) ? key_at(image, node->min[1]) : NULL;
+
+        if (second_min == NULL || (node->count == 3 && third_min == NULL))
+            return NULL;
+
+        if (image->cmp_key(key, second_min) < 0)
+            offset = node->child[0];
+        else
+        if (node->count == 2 || image->cmp_key(key, third_min) < 0)
+            offset = node->child[1];
+        else
+            offset = node->child[2];
+    }
+
+    TreeKey found = key_at(image, offset);
+
+    if (found != NULL && image->cmp_key(key, found) == 0)
+        return found;
+
+    return NULL;
+}
+
+
+TreeKey tree_image_get_min(const TreeImage *image)
+{
+    log_trace("%s", __func__);
+
+    if (image->header->elements == 0)
+        return NULL;
+
+    return key_at(image, image->header->first_key);
+}
+
+
+TreeKey tree_image_get_max(const TreeImage *image)
+{
+    log_trace("%s", __func__);
+
+    if (image->header->elements == 0)
+        return NULL;
+
+    return key_at(image, image->header->last_key);
+}
+
+
+int tree_image_count_elements(const TreeImage *image)
+{
+    log_trace("%s", __func__);
+
+    return (int)image->header->elements;
+}
+
+
+int tree_image_height(const TreeImage *image)
+{
+    log_trace("%s", __func__);
+
+    return (int)image->header->height;
+}
+
+
+/* Keys are saved one after another, so iteration is a linear scan */
+void tree_image_foreach(const TreeImage *image, func_visit_key visit, void *context)
+{
+    log_trace("%s", __func__);
+
+    uint64_t offset = image->header->first_key;
+
+    for (uint64_t i = 0; i < image->header->elements; i++)
+    {
+        TreeKey key = key_at(image, offset);
+
+        if (key == NULL || !visit(key, context))
+            return;
+
+        offset += key_record_size(image, offset);
+    }
+}
@@ -0,0 +1,81 @@
+#ifndef TREE_SNAPSHOT_H__
+#define TREE_SNAPSHOT_H__
+
+/******************************************************************************
+ * Binary snapshot of the 2-3 tree and read-only access to it through mmap.
+ *
+ * The file keeps keys in ascending order and an index of 2-3 nodes built
+ * over them. Nodes refer to each other by offsets from the file start,
+ * so the mapped file is used as is: nothing is deserialized or allocated
+ * per node, and one snapshot is shared by processes through page cache.
+ *
+ * Format (native byte order, all records aligned to 8 bytes):
+ *   header   - magic, version, counters, offsets, checksums
+ *   keys     - { uint64 size; bytes[size]; padding } in ascending order
+ *   nodes    - { uint64 count; uint64 child[3]; uint64 min[2] } bottom-up
+ *****************************************************************************/
+
+#include <stdbool.h>
+#include <stddef.h>
+
+#include "tree_2_3.h"
+
+
+typedef struct _tree_image TreeImage;
+
+/* Function to serialize key to <buffer> of <size> bytes.
+ * Returns the size of serialized key, if it is bigger than <size>
+ * the function is called again with a buffer of the required size */
+typedef size_t   (*func_save_key)    (TreeKey key, void *buffer, size_t size);
+
+
+/**
+ * @brief Writes a snapshot of the tree to file.
+ *
+ * @param tree     Tree to save. Not changed.
+ * @param path     File is replaced atomically (written to "<path>.tmp" and renamed).
+ * @param save_key Key serialization function. Required.
+ *
+ * @return true on success, false on error (the old file is kept).
+ */
+bool        tree_save            (const Tree_2_3 *tree, const char *path, func_save_key save_key);
+
+/**
+ * @brief Maps a snapshot to memory for read-only access.
+ *
+ * @param path     Snapshot file written by tree_save().
+ * @param cmp_key  Key comparison function. Required.
+ * 				   It receives pointers to serialized keys in the mapping.
+ *
+ * @return A pointer to the image, or NULL if the file is missing or its header is invalid.
+ *
+ * @note Only the header is checked, so opening doesn't depend on the size of data.
+ * 		 Use tree_image_verify() to check the whole file.
+ * @note Offsets of nodes and keys are checked against the mapping on every read,
+ * 		 so a corrupted file isn't read out of bounds: searches find nothing,
+ * 		 iteration stops at the broken record. Bytes of key are passed to
+ * 		 cmp_key as they are in the file.
+ */
+TreeImage * tree_open_mmap       (const char *path, func_cmp_key cmp_key);
+void        tree_image_close     (TreeImage **image);
+
+/**
+ * @brief Inserts all keys of a snapshot to the tree.
+ *
+ * @param tree  Tree must copy keys (func_copy), because they point to the mapping.
+ * @param path  Snapshot file written by tree_save().
+ *
+ * @return true on success, false if the file is missing or corrupted
+ * 		   (the whole file is verified before loading).
+ */
+bool        tree_load            (Tree_2_3 *tree, const char *path);
+bool        tree_image_verify    (const TreeImage *image);
+
+TreeKey     tree_image_search_key     (const TreeImage *image, TreeKey key);
+TreeKey     tree_image_get_min        (const TreeImage *image);
+TreeKey     tree_image_get_max        (const TreeImage *image);
+int         tree_image_count_elements (const TreeImage *image);
+int         tree_image_height         (const TreeImage *image);
+void        tree_image_foreach        (const TreeImage *image, func_visit_key visit, void *context);
+
+#endif
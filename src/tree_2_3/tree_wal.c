@@ -0,0 +1,634 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include "tree_wal.h"
+
+#include "log/log.h"
+
+
+#define WAL_MAGIC           "T23WAL"
+#define WAL_VERSION         1
+#define WAL_BYTE_ORDER      0x01020304u
+
+#define WAL_GROUP_SIZE      64           /* default count of operations in group */
+#define WAL_BUFFER_SIZE     (64 * 1024)  /* WAL_BUFFERED writes when buffer is bigger */
+
+#define ALIGN_8(size)       (((size) + 7) & ~(uint64_t)7)
+
+#define FNV_OFFSET          0xcbf29ce484222325ull
+#define FNV_PRIME           0x100000001b3ull
+
+
+/* -------- Data structs --------------------------------------------------- */
+
+
+enum wal_op
+{
+    WAL_INSERT = 1,
+    WAL_REMOVE = 2
+};
+
+
+struct wal_header
+{
+    char     magic[8];
+    uint32_t version;
+    uint32_t byte_order;
+};
+
+
+/* Record header, followed by serialized key and padding */
+struct wal_record
+{
+    uint64_t size;
+    uint32_t op;
+    uint32_t checksum;  /* of size, op and key */
+};
+
+
+struct _tree_wal
+{
+    int fd;
+    char *ckpt_path;
+
+    Tree_2_3 *tree;
+    func_save_key save_key;
+
+    enum wal_durability durability;
+    unsigned group_size;
+    unsigned pending;    /* operations in buffer */
+    bool unsynced;       /* records are written, but not synced */
+    bool failed;         /* sync failed, state of file is unknown until checkpoint */
+    off_t end;           /* end of completely written records in file */
+
+    unsigned char *buffer;  /* records not written yet */
+    size_t size;
+    size_t capacity;
+
+    int records;
+    int replayed;
+};
+
+
+/* -------- Static functions ----------------------------------------------- */
+
+
+static uint64_t fnv_update(uint64_t hash, const void *data, size_t size)
+{
+    const unsigned char *bytes = data;
+
+    for (size_t i = 0; i < size; i++)
+    {
+        hash ^= bytes[i];
+        hash *= FNV_PRIME;
+    }
+
+    return hash;
+}
+
+
+static uint32_t record_checksum(const struct wal_record *record, const void *key)
+{
+    uint64_t hash = FNV_OFFSET;
+
+    hash = fnv_update(hash, &record->size, sizeof(record->size));
+    hash = fnv_update(hash, &record->op, sizeof(record->op));
+    hash = fnv_update(hash, key, record->size);
+
+    return (uint32_t)(hash ^ (hash >> 32));
+}
+
+
+static bool write_all(int fd, const void *data, size_t size)
+{
+    const unsigned char *bytes = data;
+
+    while (size > 0)
+    {
+        ssize_t written = write(fd, bytes, size);
+
+        if (written < 0)
+        {
+            if (errno == EINTR)
+                continue;
+
+            log_error("Can't write log records!");
+            return false;
+        }
+
+        bytes += written;
+        size -= written;
+    }
+
+    return true;
+}
+
+
+static bool read_all(int fd, void *data, size_t size)
+{
+    unsigned char *bytes = data;
+    off_t offset = 0;
+
+    while (size > 0)
+    {
+        ssize_t readed = pread(fd, bytes, size, offset);
+
+        if (readed < 0 && errno == EINTR)
+            continue;
+
+        if (readed <= 0)
+        {
+            log_error("Can't read log file!");
+            return false;
+        }
+
+        bytes += readed;
+        offset += readed;
+        size -= readed;
+    }
+
+    return true;
+}
+
+
+static void reserve(TreeWal *wal, size_t size)
+{
+    if (size <= wal->capacity)
+        return;
+
+    size_t capacity = wal->capacity ? wal->capacity : 256;
+
+    while (capacity < size)
+        capacity *= 2;
+
+    unsigned char *tmp = realloc(wal->buffer, capacity);
+
+    if (tmp == NULL)
+    {
+        log_fatal("Can't allocate memory for log buffer!");
+        exit(EXIT_FAILURE);
+    }
+
+    wal->buffer = tmp;
+    wal->capacity = capacity;
+}
+
+
+/* Write buffered records, one write per group of records */
+static bool flush(TreeWal *wal, bool sync)
+{
+    log_trace("%s", __func__);
+
+    if (wal->failed)
+        return false;
+
+    if (wal->size > 0)
+    {
+        /* Torn part of records is cut, so the buffer can be written again.
+           Otherwise replay would stop at it and lose the records after */
+        if (!write_all(wal->fd, wal->buffer, wal->size))
+        {
+            if (ftruncate(wal->fd, wal->end) != 0)
+            {
+                log_error("Can't cut torn records of log!");
+                wal->failed = true;
+            }
+
+            return false;
+        }
+
+        wal->end += wal->size;
+        wal->size = 0;
+        wal->unsynced = true;
+    }
+
+    wal->pending = 0;
+
+    if (sync && wal->unsynced)
+    {
+        /* Written pages may be lost, the log isn't trusted anymore */
+        if (fdatasync(wal->fd) != 0)
+        {
+            log_error("Can't sync log file!");
+            wal->failed = true;
+            return false;
+        }
+
+        wal->unsynced = false;
+    }
+
+    return true;
+}
+
+
+/* Serialize key to the end of buffer, return the old end of buffer
+ * to drop the record if operation is failed */
+static size_t stage_record(TreeWal *wal, enum wal_op op, TreeKey key)
+{
+    log_trace("%s", __func__);
+
+    static const unsigned char padding[8] = {0};
+    size_t start = wal->size;
+    size_t offset = start + sizeof(struct wal_record);
+    size_t size = 0;
+
+
+    reserve(wal, offset + sizeof(uint64_t));
+    size = wal->save_key(key, wal->buffer + offset, wal->capacity - offset);
+
+    if (offset + ALIGN_8(size) > wal->capacity)
+    {
+        reserve(wal, offset + ALIGN_8(size));
+        size = wal->save_key(key, wal->buffer + offset, wal->capacity - offset);
+    }
+
+    struct wal_record record = { .size = size, .op = op };
+
+    record.checksum = record_checksum(&record, wal->buffer + offset);
+
+    memcpy(wal->buffer + start, &record, sizeof(record));
+    memcpy(wal->buffer + offset + size, padding, ALIGN_8(size) - size);
+
+    wal->size = offset + ALIGN_8(size);
+
+    return start;
+}
+
+
+/* Write and sync staged records by durability */
+static bool commit_record(TreeWal *wal)
+{
+    log_trace("%s", __func__);
+
+    wal->pending++;
+    wal->records++;
+
+    switch (wal->durability)
+    {
+    case WAL_SYNC:
+        return flush(wal, true);
+
+    case WAL_GROUP:
+        return wal->pending < wal->group_size || flush(wal, true);
+
+    case WAL_BUFFERED:
+    default:
+        return wal->size < WAL_BUFFER_SIZE || flush(wal, false);
+    }
+}
+
+
+/* Drop the record staged from <start>, when its operation is failed.
+ * The record is in buffer, if it isn't written yet */
+static void rollback_record(TreeWal *wal, size_t start)
+{
+    log_trace("%s", __func__);
+
+    if (wal->size > start)
+    {
+        wal->size = start;
+        wal->pending--;
+    }
+
+    wal->records--;
+}
+
+
+/* Apply valid records to the tree, return size of valid part of log */
+static size_t replay(TreeWal *wal, const unsigned char *data, size_t size)
+{
+    log_trace("%s", __func__);
+
+    size_t offset = sizeof(struct wal_header);
+
+    while (offset + sizeof(struct wal_record) <= size)
+    {
+        const struct wal_record *record = (const struct wal_record *)(data + offset);
+        const unsigned char *key = data + offset + sizeof(*record);
+
+        if (record->size > size - offset - sizeof(*record) ||
+            ALIGN_8(record->size) > size - offset - sizeof(*record) ||
+            record->checksum != record_checksum(record, key))
+            break;
+
+        if (record->op == WAL_INSERT)
+            tree_insert_key(wal->tree, key);
+        else
+        if (record->op == WAL_REMOVE)
+            tree_remove_key(wal->tree, key);
+        else
+            break;
+
+        offset += sizeof(*record) + ALIGN_8(record->size);
+        wal->replayed++;
+    }
+
+    return offset;
+}
+
+
+/* Check header, replay records and drop a torn tail */
+static bool restore(TreeWal *wal)
+{
+    log_trace("%s", __func__);
+
+    struct wal_header header = {
+        .magic = WAL_MAGIC,
+        .version = WAL_VERSION,
+        .byte_order = WAL_BYTE_ORDER
+    };
+    struct stat info;
+
+
+    if (fstat(wal->fd, &info) != 0)
+        return false;
+
+    /* New log, or crash while creating it */
+    wal->end = sizeof(header);
+
+    if ((size_t)info.st_size < sizeof(header))
+    {
+        return ftruncate(wal->fd, 0) == 0 &&
+               write_all(wal->fd, &header, sizeof(header)) &&
+               fsync(wal->fd) == 0;
+    }
+
+    size_t size = info.st_size;
+    unsigned char *data = malloc(size);
+    bool result = false;
+
+    if (data == NULL)
+    {
+        log_fatal("Can't allocate memory to read log!");
+        exit(EXIT_FAILURE);
+    }
+
+    if (!read_all(wal->fd, data, size))
+    {
+        free(data);
+        return false;
+    }
+
+    if (memcmp(data, &header, sizeof(header)) != 0)
+    {
+        log_warn("Log file has invalid header!");
+    }
+    else
+    {
+        size_t valid = replay(wal, data, size);
+
+        wal->records = wal->replayed;
+        wal->end = valid;
+        result = true;
+
+        if (valid < size)
+        {
+            log_warn("Dropped %zu bytes of torn log tail", size - valid);
+            result = ftruncate(wal->fd, valid) == 0 && fdatasync(wal->fd) == 0;
+        }
+    }
+
+    free(data);
+
+    return result;
+}
+
+
+static void wal_free(TreeWal *wal)
+{
+    if (wal->fd >= 0)
+        close(wal->fd);
+
+    free(wal->ckpt_path);
+    free(wal->buffer);
+    free(wal);
+}
+
+
+/* ------------------------------------------------------------------------- */
+
+
+TreeWal * tree_wal_open(const char *path, Tree_2_3 *tree, func_save_key save_key,
+                        enum wal_durability durability, unsigned group_size)
+{
+    log_trace("%s", __func__);
+
+    if (path == NULL || tree == NULL || save_key == NULL)
+    {
+        log_warn("Need path, tree and key serialization function to open log!");
+        return NULL;
+    }
+
+    if (!tree_is_empty(tree))
+    {
+        log_warn("Log must be replayed into empty tree!");
+        return NULL;
+    }
+
+    TreeWal *wal = calloc(1, sizeof(*wal));
+    size_t len_path = strlen(path);
+
+
+    if (wal == NULL || (wal->ckpt_path = malloc(len_path + sizeof(".ckpt"))) == NULL)
+    {
+        log_warn("Failed to allocate memory for TreeWal");
+        free(wal);
+        return NULL;
+    }
+
+    memcpy(wal->ckpt_path, path, len_path);
+    memcpy(wal->ckpt_path + len_path, ".ckpt", sizeof(".ckpt"));
+
+    wal->tree = tree;
+    wal->save_key = save_key;
+    wal->durability = durability;
+    wal->group_size = group_size ? group_size : WAL_GROUP_SIZE;
+    wal->fd = open(path, O_RDWR | O_CREAT | O_APPEND, 0644);
+
+    if (wal->fd < 0)
+    {
+        log_warn("Can't open log %s", path);
+        wal_free(wal);
+        return NULL;
+    }
+
+    /* Checkpoint is optional, but it must be valid if exists */
+    if (access(wal->ckpt_path, F_OK) == 0 && !tree_load(tree, wal->ckpt_path))
+    {
+        log_warn("Can't load checkpoint %s", wal->ckpt_path);
+        tree_make_empty(tree);
+        wal_free(wal);
+        return NULL;
+    }
+
+    if (!restore(wal))
+    {
+        log_warn("Can't restore tree from log %s", path);
+        tree_make_empty(tree);
+        wal_free(wal);
+        return NULL;
+    }
+
+    return wal;
+}
+
+
+bool tree_wal_close(TreeWal **wal)
+{
+    log_trace("%s", __func__);
+
+    if (wal == NULL || *wal == NULL)
+        return true;
+
+    bool result = flush(*wal, true);
+
+    wal_free(*wal);
+    *wal = NULL;
+
+    return result;
+}
+
+
+bool tree_wal_insert_key(TreeWal *wal, TreeKey key)
+{
+    log_trace("%s", __func__);
+
+    if (wal == NULL)
+    {
+        log_warn("Try insert key through not existing(nullable) log!");
+        return false;
+    }
+
+    if (wal->failed)
+        return false;
+
+    size_t start = stage_record(wal, WAL_INSERT, key);
+
+    /* Only changes are logged, so duplicates don't grow the log */
+    if (!tree_insert_key(wal->tree, key))
+    {
+        wal->size = start;
+        return false;
+    }
+
+    /* Tree and log must stay the same, so the insert is undone */
+    if (!commit_record(wal))
+    {
+        rollback_record(wal, start);
+        tree_remove_key(wal->tree, key);
+        return false;
+    }
+
+    return true;
+}
+
+
+bool tree_wal_remove_key(TreeWal *wal, TreeKey key)
+{
+    log_trace("%s", __func__);
+
+    if (wal == NULL)
+    {
+        log_warn("Try remove key through not existing(nullable) log!");
+        return false;
+    }
+
+    if (wal->failed)
+        return false;
+
+    /* Key is serialized before removing, it may be freed by the tree */
+    size_t start = stage_record(wal, WAL_REMOVE, key);
+
+    if (!tree_search_key(wal->tree, key))
+    {
+        wal->size = start;
+        return false;
+    }
+
+    /* The key is removed only after commit, the removed key
+       couldn't be inserted back if it's the stored one */
+    if (!commit_record(wal))
+    {
+        rollback_record(wal, start);
+        return false;
+    }
+
+    return tree_remove_key(wal->tree, key);
+}
+
+
+bool tree_wal_sync(TreeWal *wal)
+{
+    log_trace("%s", __func__);
+
+    if (wal == NULL)
+        return false;
+
+    return flush(wal, true);
+}
+
+
+/* Crash after saving checkpoint but before truncating the log only
+ * replays some operations twice, that gives the same tree */
+bool tree_wal_checkpoint(TreeWal *wal)
+{
+    log_trace("%s", __func__);
+
+    if (wal == NULL)
+        return false;
+
+    /* After failed sync the checkpoint is the way to trust the log again,
+       buffered records are in the tree, so they are saved by it */
+    if (wal->failed)
+        wal->size = 0;
+
+    if ((!wal->failed && !flush(wal, false)) || !tree_save(wal->tree, wal->ckpt_path, wal->save_key))
+        return false;
+
+    if (ftruncate(wal->fd, sizeof(struct wal_header)) != 0)
+    {
+        log_error("Can't truncate log after checkpoint!");
+        return false;
+    }
+
+    /* Old records on disk are replayed on top of checkpoint, that is safe */
+    wal->end = sizeof(struct wal_header);
+
+    if (fdatasync(wal->fd) != 0)
+    {
+        log_error("Can't sync log after checkpoint!");
+        return false;
+    }
+
+    wal->records = 0;
+    wal->pending = 0;
+    wal->unsynced = false;
+    wal->failed = false;
+
+    return true;
+}
+
+
+int tree_wal_count_records(const TreeWal *wal)
+{
+    log_trace("%s", __func__);
+
+    return wal ? wal->records : 0;
+}
+
+
+int tree_wal_count_replayed(const TreeWal *wal)
+{
+    log_trace("%s", __func__);
+
+    return wal ? wal->replayed : 0;
+}
@@ -0,0 +1,85 @@
+#ifndef TREE_WAL_H__
+#define TREE_WAL_H__
+
+/******************************************************************************
+ * Write-ahead log of 2-3 tree mutations.
+ *
+ * Every successful insert/remove made through the log is appended to file
+ * as a record, on open the last checkpoint (a snapshot "<path>.ckpt") is
+ * loaded and the records after it are replayed, so the tree is restored to
+ * the state of the last synced operation.
+ *
+ * Records are idempotent (insert/remove of one key), so a crash between
+ * saving checkpoint and truncating the log only repeats some operations.
+ *
+ * Format (native byte order, all records aligned to 8 bytes):
+ *   header   - magic, version, byte order
+ *   records  - { uint64 size; uint32 op; uint32 checksum; bytes[size]; padding }
+ *****************************************************************************/
+
+#include <stdbool.h>
+
+#include "tree_2_3.h"
+#include "tree_snapshot.h"
+
+
+typedef struct _tree_wal TreeWal;
+
+/* When appended records reach the disk */
+enum wal_durability
+{
+    WAL_BUFFERED,   /* written when the buffer is full, synced on checkpoint and close */
+    WAL_GROUP,      /* written and synced once per group of operations */
+    WAL_SYNC        /* written and synced before each operation returns */
+};
+
+
+/**
+ * @brief Opens the log and restores the tree from checkpoint and log.
+ *
+ * @param path       Log file, created if missing. Checkpoint is "<path>.ckpt".
+ * @param tree       Empty tree to restore. Must copy keys (func_copy),
+ * 					 because replayed keys point to temporary buffers.
+ * 					 The log doesn't own the tree.
+ * @param save_key   Key serialization function. Required.
+ * 					 Serialized keys are passed to the tree on replay.
+ * @param durability One of wal_durability.
+ * @param group_size Count of operations in a group for WAL_GROUP, 0 - default.
+ *
+ * @return A pointer to the log, or NULL if files are corrupted or can't be opened.
+ *
+ * @note A torn record at the end of log (crash while writing) is dropped.
+ */
+TreeWal *   tree_wal_open        (const char *path, Tree_2_3 *tree, func_save_key save_key,
+                                  enum wal_durability durability, unsigned group_size);
+
+/**
+ * @brief Syncs pending records and closes the log, the tree is not changed.
+ *
+ * @return false if pending records couldn't be written.
+ */
+bool        tree_wal_close       (TreeWal **wal);
+
+/* Change the tree and log the operation, return false if the tree isn't
+ * changed (duplicate or missing key) or the record couldn't be written,
+ * then the tree isn't changed too. A torn record is cut from the file,
+ * after failed sync all operations fail until tree_wal_checkpoint() */
+bool        tree_wal_insert_key  (TreeWal *wal, TreeKey key);
+bool        tree_wal_remove_key  (TreeWal *wal, TreeKey key);
+
+/* Write and sync pending records, commit point for WAL_BUFFERED and WAL_GROUP */
+bool        tree_wal_sync        (TreeWal *wal);
+
+/**
+ * @brief Saves the tree to checkpoint and truncates the log.
+ *
+ * @return true on success, false on error (the old checkpoint and log are kept).
+ *
+ * @note After failed sync it saves the tree and makes the log usable again.
+ */
+bool        tree_wal_checkpoint  (TreeWal *wal);
+
+int         tree_wal_count_records   (const TreeWal *wal);   /* records in log after checkpoint */
+int         tree_wal_count_replayed  (const TreeWal *wal);   /* records replayed on open */
+
+#endif
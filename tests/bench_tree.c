@@ -0,0 +1,879 @@
+/* Throughput of tree and hashmap workloads: distributions of keys and
+ * mixes of operations, reported as ops/sec, ns/op and peak RSS,
+ * optionally as JSON to compare results across commits.
+ *
+ * Each workload runs in a forked process, so peak RSS is its own.
+ * With -p hardware counters of each phase are read by perf_event_open */
+
+#include <math.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/resource.h>
+#include <sys/syscall.h>
+#include <sys/wait.h>
+#include <linux/perf_event.h>
+
+#include "tree_2_3/tree_2_3.h"
+#include "hashmap/hashmap.h"
+#include "log/log.h"
+
+
+#define SIZE_ARR(arr)   (sizeof(arr)/sizeof(*arr))
+
+#define BENCH_COUNT     1000000
+#define BENCH_SEED      42
+
+#define CLUSTER_SIZE    64      /* keys in a run of clustered distribution */
+#define SCAN_LENGTH     100     /* keys visited by one scan */
+#define ZIPF_THETA      0.99
+#define BATCH_MAX       1024    /* keys in one tree_search_batch() */
+
+
+/* ---------- workloads ---------------------------------------------------- */
+
+enum structure  { STRUCT_TREE, STRUCT_HASHMAP, STRUCT_FROZEN };
+enum dist       { DIST_SEQUENTIAL, DIST_RANDOM, DIST_ZIPF, DIST_CLUSTERED };
+enum mix        { MIX_READ, MIX_WRITE, MIX_DELETE, MIX_SCAN };
+
+static const char *structure_names[] = { "tree", "hashmap", "frozen" };
+static const char *dist_names[]      = { "sequential", "random", "zipfian", "clustered" };
+static const char *mix_names[]       = { "read", "write", "delete", "scan" };
+
+/* Percents of operations in mix */
+static const struct
+{
+    int read;
+    int insert;
+    int remove;
+    int scan;
+} mixes[] = {
+    [MIX_READ]   = { 90,  5,  5,  0 },
+    [MIX_WRITE]  = { 10, 45, 45,  0 },
+    [MIX_DELETE] = { 10, 10, 80,  0 },
+    [MIX_SCAN]   = {  0,  5,  0, 95 },
+};
+
+
+/* Hardware counters read around each phase */
+#define HW_CACHE_MISS(cache)    ((cache) | (PERF_COUNT_HW_CACHE_OP_READ << 8) | (PERF_COUNT_HW_CACHE_RESULT_MISS << 16))
+
+static const struct
+{
+    const char *name;
+    uint32_t type;
+    uint64_t config;
+} counter_events[] = {
+    { "cycles",        PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES },
+    { "instructions",  PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS },
+    { "l1d_misses",    PERF_TYPE_HW_CACHE, HW_CACHE_MISS(PERF_COUNT_HW_CACHE_L1D) },
+    { "llc_misses",    PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_MISSES },
+    { "branch_misses", PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_MISSES },
+    { "dtlb_misses",   PERF_TYPE_HW_CACHE, HW_CACHE_MISS(PERF_COUNT_HW_CACHE_DTLB) },
+};
+
+#define COUNT_COUNTERS  SIZE_ARR(counter_events)
+
+
+/* Result of one phase (load of keys or mix of operations) */
+struct phase
+{
+    unsigned long ops;
+    double seconds;
+    double compares;                    /* per operation, < 0 if not counted */
+    double counters[COUNT_COUNTERS];    /* per operation, < 0 if not available */
+};
+
+struct result
+{
+    struct phase load;
+    struct phase mix;
+    long peak_rss_kb;
+};
+
+
+struct options
+{
+    unsigned long count;
+    unsigned long ops;
+    unsigned long seed;
+    int structure;      /* index or -1 for all */
+    int dist;
+    int mix;
+    const char *json;
+    const char *label;
+    bool perf;          /* read hardware counters */
+    int bloom_bits;     /* bits per key of Bloom filter, 0 - without filter */
+    int misses;         /* percent of reads of missing keys */
+    int cache_entries;  /* entries of tree lookup cache, 0 - without cache */
+    int batch;          /* tree reads are collected to batches of this size, 0 - one by one */
+};
+
+
+/* Reads collected for tree_search_batch() */
+struct batch
+{
+    uint64_t keys[BATCH_MAX];
+    TreeKey ptrs[BATCH_MAX];
+    const Node_2_3 *found[BATCH_MAX];
+    size_t count;
+};
+
+
+/* ---------- keys --------------------------------------------------------- */
+
+static uint64_t g_rng;
+
+
+static uint64_t next_random(void)
+{
+    /* splitmix64 */
+    uint64_t z = (g_rng += 0x9E3779B97F4A7C15ULL);
+
+    z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+    z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+
+    return z ^ (z >> 31);
+}
+
+
+static unsigned long random_below(unsigned long bound)
+{
+    return next_random() % bound;
+}
+
+
+static int cmp_u64(TreeKey a, TreeKey b)
+{
+    uint64_t x = *(const uint64_t*)a;
+    uint64_t y = *(const uint64_t*)b;
+
+    return (x > y) - (x < y);
+}
+
+
+static int cmp_kv_u64(const KeyVal *a, const KeyVal *b)
+{
+    return cmp_u64(KEY(a), KEY(b));
+}
+
+
+static uint64_t hash_u64(TreeKey key)
+{
+    return *(const uint64_t*)key * 0x9E3779B97F4A7C15ULL;
+}
+
+
+static uint64_t hash_kv_u64(const KeyVal *kv)
+{
+    return hash_u64(KEY(kv));
+}
+
+
+static void shuffle(unsigned long *order, unsigned long count)
+{
+    for (unsigned long i = count; i > 1; i--)
+    {
+        unsigned long j = random_below(i);
+        unsigned long tmp = order[i-1];
+
+        order[i-1] = order[j];
+        order[j] = tmp;
+    }
+}
+
+
+/* Order of loading keys: ascending, random, or runs of
+ * ascending keys in random order for clustered */
+static void make_load_order(unsigned long *order, unsigned long count, enum dist dist)
+{
+    for (unsigned long i = 0; i < count; i++)
+        order[i] = i;
+
+    if (dist == DIST_SEQUENTIAL)
+        return;
+
+    if (dist != DIST_CLUSTERED)
+    {
+        shuffle(order, count);
+        return;
+    }
+
+    unsigned long runs = (count + CLUSTER_SIZE - 1) / CLUSTER_SIZE;
+    unsigned long *starts = malloc(sizeof(*starts) * runs);
+    unsigned long pos = 0;
+
+    if (starts == NULL)
+        exit(EXIT_FAILURE);
+
+    for (unsigned long i = 0; i < runs; i++)
+        starts[i] = i * CLUSTER_SIZE;
+
+    shuffle(starts, runs);
+
+    for (unsigned long i = 0; i < runs; i++)
+        for (unsigned long k = starts[i]; k < count && k < starts[i] + CLUSTER_SIZE; k++)
+            order[pos++] = k;
+
+    free(starts);
+}
+
+
+/* Zipfian ranks as in YCSB (Gray et al., "Quickly generating
+ * billion-record synthetic databases"), rank 0 is the hottest */
+struct zipf
+{
+    unsigned long count;
+    double alpha, zetan, eta;
+};
+
+
+static struct zipf make_zipf(unsigned long count)
+{
+    double zetan = 0;
+    double zeta2 = 1 + pow(0.5, ZIPF_THETA);
+
+    for (unsigned long i = 1; i <= count; i++)
+        zetan += 1 / pow(i, ZIPF_THETA);
+
+    return (struct zipf){
+        .count = count,
+        .alpha = 1 / (1 - ZIPF_THETA),
+        .zetan = zetan,
+        .eta = (1 - pow(2.0 / count, 1 - ZIPF_THETA)) / (1 - zeta2 / zetan),
+    };
+}
+
+
+static unsigned long next_zipf(const struct zipf *zipf)
+{
+    double u = (double)(next_random() >> 11) / (1ULL << 53);
+    double uz = u * zipf->zetan;
+
+    if (uz < 1)
+        return 0;
+
+    if (uz < 1 + pow(0.5, ZIPF_THETA))
+        return 1;
+
+    unsigned long rank = zipf->count * pow(zipf->eta * u - zipf->eta + 1, zipf->alpha);
+
+    return rank < zipf->count ? rank : zipf->count - 1;
+}
+
+
+/* Index of key for the next operation. Hot keys of zipfian
+ * distribution are scattered by <order>, clustered one goes
+ * through short runs of neighbor keys */
+static unsigned long next_index(enum dist dist, unsigned long step, unsigned long count,
+                                const unsigned long *order, const struct zipf *zipf)
+{
+    static unsigned long run_start;
+
+    switch (dist)
+    {
+        case DIST_SEQUENTIAL:
+                    return step % count;
+        case DIST_RANDOM:
+                    return random_below(count);
+        case DIST_ZIPF:
+                    return order[next_zipf(zipf)];
+        case DIST_CLUSTERED:
+                    if (step % 16 == 0)
+                        run_start = random_below(count);
+                    return (run_start + step % 16) % count;
+        default:
+                    exit(EXIT_FAILURE);
+    }
+}
+
+
+/* ---------- auxiliary functions ------------------------------------------ */
+
+static double now(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+
+static long peak_rss_kb(void)
+{
+    struct rusage usage;
+
+    getrusage(RUSAGE_SELF, &usage);
+
+    return usage.ru_maxrss;
+}
+
+
+/* Compares per operation since the last call, if tree counts them */
+static double compares_per_op(Tree_2_3 *tree, unsigned long ops)
+{
+    TreeOpStats stats;
+
+    if (tree == NULL || !tree_get_op_stats(tree, &stats) || ops == 0)
+        return -1;
+
+    tree_reset_op_stats(tree);
+
+    return (double)stats.compares / ops;
+}
+
+
+static void flush_batch(const Tree_2_3 *tree, struct batch *batch)
+{
+    if (batch->count > 0)
+        tree_search_batch(tree, batch->ptrs, batch->count, batch->found);
+
+    batch->count = 0;
+}
+
+
+/* Collect read, the batch is searched when it's full */
+static void add_to_batch(const Tree_2_3 *tree, struct batch *batch, int size, uint64_t key)
+{
+    batch->keys[batch->count] = key;
+    batch->ptrs[batch->count] = &batch->keys[batch->count];
+
+    if (++batch->count == (size_t)size)
+        flush_batch(tree, batch);
+}
+
+
+static void scan_tree(const Tree_2_3 *tree, const uint64_t *key)
+{
+    const Node_2_3 *node = tree_lower_bound(tree, key);
+
+    for (int i = 1; node != NULL && i < SCAN_LENGTH; i++)
+        node = tree_successor(tree, node_get_key(node));
+}
+
+
+/* ---------- hardware counters ------------------------------------------- */
+
+/* Counters of this process, each is opened alone, so the ones
+ * missing in PMU (or in virtual machine) don't disable others */
+struct perf
+{
+    int fds[COUNT_COUNTERS];
+};
+
+
+static int open_counter(uint32_t type, uint64_t config)
+{
+    struct perf_event_attr attr = {
+        .type = type,
+        .size = sizeof(attr),
+        .config = config,
+        .disabled = 1,
+        .exclude_kernel = 1,
+        .exclude_hv = 1,
+        .read_format = PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING,
+    };
+
+    return syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+}
+
+
+/* Return count of opened counters */
+static int perf_open(struct perf *perf, bool enabled)
+{
+    int opened = 0;
+
+    for (size_t i = 0; i < COUNT_COUNTERS; i++)
+    {
+        perf->fds[i] = enabled ? open_counter(counter_events[i].type, counter_events[i].config) : -1;
+        opened += perf->fds[i] >= 0;
+    }
+
+    return opened;
+}
+
+
+static void perf_close(struct perf *perf)
+{
+    for (size_t i = 0; i < COUNT_COUNTERS; i++)
+        if (perf->fds[i] >= 0)
+            close(perf->fds[i]);
+}
+
+
+static void perf_start(const struct perf *perf)
+{
+    for (size_t i = 0; i < COUNT_COUNTERS; i++)
+    {
+        if (perf->fds[i] >= 0)
+        {
+            ioctl(perf->fds[i], PERF_EVENT_IOC_RESET, 0);
+            ioctl(perf->fds[i], PERF_EVENT_IOC_ENABLE, 0);
+        }
+    }
+}
+
+
+/* Save counters per operation, scaled if PMU was shared by counters */
+static void perf_stop(const struct perf *perf, unsigned long ops, double *per_op)
+{
+    for (size_t i = 0; i < COUNT_COUNTERS; i++)
+    {
+        uint64_t value[3];  /* value, time enabled, time running */
+
+        per_op[i] = -1;
+
+        if (perf->fds[i] < 0)
+            continue;
+
+        ioctl(perf->fds[i], PERF_EVENT_IOC_DISABLE, 0);
+
+        if (read(perf->fds[i], value, sizeof(value)) != sizeof(value) || value[2] == 0 || ops == 0)
+            continue;
+
+        per_op[i] = (double)value[0] * value[1] / value[2] / ops;
+    }
+}
+
+
+/* ---------- workload ----------------------------------------------------- */
+
+static struct result run_workload(const struct options *opt, enum structure structure,
+                                  enum dist dist, enum mix mix)
+{
+    struct result result = { 0 };
+    unsigned long count = opt->count;
+    uint64_t *keys = malloc(sizeof(*keys) * count);
+    unsigned long *order = malloc(sizeof(*order) * count);
+    struct zipf zipf = { 0 };
+
+
+    if (keys == NULL || order == NULL)
+    {
+        fprintf(stderr, "not enough memory for %lu keys\n", count);
+        exit(EXIT_FAILURE);
+    }
+
+    g_rng = opt->seed;
+
+    /* odd keys, so there are gaps between them */
+    for (unsigned long i = 0; i < count; i++)
+        keys[i] = 2 * i + 1;
+
+    make_load_order(order, count, dist);
+
+    if (dist == DIST_ZIPF)
+        zipf = make_zipf(count);
+
+    Tree_2_3 *tree = NULL;
+    HashMap *hashmap = NULL;
+    TreeFrozen *frozen = NULL;
+
+    if (structure == STRUCT_HASHMAP)
+        hashmap = hm_create(cmp_kv_u64, NULL, NULL);
+    else
+        tree = tree_create(cmp_u64, NULL, NULL);
+
+    if (opt->cache_entries > 0 && tree)
+        tree_set_lookup_cache(tree, hash_u64, opt->cache_entries);
+
+    if (opt->bloom_bits > 0 && tree)
+        tree_set_bloom_filter(tree, hash_u64, opt->bloom_bits);
+    else
+    if (opt->bloom_bits > 0)
+        hm_set_bloom_filter(hashmap, hash_kv_u64, opt->bloom_bits);
+
+    struct perf perf;
+
+    perf_open(&perf, opt->perf);
+
+    /* load */
+    perf_start(&perf);
+    double start = now();
+
+    for (unsigned long i = 0; i < count; i++)
+    {
+        uint64_t *key = &keys[order[i]];
+
+        if (tree)
+            tree_insert_key(tree, key);
+        else
+            hm_insert_kv(hashmap, key, NULL);
+    }
+
+    /* frozen tree is built by conversion of loaded one */
+    if (structure == STRUCT_FROZEN)
+        frozen = tree_freeze(&tree);
+
+    result.load.seconds = now() - start;
+    perf_stop(&perf, count, result.load.counters);
+
+    result.load.ops = count;
+    result.load.compares = compares_per_op(tree, count);
+
+    static struct batch batch;
+
+    /* mix */
+    perf_start(&perf);
+    start = now();
+
+    for (unsigned long step = 0; step < opt->ops; step++)
+    {
+        uint64_t *key = &keys[next_index(dist, step, count, order, &zipf)];
+        int op = random_below(100);
+
+        /* even neighbor of odd key is missing, random isn't drawn without misses,
+           so the workload is the same as before */
+        uint64_t missing = *key + 1;
+        uint64_t *read_key = opt->misses > 0 && (int)random_below(100) < opt->misses ? &missing : key;
+
+        /* reads before change see the tree as they would one by one */
+        if (tree && batch.count > 0 && op >= mixes[mix].read)
+            flush_batch(tree, &batch);
+
+        if (frozen)
+            tree_frozen_search_key(frozen, read_key);
+        else
+        if (op < mixes[mix].read)
+        {
+            if (tree && opt->batch > 0)
+                add_to_batch(tree, &batch, opt->batch, *read_key);
+            else
+            if (tree)
+                tree_search_key(tree, read_key);
+            else
+                hm_get_value(hashmap, read_key);
+        }
+        else
+        if ((op -= mixes[mix].read) < mixes[mix].insert)
+        {
+            if (tree)
+                tree_insert_key(tree, key);
+            else
+                hm_insert_kv(hashmap, key, NULL);
+        }
+        else
+        if ((op -= mixes[mix].insert) < mixes[mix].remove)
+        {
+            if (tree)
+                tree_remove_key(tree, key);
+            else
+                hm_remove_key(hashmap, key);
+        }
+        else
+            scan_tree(tree, key);
+    }
+
+    if (tree)
+        flush_batch(tree, &batch);
+
+    result.mix.seconds = now() - start;
+    perf_stop(&perf, opt->ops, result.mix.counters);
+    perf_close(&perf);
+
+    result.mix.ops = opt->ops;
+    result.mix.compares = compares_per_op(tree, opt->ops);
+
+    result.peak_rss_kb = peak_rss_kb();
+
+    if (tree)
+        tree_destroy(&tree);
+    else
+    if (frozen)
+        tree_frozen_destroy(&frozen);
+    else
+        hm_destroy(&hashmap);
+
+    free(keys);
+    free(order);
+
+    return result;
+}
+
+
+/* Run workload in child process, so peak RSS isn't mixed with others */
+static bool run_isolated(const struct options *opt, enum structure structure,
+                         enum dist dist, enum mix mix, struct result *result)
+{
+    int fds[2];
+
+    if (pipe(fds) != 0)
+        return false;
+
+    fflush(stdout);
+    pid_t pid = fork();
+
+    if (pid < 0)
+    {
+        close(fds[0]);
+        close(fds[1]);
+        return false;
+    }
+
+    if (pid == 0)
+    {
+        close(fds[0]);
+        *result = run_workload(opt, structure, dist, mix);
+
+        bool written = write(fds[1], result, sizeof(*result)) == sizeof(*result);
+        _exit(written ? EXIT_SUCCESS : EXIT_FAILURE);
+    }
+
+    close(fds[1]);
+
+    bool readed = read(fds[0], result, sizeof(*result)) == sizeof(*result);
+    int status = 0;
+
+    close(fds[0]);
+    waitpid(pid, &status, 0);
+
+    return readed && WIFEXITED(status) && WEXITSTATUS(status) == EXIT_SUCCESS;
+}
+
+
+/* ---------- report ------------------------------------------------------- */
+
+static void print_phase(FILE *table, const char *structure, const char *dist, const char *mix,
+                        const char *name, const struct phase *phase, long rss_kb)
+{
+    double ops_per_sec = phase->ops / phase->seconds;
+
+    fprintf(table, "%-8s %-11s %-7s %-5s %12.0f %10.1f %12ld", structure, dist, mix, name,
+           ops_per_sec, 1e9 / ops_per_sec, rss_kb);
+
+    if (phase->compares >= 0)
+        fprintf(table, " %10.2f", phase->compares);
+
+    fprintf(table, "\n");
+}
+
+
+/* Counters per operation under the phase line, if any is available */
+static void print_counters(FILE *table, const struct phase *phase)
+{
+    bool any = false;
+
+    for (size_t i = 0; i < COUNT_COUNTERS; i++)
+        any |= phase->counters[i] >= 0;
+
+    if (!any)
+        return;
+
+    fprintf(table, "%36s", "per op:");
+
+    for (size_t i = 0; i < COUNT_COUNTERS; i++)
+    {
+        if (phase->counters[i] >= 0)
+            fprintf(table, " %s %.2f", counter_events[i].name, phase->counters[i]);
+        else
+            fprintf(table, " %s n/a", counter_events[i].name);
+    }
+
+    fprintf(table, "\n");
+}
+
+
+static void json_phase(FILE *json, bool *first, bool perf, const char *structure, const char *dist,
+                       const char *mix, const char *name, const struct phase *phase, long rss_kb)
+{
+    double ops_per_sec = phase->ops / phase->seconds;
+
+    fprintf(json, "%s\n    { \"structure\": \"%s\", \"distribution\": \"%s\", \"mix\": \"%s\", "
+            "\"phase\": \"%s\", \"ops\": %lu, \"seconds\": %.6f, \"ops_per_sec\": %.1f, "
+            "\"ns_per_op\": %.2f, \"peak_rss_kb\": %ld",
+            *first ? "" : ",", structure, dist, mix, name, phase->ops, phase->seconds,
+            ops_per_sec, 1e9 / ops_per_sec, rss_kb);
+
+    if (phase->compares >= 0)
+        fprintf(json, ", \"compares_per_op\": %.3f", phase->compares);
+
+    /* unavailable counters are null */
+    if (perf)
+    {
+        fprintf(json, ", \"counters_per_op\": {");
+
+        for (size_t i = 0; i < COUNT_COUNTERS; i++)
+        {
+            fprintf(json, "%s \"%s\": ", i ? "," : "", counter_events[i].name);
+
+            if (phase->counters[i] >= 0)
+                fprintf(json, "%.3f", phase->counters[i]);
+            else
+                fprintf(json, "null");
+        }
+
+        fprintf(json, " }");
+    }
+
+    fprintf(json, " }");
+    *first = false;
+}
+
+
+static void usage(const char *name)
+{
+    fprintf(stderr,
+            "usage: %s [-n keys] [-o ops] [-s tree|hashmap|frozen] [-d sequential|random|zipfian|clustered]\n"
+            "          [-m read|write|delete|scan] [-r seed] [-j report.json|-] [-l label] [-p]\n"
+            "          [-f bloom bits per key] [-x percent of missing reads] [-c cache entries] [-b batch]\n"
+            "  keys and ops accept exponent form (1e6), by default ops = keys,\n"
+            "  all structures, distributions and mixes are run,\n"
+            "  -p reads hardware counters (cycles, instructions, cache, branch and TLB misses),\n"
+            "  -f attaches Bloom filter to tree and hashmap, -c attaches lookup cache to tree,\n"
+            "  -b searches tree reads in batches (up to %d keys)\n", name, BATCH_MAX);
+}
+
+
+static int find_name(const char **names, size_t count, const char *name)
+{
+    for (size_t i = 0; i < count; i++)
+        if (strcmp(names[i], name) == 0)
+            return i;
+
+    return -2;
+}
+
+
+static bool parse_options(int argc, char **argv, struct options *opt)
+{
+    int c;
+
+    *opt = (struct options){ .count = BENCH_COUNT, .seed = BENCH_SEED, .structure = -1, .dist = -1, .mix = -1 };
+
+    while ((c = getopt(argc, argv, "n:o:s:d:m:r:j:l:f:x:c:b:ph")) != -1)
+    {
+        switch (c)
+        {
+            case 'n':   opt->count = strtod(optarg, NULL);  break;
+            case 'o':   opt->ops = strtod(optarg, NULL);    break;
+            case 'r':   opt->seed = strtoul(optarg, NULL, 0); break;
+            case 'j':   opt->json = optarg;                 break;
+            case 'l':   opt->label = optarg;                break;
+            case 'p':   opt->perf = true;                   break;
+            case 'f':   opt->bloom_bits = atoi(optarg);     break;
+            case 'x':   opt->misses = atoi(optarg);         break;
+            case 'c':   opt->cache_entries = atoi(optarg);  break;
+            case 'b':   opt->batch = atoi(optarg);          break;
+            case 's':   opt->structure = find_name(structure_names, SIZE_ARR(structure_names), optarg); break;
+            case 'd':   opt->dist = find_name(dist_names, SIZE_ARR(dist_names), optarg);                break;
+            case 'm':   opt->mix = find_name(mix_names, SIZE_ARR(mix_names), optarg);                   break;
+            default:    return false;
+        }
+    }
+
+    if (opt->ops == 0)
+        opt->ops = opt->count;
+
+    return opt->count > 0 && opt->batch >= 0 && opt->batch <= BATCH_MAX && opt->structure != -2 && opt->dist != -2 && opt->mix != -2;
+}
+
+
+/* ---------- bench -------------------------------------------------------- */
+
+int main(int argc, char **argv)
+{
+    log_set_level(LOG_LEVEL);
+
+    struct options opt;
+
+    if (!parse_options(argc, argv, &opt))
+    {
+        usage(argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    /* Fall back to timing only, if kernel or PMU doesn't give counters */
+    if (opt.perf)
+    {
+        struct perf probe;
+
+        if (perf_open(&probe, true) == 0)
+        {
+            fprintf(stderr, "hardware counters are unavailable (%s), see "
+                    "/proc/sys/kernel/perf_event_paranoid\n", strerror(errno));
+            opt.perf = false;
+        }
+
+        perf_close(&probe);
+    }
+
+    FILE *json = NULL;
+    bool first = true;
+
+    if (opt.json)
+    {
+        json = strcmp(opt.json, "-") == 0 ? stdout : fopen(opt.json, "w");
+
+        if (json == NULL)
+        {
+            perror(opt.json);
+            return EXIT_FAILURE;
+        }
+
+        fprintf(json, "{\n  \"label\": \"%s\", \"keys\": %lu, \"ops\": %lu, \"seed\": %lu, "
+                "\"bloom_bits\": %d, \"misses\": %d, \"cache_entries\": %d, \"batch\": %d,\n  \"results\": [",
+                opt.label ? opt.label : "", opt.count, opt.ops, opt.seed, opt.bloom_bits, opt.misses, opt.cache_entries, opt.batch);
+    }
+
+    FILE *table = json == stdout ? stderr : stdout;
+    int failed = 0;
+
+    fprintf(table, "%-8s %-11s %-7s %-5s %12s %10s %12s %10s\n",
+            "struct", "dist", "mix", "phase", "ops/sec", "ns/op", "peak_rss_kb", "cmp/op");
+
+    for (size_t s = 0; s < SIZE_ARR(structure_names); s++)
+    for (size_t d = 0; d < SIZE_ARR(dist_names); d++)
+    for (size_t m = 0; m < SIZE_ARR(mix_names); m++)
+    {
+        if ((opt.structure >= 0 && opt.structure != (int)s) ||
+            (opt.dist >= 0 && opt.dist != (int)d) ||
+            (opt.mix >= 0 && opt.mix != (int)m))
+            continue;
+
+        /* hashmap has no ordered iteration */
+        if (s == STRUCT_HASHMAP && m == MIX_SCAN)
+            continue;
+
+        /* frozen tree is read-only, all operations of its mix are lookups */
+        if (s == STRUCT_FROZEN && m != MIX_READ)
+            continue;
+
+        struct result result;
+
+        if (!run_isolated(&opt, s, d, m, &result))
+        {
+            fprintf(stderr, "workload %s/%s/%s failed\n", structure_names[s], dist_names[d], mix_names[m]);
+            failed++;
+            continue;
+        }
+
+        print_phase(table, structure_names[s], dist_names[d], mix_names[m], "load", &result.load, result.peak_rss_kb);
+        print_counters(table, &result.load);
+        print_phase(table, structure_names[s], dist_names[d], mix_names[m], "mix", &result.mix, result.peak_rss_kb);
+        print_counters(table, &result.mix);
+
+        if (json)
+        {
+            json_phase(json, &first, opt.perf, structure_names[s], dist_names[d], mix_names[m],
+                       "load", &result.load, result.peak_rss_kb);
+            json_phase(json, &first, opt.perf, structure_names[s], dist_names[d], mix_names[m],
+                       "mix", &result.mix, result.peak_rss_kb);
+        }
+    }
+
+    if (json)
+    {
+        fprintf(json, "\n  ]\n}\n");
+
+        if (json != stdout)
+            fclose(json);
+    }
+
+    return failed ? EXIT_FAILURE : EXIT_SUCCESS;
+}
@@ -0,0 +1,163 @@
+/* Throughput of tree mutations through write-ahead log
+ * at each durability level, and time of recovery from log */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "tree_2_3/tree_2_3.h"
+#include "tree_2_3/tree_wal.h"
+#include "log/log.h"
+
+
+#define BENCH_PATH      "./bench_tree_wal.log"
+#define BENCH_COUNT     100000
+
+
+/* ---------- double functions --------------------------------------------- */
+
+static int cmp_double(TreeKey a, TreeKey b)
+{
+    double x = *(const double*)a;
+    double y = *(const double*)b;
+
+    return (x > y) - (x < y);
+}
+
+
+static TreeKey copy_double(TreeKey key)
+{
+    double *copy = malloc(sizeof(double));
+
+    if (copy == NULL)
+        exit(EXIT_FAILURE);
+
+    *copy = *(const double*)key;
+
+    return copy;
+}
+
+
+static void free_double(TreeKey key)
+{
+    free((void*)key);
+}
+
+
+static size_t save_double(TreeKey key, void *buffer, size_t size)
+{
+    if (size >= sizeof(double))
+        memcpy(buffer, key, sizeof(double));
+
+    return sizeof(double);
+}
+
+
+/* ---------- auxiliary functions ------------------------------------------ */
+
+static double now(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+
+/* Insert all keys and remove every fourth one, return ops/sec */
+static double run_level(enum wal_durability durability, const double *keys, int count, int *ops)
+{
+    Tree_2_3 *tree = tree_create(cmp_double, copy_double, free_double);
+    TreeWal *wal = tree_wal_open(BENCH_PATH, tree, save_double, durability, 0);
+    double start = now();
+
+
+    *ops = 0;
+
+    for (int i = 0; i < count; i++)
+        *ops += tree_wal_insert_key(wal, &keys[i]);
+
+    for (int i = 0; i < count; i += 4)
+        *ops += tree_wal_remove_key(wal, &keys[i]);
+
+    tree_wal_close(&wal);
+
+    double elapsed = now() - start;
+
+    tree_destroy(&tree);
+
+    return *ops / elapsed;
+}
+
+
+static double run_recovery(int *replayed)
+{
+    Tree_2_3 *tree = tree_create(cmp_double, copy_double, free_double);
+    double start = now();
+    TreeWal *wal = tree_wal_open(BENCH_PATH, tree, save_double, WAL_BUFFERED, 0);
+    double elapsed = now() - start;
+
+
+    *replayed = tree_wal_count_replayed(wal);
+
+    tree_wal_close(&wal);
+    tree_destroy(&tree);
+
+    return elapsed;
+}
+
+
+/* ---------- bench -------------------------------------------------------- */
+
+int main(int argc, char **argv)
+{
+    log_set_level(LOG_LEVEL);
+
+    const char *names[] = { "buffered", "group", "sync" };
+    const enum wal_durability levels[] = { WAL_BUFFERED, WAL_GROUP, WAL_SYNC };
+    int count = argc > 1 ? atoi(argv[1]) : BENCH_COUNT;
+    double *keys = malloc(sizeof(double) * (count > 0 ? count : 1));
+
+
+    if (keys == NULL || count <= 0)
+    {
+        fprintf(stderr, "usage: %s [count of keys]\n", argv[0]);
+        free(keys);
+        return EXIT_FAILURE;
+    }
+
+    srand(42);
+
+    for (int i = 0; i < count; i++)
+        keys[i] = rand();
+
+    int replayed = 0;
+    double recovery = 0;
+
+    printf("%-10s %12s %14s\n", "level", "ops", "ops/sec");
+
+    for (size_t l = 0; l < sizeof(levels)/sizeof(*levels); l++)
+    {
+        int ops = 0;
+
+        remove(BENCH_PATH);
+
+        /* sync level is slow by design, so it gets fewer keys */
+        int level_count = levels[l] == WAL_SYNC && count > 1000 ? 1000 : count;
+        double throughput = run_level(levels[l], keys, level_count, &ops);
+
+        printf("%-10s %12d %14.0f\n", names[l], ops, throughput);
+
+        if (levels[l] == WAL_BUFFERED)
+            recovery = run_recovery(&replayed);
+    }
+
+    printf("recovery of %d records: %.3f sec\n", replayed, recovery);
+
+    remove(BENCH_PATH);
+    free(keys);
+
+    return EXIT_SUCCESS;
+}
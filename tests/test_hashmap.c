@@ -147,6 +147,12 @@ static void free_kv(const KeyVal *key)
 }
 
 
+static uint64_t hash_kv(const KeyVal *kv)
+{
+    return *(Key*)KEY(kv) * 0x9E3779B97F4A7C15ULL;
+}
+
+
 static void print_kv(const KeyVal *kv)
 {
     log_trace("%s", __func__);
@@ -262,6 +268,54 @@ START_TEST(test_create_empty_hashmap)
 END_TEST
 
 
+/* Allocator that counts blocks in use */
+static void * counted_alloc(size_t size, void *ctx)
+{
+    (*(long*)ctx)++;
+
+    return malloc(size);
+}
+
+
+static void counted_free(void *ptr, size_t size, void *ctx)
+{
+    (void)size;
+    (*(long*)ctx)--;
+
+    free(ptr);
+}
+
+
+START_TEST(test_create_with_allocator)
+{
+    long blocks = 0;
+    int len_vals = SIZE_ARR(g_test_data);
+    HmAllocator allocator = { counted_alloc, counted_free, &blocks };
+    HmAllocator incomplete = { NULL, counted_free, &blocks };
+
+
+    ck_assert_ptr_null(hm_create_ex(cmp_kv, copy_kv, free_kv, &incomplete));
+
+    HashMap *hashmap = hm_create_ex(cmp_kv, copy_kv, free_kv, &allocator);
+    ck_assert_ptr_nonnull(hashmap);
+    ck_assert_int_eq(blocks, 2);  // hashmap and its tree
+
+    fill_hashmap_test_data(hashmap);
+
+    /* leaf and KeyVal for each key, and inner nodes */
+    ck_assert_int_gt(blocks, 2 + 2 * len_vals);
+
+    hm_clear(hashmap);
+    ck_assert_int_eq(blocks, 2);
+
+    hm_destroy(&hashmap);
+    ck_assert_int_eq(blocks, 0);
+
+    g_memory_counter = (struct memory_counter){0};
+}
+END_TEST
+
+
 /* ========== DESTROY ====================================================== */
 
 
@@ -594,6 +648,35 @@ START_TEST(test_search_random_key)
 END_TEST
 
 
+/* using fixtures - setup_data/teardown_data callbacks */
+START_TEST(test_search_with_bloom_filter)
+{
+    Key missing = KEY_FROM_DATE(0, 0, 0);
+    Key added = today();
+
+
+    hm_set_bloom_filter(_hashmap, hash_kv, 0);
+
+    for (int i = 0; i < SIZE_ARR(g_test_data); i++)
+    {
+        ck_assert(hm_is_contain(_hashmap, &g_test_data[i].key));
+    }
+
+    ck_assert(!hm_is_contain(_hashmap, &missing));
+    ck_assert(!hm_remove_key(_hashmap, &missing));
+
+    /* filter is kept on insert and remove */
+    ck_assert(hm_insert_kv(_hashmap, &added, "today"));
+    ck_assert_str_eq(hm_get_value(_hashmap, &added), "today");
+    ck_assert(hm_remove_key(_hashmap, &g_test_data[0].key));
+    ck_assert(!hm_is_contain(_hashmap, &g_test_data[0].key));
+
+    hm_set_bloom_filter(_hashmap, NULL, 0);
+    ck_assert(hm_is_contain(_hashmap, &added));
+}
+END_TEST
+
+
 /* ========== COPY_FUNC ==================================================== */
 
 /* using fixtures - setup/teardown callbacks */
@@ -662,6 +745,10 @@ static Suite* make_suite_create(void)
     tcase_add_test(tc_create_empty, test_create_empty_hashmap);
     suite_add_tcase(s, tc_create_empty);
 
+    TCase* tc_create_allocator = tcase_create("Create hashmap with allocator");
+    tcase_add_test(tc_create_allocator, test_create_with_allocator);
+    suite_add_tcase(s, tc_create_allocator);
+
     return s;
 }
 
@@ -795,6 +882,11 @@ static Suite* make_suite_search(void)
     tcase_add_test(tc_search_random, test_search_random_key);
     suite_add_tcase(s, tc_search_random);
 
+    TCase* tc_search_bloom = tcase_create("Search with Bloom filter");
+    tcase_add_checked_fixture(tc_search_bloom, setup_data, teardown_data);
+    tcase_add_test(tc_search_bloom, test_search_with_bloom_filter);
+    suite_add_tcase(s, tc_search_bloom);
+
     return s;
 }
 
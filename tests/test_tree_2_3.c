@@ -72,6 +72,16 @@ static void free_double(TreeKey key)
 }
 
 
+static uint64_t hash_double(TreeKey key)
+{
+    uint64_t bits;
+
+    memcpy(&bits, key, sizeof(bits));
+
+    return bits * 0x9E3779B97F4A7C15ULL;
+}
+
+
 static void print_double(TreeKey value)
 {
     printf("%.9lf", *(double*)value);
@@ -106,6 +116,16 @@ static void print_string(TreeKey value)
 
 /* ---------- auxiliary functions ------------------------------------------ */
 
+static unsigned long g_compare_count;  /* calls of cmp_double_counted */
+
+static int cmp_double_counted(TreeKey a, TreeKey b)
+{
+    g_compare_count++;
+
+    return cmp_double(a, b);
+}
+
+
 static void setup(void)
 {
     log_trace("%s", __func__);
@@ -151,6 +171,184 @@ START_TEST(test_create_empty_tree)
 END_TEST
 
 
+/* Allocator that counts blocks and bytes in use */
+struct alloc_counter
+{
+    long blocks;
+    long bytes;
+};
+
+
+static void * counted_alloc(size_t size, void *ctx)
+{
+    struct alloc_counter *counter = ctx;
+
+    counter->blocks++;
+    counter->bytes += size;
+
+    return malloc(size);
+}
+
+
+static void counted_free(void *ptr, size_t size, void *ctx)
+{
+    struct alloc_counter *counter = ctx;
+
+    counter->blocks--;
+    counter->bytes -= size;
+
+    free(ptr);
+}
+
+
+START_TEST(test_create_with_allocator)
+{
+    const int count_vals = 1000;
+
+    struct alloc_counter counter = {0}, other_counter = {0};
+    TreeAllocator allocator = { counted_alloc, counted_free, &counter };
+    TreeAllocator other = { counted_alloc, counted_free, &other_counter };
+    TreeAllocator incomplete = { counted_alloc, NULL, &counter };
+    Tree_2_3 *left = NULL, *right = NULL;
+    double key = count_vals / 3;
+
+
+    ck_assert_ptr_null(tree_create_ex(cmp_double, copy_double, free_double, &incomplete));
+
+    Tree_2_3 *tree = tree_create_ex(cmp_double, copy_double, free_double, &allocator);
+    ck_assert_ptr_nonnull(tree);
+    ck_assert_int_eq(counter.blocks, 1);
+
+    for (int i = 0; i < count_vals; i++)
+    {
+        double val = i;
+        ck_assert(tree_insert_key(tree, &val));
+    }
+
+    /* all nodes and tree struct */
+    TreeMemoryStats stats;
+    tree_memory_stats(tree, &stats);
+    ck_assert_int_eq(counter.bytes, stats.node_bytes);
+
+    /* derived trees use the same allocator */
+    ck_assert(tree_split(tree, &key, &left, &right));
+    Tree_2_3 *united = tree_union(left, right);
+
+    long bytes = 0;
+    Tree_2_3 *trees[] = { tree, left, right, united };
+
+    for (size_t i = 0; i < SIZE_ARR(trees); i++)
+    {
+        tree_memory_stats(trees[i], &stats);
+        bytes += stats.node_bytes;
+    }
+
+    ck_assert_int_eq(counter.bytes, bytes);
+    tree_destroy(&united);
+
+    Tree_2_3 *alien = tree_create_ex(cmp_double, copy_double, free_double, &other);
+    ck_assert(!tree_join(left, &alien));
+    tree_destroy(&alien);
+    ck_assert_int_eq(other_counter.blocks, 0);
+
+    ck_assert(tree_join(left, &right));
+    tree_destroy(&tree);
+
+    TreeFrozen *frozen = tree_freeze(&left);
+    left = tree_thaw(&frozen);
+    ck_assert_int_eq(tree_count_elements(left), count_vals);
+    ck_assert_int_gt(counter.blocks, 1);
+
+    tree_destroy(&left);
+    ck_assert_int_eq(counter.blocks, 0);
+    ck_assert_int_eq(counter.bytes, 0);
+}
+END_TEST
+
+
+/* Object of user linked into intrusive tree */
+struct item
+{
+    int value;
+    TreeHook hook;
+};
+
+
+static int cmp_item(TreeKey a, TreeKey b)
+{
+    const struct item *x = TREE_CONTAINER_OF(a, struct item, hook);
+    const struct item *y = TREE_CONTAINER_OF(b, struct item, hook);
+
+    return (x->value > y->value) - (x->value < y->value);
+}
+
+
+START_TEST(test_create_intrusive_tree)
+{
+    const int count_vals = 1000;
+
+    struct alloc_counter counter = {0};
+    TreeAllocator allocator = { counted_alloc, counted_free, &counter };
+    struct item *items = calloc(count_vals, sizeof(*items));
+    struct item probe = { .value = count_vals / 2 };
+    TreeMemoryStats stats;
+
+
+    ck_assert_ptr_nonnull(items);
+
+    Tree_2_3 *tree = tree_create_intrusive(cmp_item, &allocator);
+    ck_assert_ptr_nonnull(tree);
+
+    for (int i = 0; i < count_vals; i++)
+    {
+        items[i].value = (i * 7919) % count_vals;
+        ck_assert(tree_link(tree, &items[i].hook));
+    }
+
+    ck_assert(!tree_link(tree, &items[0].hook));
+    ck_assert(tree_check_invariants(tree));
+
+    /* the allocator gives only inner nodes and tree struct */
+    tree_memory_stats(tree, &stats);
+    ck_assert_int_eq(counter.blocks, stats.inner_2 + stats.inner_3 + 1);
+    ck_assert_int_eq(counter.bytes, stats.node_bytes);
+
+    /* search by hook of object made for search */
+    const Node_2_3 *node = tree_search_key(tree, &probe.hook);
+    struct item *found = TREE_CONTAINER_OF(node_get_key(node), struct item, hook);
+    ck_assert_int_eq(found->value, probe.value);
+
+    ck_assert(tree_unlink(tree, &found->hook));
+    ck_assert(!tree_unlink(tree, &found->hook));
+    ck_assert_ptr_null(tree_search_key(tree, &probe.hook));
+
+    /* popped key is the hook */
+    struct item *min = TREE_CONTAINER_OF(tree_pop_min(tree), struct item, hook);
+    ck_assert_int_eq(min->value, 0);
+    ck_assert_int_eq(tree_count_elements(tree), count_vals - 2);
+
+    /* objects are relinked again */
+    ck_assert(tree_link(tree, &found->hook));
+    ck_assert(tree_link(tree, &min->hook));
+    ck_assert(tree_check_invariants(tree));
+
+    /* key of intrusive tree is the leaf, so it can't be swapped or buried */
+    tree_set_lazy_delete(tree, true, 0);
+    ck_assert(!tree_replace_key(tree, &probe.hook));
+    ck_assert(tree_unlink(tree, &found->hook));
+    ck_assert_ptr_null(tree_search_key(tree, &probe.hook));
+
+    tree_destroy(&tree);
+    ck_assert_int_eq(counter.blocks, 0);
+
+    /* objects are only unlinked by destroy */
+    ck_assert_int_eq(items[count_vals - 1].value, (count_vals - 1) * 7919 % count_vals);
+    ck_assert(!tree_link(NULL, &items[0].hook));
+    free(items);
+}
+END_TEST
+
+
 /* ========== DESTROY ====================================================== */
 
 START_TEST(test_destroy_empty_tree)
@@ -294,6 +492,129 @@ START_TEST(test_insert_many_ascending)
 END_TEST
 
 
+START_TEST(test_append_sorted_keys)
+{
+    const int count_vals = 10000;
+    double *vals = malloc(sizeof(double) * count_vals);
+    Tree_2_3 *tree = tree_create(cmp_double_counted, NULL, NULL);
+
+
+    for (int i = 0; i < count_vals; i++)
+        vals[i] = i;
+
+    g_compare_count = 0;
+
+    for (int i = 0; i < count_vals; i++)
+    {
+        ck_assert(tree_insert_key(tree, &vals[i]));
+    }
+
+    /* one comparison with maximum per key, no descent */
+    ck_assert_uint_lt(g_compare_count, (unsigned long)count_vals);
+    ck_assert_int_eq(tree_count_elements(tree), count_vals);
+    ck_assert(!tree_insert_key(tree, &vals[count_vals - 1]));
+
+    for (int i = 0; i < count_vals; i++)
+    {
+        ck_assert_ptr_nonnull(tree_search_key(tree, &vals[i]));
+    }
+
+    tree_destroy(&tree);
+    free(vals);
+}
+END_TEST
+
+
+/* using fixtures - setup/teardown callbacks */
+START_TEST(test_insert_hint)
+{
+    const double vals[] = { 50, 51, 52, 53, 54, 55 };
+    const double lows[] = { 49, 48, 47 };
+    const double middle = 52.5;
+    const Node_2_3 *hint = NULL;
+
+
+    for (size_t i = 0; i < SIZE_ARR(vals); i++)
+    {
+        hint = tree_insert_hint(_tree, &vals[i], hint);
+        ck_assert_ptr_nonnull(hint);
+        ck_assert_ptr_eq(node_get_key(hint), &vals[i]);
+    }
+
+    /* hint is the minimal leaf, keys go before it */
+    hint = tree_search_key(_tree, &vals[0]);
+
+    for (size_t i = 0; i < SIZE_ARR(lows); i++)
+    {
+        hint = tree_insert_hint(_tree, &lows[i], hint);
+        ck_assert_ptr_nonnull(hint);
+    }
+
+    /* hint isn't an end of tree, descent from its ancestor */
+    hint = tree_insert_hint(_tree, &middle, hint);
+    ck_assert_ptr_nonnull(hint);
+    ck_assert_ptr_eq(node_get_key(hint), &middle);
+
+    ck_assert_ptr_null(tree_insert_hint(_tree, &middle, hint));
+    ck_assert_ptr_null(tree_insert_hint(_tree, &vals[5], tree_search_key(_tree, &vals[5])));
+
+    ck_assert_int_eq(tree_count_elements(_tree), SIZE_ARR(vals) + SIZE_ARR(lows) + 1);
+    ck_assert_double_eq(*(const double *)tree_get_min(_tree), lows[2]);
+    ck_assert_double_eq(*(const double *)tree_get_max(_tree), vals[5]);
+}
+END_TEST
+
+
+START_TEST(test_insert_hint_middle)
+{
+    const int count_vals = 1024;
+    TreeOpStats ops;
+
+    Tree_2_3 *tree = MAKE_TREE(double);
+
+
+    for (int i = 0; i < count_vals; i++)
+    {
+        double key = 2 * i;
+        ck_assert(tree_insert_key(tree, &key));
+    }
+
+    /* hint is far from ends of tree, the key goes right after it */
+    double middle = count_vals + 1;
+    double hint_key = count_vals;
+    const Node_2_3 *hint = tree_search_key(tree, &hint_key);
+
+    tree_reset_op_stats(tree);
+
+    const Node_2_3 *leaf = tree_insert_hint(tree, &middle, hint);
+    bool counted = tree_get_op_stats(tree, &ops);
+    unsigned long hinted = ops.compares;
+
+    ck_assert_ptr_nonnull(leaf);
+    ck_assert_double_eq(*(const double *)node_get_key(leaf), middle);
+    ck_assert_ptr_eq(tree_next_node(tree, hint), leaf);
+    ck_assert_ptr_null(tree_insert_hint(tree, &middle, hint));
+    ck_assert(tree_check_invariants(tree));
+    ck_assert_int_eq(tree_count_elements(tree), count_vals + 1);
+
+    /* descent from the root compares at least once per level, descent near hint doesn't */
+    if (counted)
+    {
+        double after = middle + 2;
+
+        tree_reset_op_stats(tree);
+        ck_assert(tree_insert_key(tree, &after));
+        tree_get_op_stats(tree, &ops);
+
+        ck_assert_uint_lt(hinted, tree_height(tree));
+        ck_assert_uint_lt(hinted, ops.compares);
+    }
+
+    tree_destroy(&tree);
+}
+END_TEST
+
+
 /* using fixtures - setup/teardown callbacks */
 START_TEST(test_insert_many_descending)
 {
@@ -333,6 +654,82 @@ START_TEST(test_insert_duplicate)
 END_TEST
 
 
+/* using fixtures - setup/teardown callbacks */
+START_TEST(test_find_or_insert)
+{
+    const double vals[] = { 4, 2, 6, 1, 3, 5, 7 };
+    bool inserted = false;
+
+
+    for (size_t i = 0; i < SIZE_ARR(vals); i++)
+    {
+        const Node_2_3 *leaf = tree_find_or_insert(_tree, &vals[i], &inserted);
+
+        ck_assert(inserted);
+        ck_assert_ptr_eq(node_get_key(leaf), &vals[i]);
+    }
+
+    for (size_t i = 0; i < SIZE_ARR(vals); i++)
+    {
+        const double key = vals[i];
+        const Node_2_3 *leaf = tree_find_or_insert(_tree, &key, &inserted);
+
+        ck_assert(!inserted);
+        ck_assert_ptr_eq(node_get_key(leaf), &vals[i]);  // stored key, not the passed one
+    }
+
+    ck_assert_int_eq(tree_count_elements(_tree), SIZE_ARR(vals));
+    ck_assert_ptr_null(tree_find_or_insert(_tree, NULL, &inserted));
+}
+END_TEST
+
+
+START_TEST(test_replace_key)
+{
+    const int count_vals = 100;
+    const double missing = 1000;
+    double *vals = malloc(sizeof(double) * count_vals);
+    Tree_2_3 *tree = MAKE_TREE(double);
+
+
+    g_memory_counter = &(struct memory_counter){0};
+
+    for (int i = 0; i < count_vals; i++)
+    {
+        vals[i] = i;
+        ck_assert(tree_insert_key(tree, &vals[i]));
+    }
+
+    /* every key is replaced by a new copy, the old copy is released,
+     * separators of inner nodes must point to new copies */
+    for (int i = 0; i < count_vals; i++)
+    {
+        const double key = vals[i];
+        TreeKey old = node_get_key(tree_search_key(tree, &key));
+
+        ck_assert(tree_replace_key(tree, &key));
+        ck_assert_ptr_ne(node_get_key(tree_search_key(tree, &key)), old);
+    }
+
+    ck_assert(!tree_replace_key(tree, &missing));
+    ck_assert_int_eq(g_memory_counter->alloc, 2 * count_vals);
+    ck_assert_int_eq(g_memory_counter->free, count_vals);
+    ck_assert_int_eq(tree_count_elements(tree), count_vals);
+
+    for (int i = 0; i < count_vals; i++)
+    {
+        ck_assert(tree_remove_key(tree, &vals[i]));
+    }
+
+    tree_destroy(&tree);
+    ck_assert_int_eq(g_memory_counter->free, 2 * count_vals);
+
+    g_memory_counter = NULL;
+    free(vals);
+}
+END_TEST
+
+
 /* ========== REMOVE ======================================================= */
 
 /* using fixtures - setup/teardown callbacks */
@@ -455,138 +852,1541 @@ START_TEST(test_remove_random_element)
 END_TEST
 
 
-/* ========== SEARCH ======================================================= */
-
 /* using fixtures - setup/teardown callbacks */
-START_TEST(test_search_in_empty_tree)
+START_TEST(test_lazy_remove)
 {
-    const double key = 1;
-
-
-    ck_assert_ptr_null(tree_search_key(_tree, &key));
-    ck_assert_ptr_null(tree_get_min(_tree));
-    ck_assert_ptr_null(tree_get_max(_tree));
-}
-END_TEST
-
+    const double vals[] = { 1, 2, 3, 4, 5, 6, 7, 8 };
+    const double between = 4.5;
 
-/* using fixtures - setup/teardown callbacks */
-START_TEST(test_search_missing_key)
-{
-    const double missing = 15.0;
-    const double vals[] = { 10.0, 20.0, 30.0 };
 
+    tree_set_lazy_delete(_tree, true, 1);
 
-    for (size_t i = 0; i < 3; i++)
+    for (size_t i = 0; i < SIZE_ARR(vals); i++)
     {
         ck_assert(tree_insert_key(_tree, &vals[i]));
     }
 
-    ck_assert_ptr_null(tree_search_key(_tree, &missing));
+    int height = tree_height(_tree);
+
+    /* the ends and the middle are marked as dead */
+    ck_assert(tree_remove_key(_tree, &vals[0]));
+    ck_assert(tree_remove_key(_tree, &vals[4]));
+    ck_assert(tree_remove_key(_tree, &vals[7]));
+    ck_assert(!tree_remove_key(_tree, &vals[4]));
+
+    ck_assert_int_eq(tree_height(_tree), height);
+    ck_assert_int_eq(tree_count_elements(_tree), SIZE_ARR(vals) - 3);
+    ck_assert_ptr_null(tree_search_key(_tree, &vals[4]));
+    ck_assert_double_eq(*(const double*)tree_get_min(_tree), 2);
+    ck_assert_double_eq(*(const double*)tree_get_max(_tree), 7);
+    ck_assert_double_eq(*(const double*)node_get_key(tree_ceil(_tree, &between)), 6);
+    ck_assert_double_eq(*(const double*)node_get_key(tree_floor(_tree, &vals[4])), 4);
+
+    /* dead key is inserted again */
+    ck_assert(tree_insert_key(_tree, &vals[4]));
+    ck_assert_ptr_nonnull(tree_search_key(_tree, &vals[4]));
+    ck_assert_int_eq(tree_count_elements(_tree), SIZE_ARR(vals) - 2);
 }
 END_TEST
 
 
-/* using fixtures - setup/teardown callbacks */
-START_TEST(tesr_search_random_key)
+START_TEST(test_lazy_remove_compaction)
 {
-    const double vals[] = { 10.0, 20.0, 30.0, 40.0, 50.0, 60.0, 70.0 };
-    const int len_vals = (int)SIZE_ARR(vals);
-    const int element = rand() % len_vals;
+    const int count_vals = 100;
+    double *vals = malloc(sizeof(double) * count_vals);
+    Tree_2_3 *tree = MAKE_TREE(double);
 
-    log_debug("Search random element: %lf, index: %d", vals[element], element);
-    
 
-    for (int i = 0; i < len_vals; i++)
+    g_memory_counter = &(struct memory_counter){0};
+    tree_set_lazy_delete(tree, true, 0.5);
+
+    for (int i = 0; i < count_vals; i++)
     {
-        ck_assert(tree_insert_key(_tree, &vals[i]));
+        vals[i] = i;
+        ck_assert(tree_insert_key(tree, &vals[i]));
     }
 
-    const Node_2_3 *finded = tree_search_key(_tree, &vals[element]);
-    ck_assert_ptr_nonnull(finded);
-    ck_assert_double_eq(*(double*)node_get_key(finded), vals[element]);
-}
-END_TEST
+    /* keys are kept until the half of leafs is dead */
+    for (int i = 0; i < count_vals / 2; i++)
+    {
+        ck_assert(tree_remove_key(tree, &vals[i]));
+    }
 
+    ck_assert_int_eq(g_memory_counter->free, 0);
 
-/* ========== COPY_FUNC ==================================================== */
+    ck_assert(tree_remove_key(tree, &vals[count_vals / 2]));
+    ck_assert_int_eq(g_memory_counter->free, count_vals / 2 + 1);
 
-/* using fixtures - setup/teardown callbacks */
-START_TEST(test_no_copy_key_dependent_from_source)
-{
-    double query = 10.0;
-    struct _key { double v; };
-    struct _node{ struct _key key; const char* name; } val={.key.v=query, .name="10.0"};
+    /* explicit compaction */
+    ck_assert(tree_remove_key(tree, &vals[count_vals - 1]));
+    ck_assert_int_eq(g_memory_counter->free, count_vals / 2 + 1);
 
+    tree_compact(tree);
+    ck_assert_int_eq(g_memory_counter->free, count_vals / 2 + 2);
+    ck_assert_int_eq(tree_count_elements(tree), count_vals / 2 - 2);
 
-    ck_assert(tree_insert_key(_tree, &val));
-    val.name = "99.0";
+    for (int i = count_vals / 2 + 1; i < count_vals - 1; i++)
+    {
+        ck_assert_ptr_nonnull(tree_search_key(tree, &vals[i]));
+    }
 
-    const Node_2_3 *node = tree_search_key(_tree, &query);
-    ck_assert_ptr_nonnull(node);
+    tree_destroy(&tree);
+    ck_assert_int_eq(g_memory_counter->free, count_vals);
 
-    const char *name = ((struct _node*)node_get_key(node))->name;
-    ck_assert_str_eq(name, "99.0");
+    g_memory_counter = NULL;
+    free(vals);
 }
 END_TEST
 
 
-START_TEST(test_copy_key_independent_from_source)
+START_TEST(test_pop_min_max)
 {
-    double key = 10;
-    double query = 10;
+    const int count_vals = 1000;
 
     Tree_2_3 *tree = MAKE_TREE(double);
-    
-
-    ck_assert(tree_insert_key(tree, &key));
-    key = 99;
+    Tree_2_3 *strings = tree_create_strings();
+    double lo = 0, hi = count_vals - 1;
 
-    const Node_2_3 *node = tree_search_key(tree, &query);
-    ck_assert_ptr_nonnull(node);
-    ck_assert_double_eq(*(const double*)node_get_key(node), query);
 
-    tree_destroy(&tree);
-}
-END_TEST
+    g_memory_counter = &(struct memory_counter){0};
+    ck_assert_ptr_null(tree_pop_min(tree));
 
+    for (int i = 0; i < count_vals; i++)
+    {
+        double val = (i * 7919) % count_vals;
+        ck_assert(tree_insert_key(tree, &val));
+    }
 
-/* ========== HEIGHT ======================================================= */
+    /* every tenth key is removed lazily, dead leafs are skipped */
+    tree_set_lazy_delete(tree, true, 0.9);
+
+    for (int i = 0; i < count_vals; i += 10)
+    {
+        double val = i;
+        ck_assert(tree_remove_key(tree, &val));
+    }
+
+    tree_set_bloom_filter(tree, hash_double, 0);
+    tree_set_lookup_cache(tree, hash_double, 0);
+
+    /* keys are popped in order and belong to the caller */
+    for (int i = 0; i < count_vals / 2; i++)
+    {
+        bool from_min = i % 3 != 0;
+        double *key = (double*)(from_min ? tree_pop_min(tree) : tree_pop_max(tree));
+
+        if (from_min && (int)lo % 10 == 0)  lo++;
+        if (!from_min && (int)hi % 10 == 0) hi--;
+
+        ck_assert_ptr_nonnull(key);
+        ck_assert_double_eq(*key, from_min ? lo++ : hi--);
+        ck_assert_ptr_null(tree_search_key(tree, key));
+
+        free_double(key);
+    }
+
+    /* popped keys and dead leafs in front of them */
+    int dead = 0;
+
+    for (int i = 0; i < count_vals; i += 10)
+        dead += i < lo || i > hi;
+
+    ck_assert_int_eq(g_memory_counter->free, count_vals / 2 + dead);
+    ck_assert_int_eq(tree_count_elements(tree), count_vals - count_vals / 10 - count_vals / 2);
+
+    while (!tree_is_empty(tree))
+        free_double(tree_pop_max(tree));
+
+    ck_assert_ptr_null(tree_pop_max(tree));
+    ck_assert_int_eq(g_memory_counter->free, count_vals);
+
+    /* key of string tree */
+    ck_assert(tree_insert_key(strings, "/queue/b"));
+    ck_assert(tree_insert_key(strings, "/queue/a"));
+
+    TreeKey key = tree_pop_min(strings);
+    char buffer[16];
+
+    tree_string_decode(key, buffer, sizeof(buffer));
+    ck_assert_str_eq(buffer, "/queue/a");
+    tree_string_free(key);
+
+    tree_destroy(&tree);
+    tree_destroy(&strings);
+    g_memory_counter = NULL;
+}
+END_TEST
+
+
+START_TEST(test_remove_node)
+{
+    const int count_vals = 1000;
+    const Node_2_3 **leafs = malloc(sizeof(*leafs) * count_vals);
+    double *vals = malloc(sizeof(double) * count_vals);
+    Tree_2_3 *tree = MAKE_TREE(double);
+
+
+    ck_assert_ptr_nonnull(leafs);
+    ck_assert_ptr_nonnull(vals);
+    g_memory_counter = &(struct memory_counter){0};
+
+    for (int i = 0; i < count_vals; i++)
+    {
+        vals[i] = (i * 7919) % count_vals;
+        leafs[i] = tree_insert_hint(tree, &vals[i], NULL);
+        ck_assert_ptr_nonnull(leafs[i]);
+    }
+
+    tree_set_lookup_cache(tree, hash_double, 0);
+
+    /* handles stay valid while other keys are removed */
+    for (int i = 0; i < count_vals; i += 2)
+    {
+        ck_assert_ptr_eq(tree_search_key(tree, &vals[i]), leafs[i]);
+        ck_assert(tree_remove_node(tree, leafs[i]));
+        ck_assert_ptr_null(tree_search_key(tree, &vals[i]));
+    }
+
+    ck_assert(tree_check_invariants(tree));
+    ck_assert_int_eq(tree_count_elements(tree), count_vals / 2);
+    ck_assert_int_eq(g_memory_counter->free, count_vals / 2);
+
+    /* lazy mode marks the leaf as dead, it can't be removed twice */
+    tree_set_lazy_delete(tree, true, 0.9);
+
+    ck_assert(tree_remove_node(tree, leafs[1]));
+    ck_assert(!tree_remove_node(tree, leafs[1]));
+    ck_assert_ptr_null(tree_search_key(tree, &vals[1]));
+    ck_assert_int_eq(tree_count_elements(tree), count_vals / 2 - 1);
+
+    tree_set_lazy_delete(tree, false, 0);
+
+    for (int i = 3; i < count_vals; i += 2)
+    {
+        ck_assert(tree_remove_node(tree, leafs[i]));
+    }
+
+    ck_assert(tree_is_empty(tree));
+    ck_assert_int_eq(tree_height(tree), 0);
+    ck_assert_int_eq(g_memory_counter->free, count_vals);
+
+    /* not a leaf */
+    ck_assert(tree_insert_key(tree, &vals[0]));
+    ck_assert(tree_insert_key(tree, &vals[1]));
+    ck_assert(!tree_remove_node(tree, tree_get_root(tree)));
+    ck_assert(!tree_remove_node(tree, NULL));
+    ck_assert(!tree_remove_node(NULL, leafs[0]));
+
+    tree_destroy(&tree);
+    g_memory_counter = NULL;
+    free(leafs);
+    free(vals);
+}
+END_TEST
+
+
+/* ========== SEARCH ======================================================= */
+
+/* using fixtures - setup/teardown callbacks */
+START_TEST(test_search_in_empty_tree)
+{
+    const double key = 1;
+
+
+    ck_assert_ptr_null(tree_search_key(_tree, &key));
+    ck_assert_ptr_null(tree_get_min(_tree));
+    ck_assert_ptr_null(tree_get_max(_tree));
+}
+END_TEST
+
+
+/* using fixtures - setup/teardown callbacks */
+START_TEST(test_search_missing_key)
+{
+    const double missing = 15.0;
+    const double vals[] = { 10.0, 20.0, 30.0 };
+
+
+    for (size_t i = 0; i < 3; i++)
+    {
+        ck_assert(tree_insert_key(_tree, &vals[i]));
+    }
+
+    ck_assert_ptr_null(tree_search_key(_tree, &missing));
+}
+END_TEST
+
+
+/* using fixtures - setup/teardown callbacks */
+START_TEST(tesr_search_random_key)
+{
+    const double vals[] = { 10.0, 20.0, 30.0, 40.0, 50.0, 60.0, 70.0 };
+    const int len_vals = (int)SIZE_ARR(vals);
+    const int element = rand() % len_vals;
+
+    log_debug("Search random element: %lf, index: %d", vals[element], element);
+    
+
+    for (int i = 0; i < len_vals; i++)
+    {
+        ck_assert(tree_insert_key(_tree, &vals[i]));
+    }
+
+    const Node_2_3 *finded = tree_search_key(_tree, &vals[element]);
+    ck_assert_ptr_nonnull(finded);
+    ck_assert_double_eq(*(double*)node_get_key(finded), vals[element]);
+}
+END_TEST
+
+
+/* Keys [from, to) are found, halves between them are not */
+static void assert_keys_range(const Tree_2_3 *tree, int from, int to)
+{
+    for (int i = from; i < to; i++)
+    {
+        double key = i;
+        double missing = i + 0.5;
+
+        ck_assert_ptr_nonnull(tree_search_key(tree, &key));
+        ck_assert_ptr_null(tree_search_key(tree, &missing));
+    }
+}
+
+
+START_TEST(test_search_with_bloom_filter)
+{
+    const int count_vals = 5000;
+
+    TreeMemoryStats stats;
+    TreeOpStats op_stats;
+    Tree_2_3 *tree = MAKE_TREE(double);
+    Tree_2_3 *left = NULL, *right = NULL;
+
+
+    for (int i = 0; i < count_vals / 2; i++)
+    {
+        double key = i;
+        ck_assert(tree_insert_key(tree, &key));
+    }
+
+    tree_set_bloom_filter(tree, hash_double, 0);
+    tree_reset_op_stats(tree);
+    assert_keys_range(tree, 0, count_vals / 2);
+
+    /* misses are rejected without descent */
+    if (tree_get_op_stats(tree, &op_stats))
+    {
+        ck_assert_uint_gt(op_stats.filtered, count_vals / 2 * 9 / 10);
+    }
+
+    /* filter grows with tree */
+    for (int i = count_vals / 2; i < count_vals; i++)
+    {
+        double key = i;
+        ck_assert(tree_insert_key(tree, &key));
+    }
+
+    assert_keys_range(tree, 0, count_vals);
+
+    /* removed keys aren't found, though their bits stay until rebuild */
+    for (int i = 0; i < count_vals * 3 / 4; i++)
+    {
+        double key = i;
+        ck_assert(tree_remove_key(tree, &key));
+        ck_assert(!tree_remove_key(tree, &key));
+    }
+
+    assert_keys_range(tree, count_vals * 3 / 4, count_vals);
+
+    /* parts of split get own filters */
+    double middle = count_vals * 7 / 8;
+
+    ck_assert(tree_split(tree, &middle, &left, &right));
+    assert_keys_range(left, count_vals * 3 / 4, count_vals * 7 / 8);
+    assert_keys_range(right, count_vals * 7 / 8, count_vals);
+    ck_assert_ptr_null(tree_search_key(left, &middle));
+
+    ck_assert(tree_join(left, &right));
+    assert_keys_range(left, count_vals * 3 / 4, count_vals);
+
+    tree_memory_stats(left, &stats);
+    ck_assert_uint_gt(stats.filter_bytes, 0);
+
+    tree_set_bloom_filter(left, NULL, 0);
+    tree_memory_stats(left, &stats);
+    ck_assert_uint_eq(stats.filter_bytes, 0);
+    assert_keys_range(left, count_vals * 3 / 4, count_vals);
+
+    tree_destroy(&tree);
+    tree_destroy(&left);
+}
+END_TEST
+
+
+START_TEST(test_search_batch)
+{
+    enum { count_vals = 1000, count_keys = 2 * count_vals + 2 };
+
+    Tree_2_3 *tree = MAKE_TREE(double);
+    double keys[count_keys];
+    TreeKey ptrs[count_keys];
+    const Node_2_3 *found[count_keys];
+
+
+    ck_assert_uint_eq(tree_search_batch(tree, NULL, 0, NULL), 0);
+
+    /* keys are 0 .. count_vals - 1, halves between them and ends are missing */
+    for (int i = 0; i < count_keys; i++)
+    {
+        keys[i] = (i - 1) / 2.0;
+        ptrs[i] = &keys[i];
+    }
+
+    ck_assert_uint_eq(tree_search_batch(tree, ptrs, count_keys, found), 0);
+
+    for (int i = 0; i < count_vals; i++)
+    {
+        double key = i;
+        ck_assert(tree_insert_key(tree, &key));
+    }
+
+    /* lookups of one batch go to different groups and leafs, some are lazily removed */
+    tree_set_lazy_delete(tree, true, 1);
+
+    for (int i = 0; i < count_vals; i += 7)
+    {
+        double key = i;
+        ck_assert(tree_remove_key(tree, &key));
+    }
+
+    tree_set_bloom_filter(tree, hash_double, 0);
+
+    size_t count_found = tree_search_batch(tree, ptrs, count_keys, found);
+
+    ck_assert_uint_eq(count_found, tree_count_elements(tree));
+
+    for (int i = 0; i < count_keys; i++)
+    {
+        ck_assert_ptr_eq(found[i], tree_search_key(tree, ptrs[i]));
+    }
+
+    tree_destroy(&tree);
+}
+END_TEST
+
+
+START_TEST(test_search_with_lookup_cache)
+{
+    const int count_vals = 1000;
+    const int count_hot = 8;
+    const int rounds = 100;
+
+    TreeCacheStats stats;
+    Tree_2_3 *tree = MAKE_TREE(double);
+    Tree_2_3 *left = NULL, *right = NULL;
+    double key = 5;
+
+
+    for (int i = 0; i < count_vals; i++)
+    {
+        double val = i;
+        ck_assert(tree_insert_key(tree, &val));
+    }
+
+    ck_assert(!tree_get_cache_stats(tree, &stats));
+    tree_set_lookup_cache(tree, hash_double, 64);
+
+    ck_assert_ptr_nonnull(tree_search_key(tree, &key));
+    ck_assert_ptr_nonnull(tree_search_key(tree, &key));
+    ck_assert(tree_get_cache_stats(tree, &stats));
+    ck_assert_uint_eq(stats.hits, 1);
+    ck_assert_uint_eq(stats.misses, 1);
+    ck_assert_uint_eq(stats.entries, 64);
+
+    /* removed key isn't returned from cache */
+    ck_assert(tree_remove_key(tree, &key));
+    ck_assert_ptr_null(tree_search_key(tree, &key));
+    ck_assert(tree_insert_key(tree, &key));
+    ck_assert_double_eq(*(const double*)node_get_key(tree_search_key(tree, &key)), key);
+
+    for (int r = 0; r < rounds; r++)
+    for (int i = 0; i < count_hot; i++)
+    {
+        double hot = i * 100;
+        ck_assert_double_eq(*(const double*)node_get_key(tree_search_key(tree, &hot)), hot);
+    }
+
+    tree_get_cache_stats(tree, &stats);
+    ck_assert_uint_ge(stats.hits, 1 + count_hot * (rounds - 1));
+
+    /* the same in lazy mode, where the leaf is only marked */
+    tree_set_lazy_delete(tree, true, 0.5);
+    ck_assert(tree_remove_key(tree, &key));
+    ck_assert_ptr_null(tree_search_key(tree, &key));
+
+    /* parts of split get own empty caches */
+    key = count_vals / 2;
+    ck_assert(tree_split(tree, &key, &left, &right));
+    ck_assert_ptr_null(tree_search_key(tree, &key));
+    ck_assert_ptr_nonnull(tree_search_key(right, &key));
+    ck_assert(tree_get_cache_stats(left, &stats));
+    ck_assert_uint_eq(stats.hits + stats.misses, 0);
+
+    tree_make_empty(right);
+    ck_assert_ptr_null(tree_search_key(right, &key));
+
+    tree_set_lookup_cache(left, NULL, 0);
+    ck_assert(!tree_get_cache_stats(left, &stats));
+
+    tree_destroy(&tree);
+    tree_destroy(&left);
+    tree_destroy(&right);
+}
+END_TEST
+
+
+/* using fixtures - setup/teardown callbacks */
+START_TEST(test_neighbors_of_keys)
+{
+    const double vals[] = { 10, 20, 30, 40, 50, 60, 70, 80, 90, 100 };
+    const double inside = 45, low = 5, high = 105;
+
+
+    for (size_t i = 0; i < SIZE_ARR(vals); i++)
+    {
+        ck_assert(tree_insert_key(_tree, &vals[i]));
+    }
+
+    /* key between two keys of tree */
+    ck_assert_double_eq(*(const double*)node_get_key(tree_lower_bound(_tree, &inside)), 50);
+    ck_assert_double_eq(*(const double*)node_get_key(tree_upper_bound(_tree, &inside)), 50);
+    ck_assert_double_eq(*(const double*)node_get_key(tree_floor(_tree, &inside)), 40);
+    ck_assert_double_eq(*(const double*)node_get_key(tree_predecessor(_tree, &inside)), 40);
+
+    /* keys of tree */
+    for (size_t i = 0; i < SIZE_ARR(vals); i++)
+    {
+        ck_assert_ptr_eq(node_get_key(tree_ceil(_tree, &vals[i])), &vals[i]);
+        ck_assert_ptr_eq(node_get_key(tree_floor(_tree, &vals[i])), &vals[i]);
+
+        if (i + 1 < SIZE_ARR(vals))
+            ck_assert_ptr_eq(node_get_key(tree_successor(_tree, &vals[i])), &vals[i + 1]);
+        else
+            ck_assert_ptr_null(tree_successor(_tree, &vals[i]));
+
+        if (i > 0)
+            ck_assert_ptr_eq(node_get_key(tree_predecessor(_tree, &vals[i])), &vals[i - 1]);
+        else
+            ck_assert_ptr_null(tree_predecessor(_tree, &vals[i]));
+    }
+
+    /* keys out of range */
+    ck_assert_ptr_eq(node_get_key(tree_lower_bound(_tree, &low)), &vals[0]);
+    ck_assert_ptr_null(tree_floor(_tree, &low));
+    ck_assert_ptr_null(tree_upper_bound(_tree, &high));
+    ck_assert_ptr_eq(node_get_key(tree_floor(_tree, &high)), &vals[SIZE_ARR(vals) - 1]);
+
+    /* step from leaf to leaf without search */
+    const Node_2_3 *node = tree_lower_bound(_tree, &low);
+
+    for (size_t i = 0; i < SIZE_ARR(vals); i++)
+    {
+        ck_assert_ptr_eq(node_get_key(node), &vals[i]);
+        node = tree_next_node(_tree, node);
+    }
+
+    ck_assert_ptr_null(node);
+    node = tree_floor(_tree, &high);
+
+    for (size_t i = SIZE_ARR(vals); i > 0; i--)
+    {
+        ck_assert_ptr_eq(node_get_key(node), &vals[i - 1]);
+        node = tree_prev_node(_tree, node);
+    }
+
+    ck_assert_ptr_null(node);
+    ck_assert_ptr_null(tree_next_node(_tree, tree_get_root(_tree)));
+}
+END_TEST
+
+
+/* using fixtures - setup/teardown callbacks */
+START_TEST(test_neighbors_in_empty_tree)
+{
+    const double key = 1;
+
+
+    ck_assert_ptr_null(tree_lower_bound(_tree, &key));
+    ck_assert_ptr_null(tree_upper_bound(_tree, &key));
+    ck_assert_ptr_null(tree_floor(_tree, &key));
+    ck_assert_ptr_null(tree_ceil(_tree, &key));
+    ck_assert_ptr_null(tree_successor(_tree, &key));
+    ck_assert_ptr_null(tree_predecessor(_tree, &key));
+    ck_assert_ptr_null(tree_lower_bound(_tree, NULL));
+}
+END_TEST
+
+
+/* ========== COPY_FUNC ==================================================== */
+
+/* using fixtures - setup/teardown callbacks */
+START_TEST(test_no_copy_key_dependent_from_source)
+{
+    double query = 10.0;
+    struct _key { double v; };
+    struct _node{ struct _key key; const char* name; } val={.key.v=query, .name="10.0"};
+
+
+    ck_assert(tree_insert_key(_tree, &val));
+    val.name = "99.0";
+
+    const Node_2_3 *node = tree_search_key(_tree, &query);
+    ck_assert_ptr_nonnull(node);
+
+    const char *name = ((struct _node*)node_get_key(node))->name;
+    ck_assert_str_eq(name, "99.0");
+}
+END_TEST
+
+
+START_TEST(test_copy_key_independent_from_source)
+{
+    double key = 10;
+    double query = 10;
+
+    Tree_2_3 *tree = MAKE_TREE(double);
+    
+
+    ck_assert(tree_insert_key(tree, &key));
+    key = 99;
+
+    const Node_2_3 *node = tree_search_key(tree, &query);
+    ck_assert_ptr_nonnull(node);
+    ck_assert_double_eq(*(const double*)node_get_key(node), query);
+
+    tree_destroy(&tree);
+}
+END_TEST
+
+
+/* ========== HEIGHT ======================================================= */
 
 START_TEST(test_height_within_theoretical_bounds)
 {
-    const int count_vals = 10000;
-    int count_cickle = 0;
+    const int count_vals = 10000;
+    int count_cickle = 0;
+
+    Tree_2_3 *tree = MAKE_TREE(double);
+    
+
+    while (tree_count_elements(tree) < count_vals)
+    {
+        double key = drand48(); //(double)rand();
+
+        if (!tree_insert_key(tree, &key))
+        {
+            log_debug("key: %.12lf, count_cickle: %d", key,  count_cickle);
+        }
+
+        count_cickle++;
+
+        ck_assert_msg(
+            count_cickle < count_vals * 2, 
+            "The limit of iterations for filling the tree has been exceeded"
+        );
+    }
+
+    int height = tree_height(tree);
+    double height_max = log2(count_vals) + 1;
+    double height_min = log(count_vals) / log(3.0) + 1;
+
+    log_debug("[height] min: %.2lf, max: %.2lf, nominal: %d", height_min, height_max, height);
+    ck_assert_double_ge(height, height_min); // 
+    ck_assert_double_le(height, height_max);
+    ck_assert(tree_check_invariants(tree));
+
+    tree_destroy(&tree);
+}
+END_TEST
+
+
+START_TEST(test_invariants_after_mutations)
+{
+    const int count_vals = 2000;
+    double *vals = malloc(sizeof(double) * count_vals);
+    Tree_2_3 *tree = MAKE_TREE(double);
+    Tree_2_3 *left = NULL, *right = NULL;
+
+
+    ck_assert_ptr_nonnull(vals);
+    ck_assert(tree_check_invariants(tree));
+
+    for (int i = 0; i < count_vals; i++)
+    {
+        vals[i] = (i * 7919) % count_vals;
+        ck_assert(tree_insert_key(tree, &vals[i]));
+    }
+
+    ck_assert(tree_check_invariants(tree));
+
+    /* height follows the root while the tree shrinks */
+    for (int i = 0; i < count_vals; i += 2)
+    {
+        ck_assert(tree_remove_key(tree, &vals[i]));
+    }
+
+    ck_assert(tree_check_invariants(tree));
+
+    for (int i = 0; i < 100; i++)
+    {
+        TreeKey min = tree_pop_min(tree);
+        TreeKey max = tree_pop_max(tree);
+
+        free((void*)min);
+        free((void*)max);
+    }
+
+    ck_assert(tree_check_invariants(tree));
+
+    /* dead leafs are counted apart from alive ones */
+    tree_set_lazy_delete(tree, true, 0.9);
+
+    for (int i = 1; i < count_vals; i += 6)
+    {
+        tree_remove_key(tree, &vals[i]);
+    }
+
+    ck_assert(tree_check_invariants(tree));
+
+    ck_assert(tree_split(tree, &vals[count_vals / 3], &left, &right));
+    ck_assert(tree_check_invariants(tree));
+    ck_assert(tree_check_invariants(left));
+    ck_assert(tree_check_invariants(right));
+
+    ck_assert(tree_join(left, &right));
+    ck_assert(tree_check_invariants(left));
+
+    tree_make_empty(left);
+    ck_assert(tree_check_invariants(left));
+    ck_assert_int_eq(tree_height(left), 0);
+
+    ck_assert(!tree_check_invariants(NULL));
+
+    tree_destroy(&tree);
+    tree_destroy(&left);
+    free(vals);
+}
+END_TEST
+
+
+/* ========== MEMORY ======================================================= */
+
+static size_t size_double(TreeKey key)
+{
+    (void)key;
+
+    return sizeof(double);
+}
+
+
+START_TEST(test_memory_stats)
+{
+    const int count_vals = 1000;
+    TreeMemoryStats stats;
+
+    Tree_2_3 *tree = MAKE_TREE(double);
+
+
+    tree_memory_stats(tree, &stats);
+    ck_assert_int_eq(stats.leafs, 0);
+    ck_assert_int_eq(stats.inner_2 + stats.inner_3, 0);
+    ck_assert_int_eq(stats.key_bytes, 0);
+    ck_assert_int_eq(stats.height, 0);
+
+    for (int i = 0; i < count_vals / 2; i++)
+    {
+        double key = i;
+        ck_assert(tree_insert_key(tree, &key));
+    }
+
+    /* keys already in tree are counted on setting of size function */
+    tree_set_size_func(tree, size_double);
+
+    for (int i = count_vals / 2; i < count_vals; i++)
+    {
+        double key = i;
+        ck_assert(tree_insert_key(tree, &key));
+    }
+
+    tree_memory_stats(tree, &stats);
+    ck_assert_int_eq(stats.leafs, count_vals);
+    ck_assert_int_eq(stats.dead, 0);
+    ck_assert_int_eq(stats.key_bytes, count_vals * sizeof(double));
+    ck_assert_int_eq(stats.height, tree_height(tree));
+
+    /* every inner node except root has 2 or 3 children */
+    ck_assert_int_eq(2 * stats.inner_2 + 3 * stats.inner_3, stats.leafs + stats.inner_2 + stats.inner_3 - 1);
+    ck_assert_double_ge(stats.fill_factor, 2.0 / 3);
+    ck_assert_double_le(stats.fill_factor, 1.0);
+    ck_assert_int_gt(stats.node_bytes, 0);
+
+    for (int i = 0; i < count_vals; i += 2)
+    {
+        double key = i;
+        ck_assert(tree_remove_key(tree, &key));
+    }
+
+    tree_memory_stats(tree, &stats);
+    ck_assert_int_eq(stats.leafs, count_vals / 2);
+    ck_assert_int_eq(stats.key_bytes, count_vals / 2 * sizeof(double));
+
+    /* parts of split tree keep their own counters */
+    Tree_2_3 *left = NULL, *right = NULL;
+    double middle = count_vals / 2;
+    TreeMemoryStats stats_left, stats_right;
+
+    ck_assert(tree_split(tree, &middle, &left, &right));
+    tree_memory_stats(left, &stats_left);
+    tree_memory_stats(right, &stats_right);
+    ck_assert_int_eq(stats_left.leafs + stats_right.leafs, count_vals / 2);
+    ck_assert_int_eq(stats_left.key_bytes + stats_right.key_bytes, count_vals / 2 * sizeof(double));
+
+    ck_assert(tree_join(left, &right));
+    tree_memory_stats(left, &stats_left);
+    ck_assert_int_eq(stats_left.leafs, count_vals / 2);
+    ck_assert_int_eq(stats_left.key_bytes, count_vals / 2 * sizeof(double));
+
+    tree_destroy(&left);
+    tree_destroy(&tree);
+}
+END_TEST
+
+
+/* ========== OPERATION STATS ============================================== */
+
+START_TEST(test_op_stats)
+{
+    const int count_vals = 100;
+    TreeOpStats ops;
+    TreeMemoryStats stats;
+
+    Tree_2_3 *tree = MAKE_TREE(double);
+
+
+    /* without TREE_OP_STATS there is nothing to count */
+    if (!tree_get_op_stats(tree, &ops))
+    {
+        ck_assert_int_eq(ops.compares + ops.searches + ops.inserts + ops.allocations, 0);
+        tree_destroy(&tree);
+        return;
+    }
+
+    for (int i = count_vals - 1; i >= 0; i--)
+    {
+        double key = i;
+        ck_assert(tree_insert_key(tree, &key));
+    }
+
+    /* nothing is released by inserts */
+    tree_get_op_stats(tree, &ops);
+    tree_memory_stats(tree, &stats);
+    ck_assert_int_eq(ops.inserts, count_vals);
+    ck_assert_int_eq(ops.allocations, stats.leafs + stats.inner_2 + stats.inner_3);
+    ck_assert_int_gt(ops.splits, 0);
+    ck_assert_int_gt(ops.insert_visits, 0);
+
+    tree_reset_op_stats(tree);
+    tree_get_op_stats(tree, &ops);
+    ck_assert_int_eq(ops.compares + ops.inserts + ops.allocations, 0);
+
+    /* one node per level, one or two compares in inner node and one in leaf */
+    int height = tree_height(tree);
+
+    for (int i = 0; i < count_vals; i++)
+    {
+        double key = i;
+        ck_assert_ptr_nonnull(tree_search_key(tree, &key));
+    }
+
+    tree_get_op_stats(tree, &ops);
+    ck_assert_int_eq(ops.searches, count_vals);
+    ck_assert_int_eq(ops.search_visits, count_vals * height);
+    ck_assert_int_ge(ops.compares, count_vals * height);
+    ck_assert_int_le(ops.compares, count_vals * (2 * height - 1));
+
+    tree_reset_op_stats(tree);
+
+    for (int i = 0; i < count_vals; i++)
+    {
+        double key = i;
+        ck_assert(tree_remove_key(tree, &key));
+    }
+
+    tree_get_op_stats(tree, &ops);
+    ck_assert_int_eq(ops.removes, count_vals);
+    ck_assert_int_gt(ops.merges, 0);
+    ck_assert_int_eq(ops.inserts, 0);
+
+    tree_destroy(&tree);
+}
+END_TEST
+
+
+/* ========== SPLIT / JOIN ================================================= */
+
+START_TEST(test_split_by_middle_key)
+{
+    const double vals[] = { 10, 20, 30, 40, 50, 60, 70, 80, 90 };
+    const int len_vals = (int)SIZE_ARR(vals);
+    const double key = 45;
+
+    Tree_2_3 *tree = MAKE_TREE(double);
+    Tree_2_3 *left = NULL, *right = NULL;
+    TreeMemoryStats stats, stats_left, stats_right;
+    g_memory_counter = &(struct memory_counter){0};
+
+
+    tree_set_size_func(tree, size_double);
+
+    for (int i = 0; i < len_vals; i++)
+    {
+        ck_assert(tree_insert_key(tree, &vals[i]));
+    }
+
+    ck_assert(tree_split(tree, &key, &left, &right));
+
+    ck_assert(tree_is_empty(tree));
+
+    /* memory of keys moves with them */
+    tree_memory_stats(tree, &stats);
+    tree_memory_stats(left, &stats_left);
+    tree_memory_stats(right, &stats_right);
+    ck_assert_int_eq(stats.key_bytes, 0);
+    ck_assert_int_eq(stats_left.key_bytes, 4 * sizeof(double));
+    ck_assert_int_eq(stats_right.key_bytes, 5 * sizeof(double));
+    ck_assert_int_eq(tree_count_elements(left), 4);
+    ck_assert_int_eq(tree_count_elements(right), 5);
+    ck_assert_double_eq(*(const double *)tree_get_max(left), 40);
+    ck_assert_double_eq(*(const double *)tree_get_min(right), 50);
+
+    for (int i = 0; i < len_vals; i++)
+    {
+        Tree_2_3 *owner = (vals[i] < key) ? left : right;
+        Tree_2_3 *other = (vals[i] < key) ? right : left;
+
+        ck_assert_ptr_nonnull(tree_search_key(owner, &vals[i]));
+        ck_assert_ptr_null(tree_search_key(other, &vals[i]));
+    }
+
+    /* keys were moved, not copied */
+    ck_assert_int_eq(g_memory_counter->alloc, len_vals);
+    ck_assert_int_eq(g_memory_counter->free, 0);
+
+    tree_destroy(&left);
+    tree_destroy(&right);
+    tree_destroy(&tree);
+    ck_assert_int_eq(g_memory_counter->free, len_vals);
+
+    g_memory_counter = NULL;
+}
+END_TEST
+
+
+START_TEST(test_split_out_of_range_key)
+{
+    const double vals[] = { 1, 2, 3, 4, 5 };
+    const int len_vals = (int)SIZE_ARR(vals);
+    const double smaller = 0, bigger = 100;
+
+    Tree_2_3 *left = NULL, *right = NULL;
+
+
+    for (int i = 0; i < len_vals; i++)
+    {
+        ck_assert(tree_insert_key(_tree, &vals[i]));
+    }
+
+    ck_assert(tree_split(_tree, &smaller, &left, &right));
+    ck_assert(tree_is_empty(left));
+    ck_assert_int_eq(tree_count_elements(right), len_vals);
+    tree_destroy(&left);
+
+    Tree_2_3 *source = right;
+
+    ck_assert(tree_split(source, &bigger, &left, &right));
+    ck_assert(tree_is_empty(right));
+    ck_assert_int_eq(tree_count_elements(left), len_vals);
+
+    tree_destroy(&source);
+    tree_destroy(&right);
+    tree_destroy(&left);
+}
+END_TEST
+
+
+START_TEST(test_join_trees)
+{
+    const int count_vals = 1000;
+    double *vals = malloc(sizeof(double) * count_vals);
+    Tree_2_3 *left = NULL, *right = NULL;
+
+
+    for (int i = 0; i < count_vals; i++)
+    {
+        vals[i] = i;
+        ck_assert(tree_insert_key(_tree, &vals[i]));
+    }
+
+    double key = rand() % count_vals;
+
+    ck_assert(tree_split(_tree, &key, &left, &right));
+    ck_assert(!tree_join(right, &left));  // keys of left are smaller
+    ck_assert(tree_join(left, &right));
+    ck_assert_ptr_null(right);
+
+    ck_assert_int_eq(tree_count_elements(left), count_vals);
+    ck_assert_double_eq(*(const double *)tree_get_min(left), 0);
+    ck_assert_double_eq(*(const double *)tree_get_max(left), count_vals - 1);
+
+    for (int i = 0; i < count_vals; i++)
+    {
+        ck_assert_ptr_nonnull(tree_search_key(left, &vals[i]));
+    }
+
+    int height = tree_height(left);
+    ck_assert_double_ge(height, log(count_vals) / log(3.0) + 1);
+    ck_assert_double_le(height, log2(count_vals) + 1);
+
+    ck_assert(tree_check_invariants(left));
+
+    tree_destroy(&left);
+    free(vals);
+}
+END_TEST
+
+
+/* ========== SET OPERATIONS =============================================== */
+
+static Tree_2_3 *_tree_other;  /* second object for set operations */
+
+static void setup_sets(void)
+{
+    log_trace("%s", __func__);
+
+    const double vals_a[] = { 1, 2, 3, 4, 5, 6 };
+    const double vals_b[] = { 4, 5, 6, 7, 8 };
+
+    _tree = MAKE_TREE(double);
+    _tree_other = MAKE_TREE(double);
+
+    for (size_t i = 0; i < SIZE_ARR(vals_a); i++)
+        ck_assert(tree_insert_key(_tree, &vals_a[i]));
+
+    for (size_t i = 0; i < SIZE_ARR(vals_b); i++)
+        ck_assert(tree_insert_key(_tree_other, &vals_b[i]));
+}
+
+
+static void teardown_sets(void)
+{
+    log_trace("%s", __func__);
+
+    tree_destroy(&_tree);
+    tree_destroy(&_tree_other);
+}
+
+
+/* check that tree contains exactly keys from <vals> */
+static void assert_tree_keys(const Tree_2_3 *tree, const double *vals, int len_vals)
+{
+    ck_assert_int_eq(tree_count_elements(tree), len_vals);
+
+    for (int i = 0; i < len_vals; i++)
+    {
+        ck_assert_ptr_nonnull(tree_search_key(tree, &vals[i]));
+    }
+}
+
+
+/* using fixtures - setup_sets/teardown_sets callbacks */
+START_TEST(test_union_of_trees)
+{
+    const double expected[] = { 1, 2, 3, 4, 5, 6, 7, 8 };
+    Tree_2_3 *result = tree_union(_tree, _tree_other);
+
+
+    ck_assert_ptr_nonnull(result);
+    assert_tree_keys(result, expected, SIZE_ARR(expected));
+
+    /* sources are not changed */
+    ck_assert_int_eq(tree_count_elements(_tree), 6);
+    ck_assert_int_eq(tree_count_elements(_tree_other), 5);
+
+    tree_destroy(&result);
+}
+END_TEST
+
+
+/* using fixtures - setup_sets/teardown_sets callbacks */
+START_TEST(test_intersection_of_trees)
+{
+    const double expected[] = { 4, 5, 6 };
+    const double missing = 3;
+    Tree_2_3 *result = tree_intersection(_tree, _tree_other);
+
+
+    ck_assert_ptr_nonnull(result);
+    assert_tree_keys(result, expected, SIZE_ARR(expected));
+    ck_assert_ptr_null(tree_search_key(result, &missing));
+
+    tree_destroy(&result);
+}
+END_TEST
+
+
+/* using fixtures - setup_sets/teardown_sets callbacks */
+START_TEST(test_difference_of_trees)
+{
+    const double expected[] = { 1, 2, 3 };
+    const double missing = 4;
+    Tree_2_3 *result = tree_difference(_tree, _tree_other);
+
+
+    ck_assert_ptr_nonnull(result);
+    assert_tree_keys(result, expected, SIZE_ARR(expected));
+    ck_assert_ptr_null(tree_search_key(result, &missing));
+
+    tree_destroy(&result);
+}
+END_TEST
+
+
+START_TEST(test_set_operations_small_and_big_tree)
+{
+    const int count_vals = 5000;
+    const double small_vals[] = { -1, 0, 777, 2500.5, 4999, 6000 };
+    const int len_small = (int)SIZE_ARR(small_vals);
+
+    Tree_2_3 *big = MAKE_TREE(double);
+    Tree_2_3 *small = MAKE_TREE(double);
+    g_memory_counter = &(struct memory_counter){0};
+
+
+    for (int i = 0; i < count_vals; i++)
+    {
+        double key = i;
+        ck_assert(tree_insert_key(big, &key));
+    }
+
+    for (int i = 0; i < len_small; i++)
+        ck_assert(tree_insert_key(small, &small_vals[i]));
+
+    Tree_2_3 *both = tree_intersection(small, big);
+    Tree_2_3 *all = tree_union(big, small);
+    Tree_2_3 *rest = tree_difference(small, big);
+
+    const double expected_both[] = { 0, 777, 4999 };
+    const double expected_rest[] = { -1, 2500.5, 6000 };
+
+    assert_tree_keys(both, expected_both, SIZE_ARR(expected_both));
+    assert_tree_keys(rest, expected_rest, SIZE_ARR(expected_rest));
+    ck_assert_int_eq(tree_count_elements(all), count_vals + 3);
+
+    for (int i = 0; i < len_small; i++)
+        ck_assert_ptr_nonnull(tree_search_key(all, &small_vals[i]));
+
+    tree_destroy(&both);
+    tree_destroy(&all);
+    tree_destroy(&rest);
+    tree_destroy(&small);
+    tree_destroy(&big);
+
+    ck_assert_int_eq(g_memory_counter->free, g_memory_counter->alloc);
+
+    g_memory_counter = NULL;
+}
+END_TEST
+
+
+/* ========== FREEZE / THAW ================================================ */
+
+/* check that keys come in ascending order */
+static bool visit_ascending(TreeKey key, void *context)
+{
+    double *last = context;
+
+    ck_assert_double_gt(*(const double*)key, *last);
+    *last = *(const double*)key;
+
+    return true;
+}
+
+
+START_TEST(test_freeze_and_thaw)
+{
+    const int count_vals = 1000;
+
+    Tree_2_3 *tree = MAKE_TREE(double);
+    g_memory_counter = &(struct memory_counter){0};
+
+
+    for (int i = 0; i < count_vals; i++)
+    {
+        double key = i * 2;
+        ck_assert(tree_insert_key(tree, &key));
+    }
+
+    /* keys are moved, not copied */
+    unsigned allocated = g_memory_counter->alloc;
+    TreeFrozen *frozen = tree_freeze(&tree);
+
+    ck_assert_ptr_nonnull(frozen);
+    ck_assert_ptr_null(tree);
+    ck_assert_int_eq(tree_frozen_count_elements(frozen), count_vals);
+    ck_assert_double_eq(*(const double*)tree_frozen_get_min(frozen), 0);
+    ck_assert_double_eq(*(const double*)tree_frozen_get_max(frozen), (count_vals - 1) * 2);
+
+    for (int i = 0; i < count_vals; i++)
+    {
+        double key = i * 2;
+        double missing = key + 1;
+        double below = key - 0.5;
+
+        ck_assert_double_eq(*(const double*)tree_frozen_search_key(frozen, &key), key);
+        ck_assert_ptr_null(tree_frozen_search_key(frozen, &missing));
+        ck_assert_double_eq(*(const double*)tree_frozen_lower_bound(frozen, &below), key);
+    }
+
+    double after_max = count_vals * 2;
+    double last = -1;
+
+    ck_assert_ptr_null(tree_frozen_lower_bound(frozen, &after_max));
+    tree_frozen_foreach(frozen, visit_ascending, &last);
+    ck_assert_double_eq(last, (count_vals - 1) * 2);
+
+    tree = tree_thaw(&frozen);
+
+    ck_assert_ptr_nonnull(tree);
+    ck_assert_ptr_null(frozen);
+    ck_assert_int_eq(g_memory_counter->alloc, allocated);
+    ck_assert_int_eq(tree_count_elements(tree), count_vals);
+
+    /* thawed tree is mutable again and copies new keys */
+    ck_assert(tree_insert_key(tree, &after_max));
+    ck_assert(tree_remove_key(tree, &last));
+    ck_assert_int_eq(tree_count_elements(tree), count_vals);
+
+    tree_destroy(&tree);
+    ck_assert_int_eq(g_memory_counter->free, g_memory_counter->alloc);
+
+    g_memory_counter = NULL;
+}
+END_TEST
+
+
+START_TEST(test_freeze_empty_tree)
+{
+    const double key = 1;
+
+    Tree_2_3 *tree = MAKE_TREE(double);
+
+
+    ck_assert_ptr_null(tree_freeze(NULL));
+
+    TreeFrozen *frozen = tree_freeze(&tree);
+
+    ck_assert_ptr_nonnull(frozen);
+    ck_assert_int_eq(tree_frozen_count_elements(frozen), 0);
+    ck_assert_ptr_null(tree_frozen_search_key(frozen, &key));
+    ck_assert_ptr_null(tree_frozen_lower_bound(frozen, &key));
+    ck_assert_ptr_null(tree_frozen_get_min(frozen));
+    ck_assert_ptr_null(tree_frozen_get_max(frozen));
+
+    tree_frozen_destroy(&frozen);
+    ck_assert_ptr_null(frozen);
+}
+END_TEST
+
+
+/* ========== AGGREGATE ==================================================== */
+
+static double value_double(TreeKey key)
+{
+    return *(const double*)key;
+}
+
+
+START_TEST(test_thaw_keeps_settings)
+{
+    const int count_vals = 100;
+    const double lo = 10, hi = 19, missing = -1;
+    double sum = 0;
+    TreeMemoryStats stats;
+    TreeCacheStats cache;
 
     Tree_2_3 *tree = MAKE_TREE(double);
-    
 
-    while (tree_count_elements(tree) < count_vals)
+
+    for (int i = 0; i < count_vals; i++)
     {
-        double key = drand48(); //(double)rand();
+        double key = i;
+        ck_assert(tree_insert_key(tree, &key));
+    }
 
-        if (!tree_insert_key(tree, &key))
-        {
-            log_debug("key: %.12lf, count_cickle: %d", key,  count_cickle);
-        }
+    tree_set_aggregate(tree, value_double, tree_aggregate_sum, 0);
+    tree_set_bloom_filter(tree, hash_double, 0);
+    tree_set_lookup_cache(tree, hash_double, 64);
 
-        count_cickle++;
+    TreeFrozen *frozen = tree_freeze(&tree);
+    tree = tree_thaw(&frozen);
 
-        ck_assert_msg(
-            count_cickle < count_vals * 2, 
-            "The limit of iterations for filling the tree has been exceeded"
-        );
+    /* thawed tree answers as the original one */
+    ck_assert_ptr_nonnull(tree);
+    ck_assert(tree_range_aggregate(tree, &lo, &hi, &sum));
+    ck_assert_double_eq(sum, 145);
+
+    tree_memory_stats(tree, &stats);
+    ck_assert_uint_gt(stats.filter_bytes, 0);
+    ck_assert_uint_gt(stats.cache_bytes, 0);
+
+    ck_assert_ptr_null(tree_search_key(tree, &missing));
+    ck_assert_ptr_nonnull(tree_search_key(tree, &lo));
+    ck_assert_ptr_nonnull(tree_search_key(tree, &lo));
+    ck_assert(tree_get_cache_stats(tree, &cache));
+    ck_assert_uint_eq(cache.hits, 1);
+    ck_assert_uint_eq(cache.entries, 64);
+
+    tree_destroy(&tree);
+}
+END_TEST
+
+
+/* Associative, but not commutative: value of the last key */
+static double combine_last(double a, double b)
+{
+    return isnan(b) ? a : b;
+}
+
+
+/* Check aggregates of tree with keys 0..count-1 (alive if alive[i]) over random ranges */
+static void assert_range_aggregates(const Tree_2_3 *tree, const bool *alive, int count)
+{
+    for (int r = 0; r < 200; r++)
+    {
+        double lo = rand() % (count + 2) - 1;
+        double hi = rand() % (count + 2) - 1;
+        double sum = 0, result;
+
+        for (int i = 0; i < count; i++)
+            sum += (alive[i] && i >= lo && i <= hi) ? i : 0;
+
+        ck_assert(tree_range_aggregate(tree, &lo, &hi, &result));
+        ck_assert_double_eq(result, sum);
     }
+}
 
-    int height = tree_height(tree);
-    double height_max = log2(count_vals) + 1;
-    double height_min = log(count_vals) / log(3.0) + 1;
 
-    log_debug("[height] min: %.2lf, max: %.2lf, nominal: %d", height_min, height_max, height);
-    ck_assert_double_ge(height, height_min); // 
-    ck_assert_double_le(height, height_max);
+START_TEST(test_range_aggregate)
+{
+    const int count_vals = 500;
+
+    Tree_2_3 *tree = MAKE_TREE(double);
+    bool *alive = calloc(count_vals, sizeof(bool));
+    double lo = 10, hi = 20, result;
+
+
+    ck_assert(!tree_range_aggregate(tree, NULL, NULL, &result));
+    tree_set_aggregate(tree, value_double, tree_aggregate_sum, 0);
+
+    ck_assert(tree_range_aggregate(tree, NULL, NULL, &result));
+    ck_assert_double_eq(result, 0);
+
+    for (int i = 0; i < count_vals; i++)
+    {
+        double val = (i * 7919) % count_vals;
+        ck_assert(tree_insert_key(tree, &val));
+        alive[(int)val] = true;
+    }
+
+    assert_range_aggregates(tree, alive, count_vals);
+
+    ck_assert(tree_range_aggregate(tree, NULL, &hi, &result));
+    ck_assert_double_eq(result, 210);
+    ck_assert(tree_range_aggregate(tree, &hi, &lo, &result));  // empty range
+    ck_assert_double_eq(result, 0);
+
+    /* removed keys, eager and lazy */
+    for (int i = 0; i < count_vals; i += 3)
+    {
+        double val = i;
+        ck_assert(tree_remove_key(tree, &val));
+        alive[i] = false;
+    }
+
+    assert_range_aggregates(tree, alive, count_vals);
+
+    tree_set_lazy_delete(tree, true, 0.9);
+
+    for (int i = 1; i < count_vals; i += 3)
+    {
+        double val = i;
+        ck_assert(tree_remove_key(tree, &val));
+        alive[i] = false;
+    }
+
+    assert_range_aggregates(tree, alive, count_vals);
+
+    /* revived leaf */
+    double val = 1;
+    ck_assert(tree_insert_key(tree, &val));
+    alive[1] = true;
+    assert_range_aggregates(tree, alive, count_vals);
+
+    /* min, max and order of combine */
+    tree_set_aggregate(tree, value_double, tree_aggregate_min, INFINITY);
+    ck_assert(tree_range_aggregate(tree, &lo, &hi, &result));
+    ck_assert_double_eq(result, 11);
+
+    tree_set_aggregate(tree, value_double, tree_aggregate_max, -INFINITY);
+    ck_assert(tree_range_aggregate(tree, &lo, &hi, &result));
+    ck_assert_double_eq(result, 20);
+
+    tree_set_aggregate(tree, value_double, combine_last, NAN);
+    ck_assert(tree_range_aggregate(tree, &lo, &hi, &result));
+    ck_assert_double_eq(result, 20);
+
+    tree_set_aggregate(tree, NULL, NULL, 0);
+    ck_assert(!tree_range_aggregate(tree, NULL, NULL, &result));
+
+    tree_destroy(&tree);
+    free(alive);
+}
+END_TEST
+
+
+START_TEST(test_aggregate_after_split_join)
+{
+    const int count_vals = 1000;
+
+    Tree_2_3 *tree = MAKE_TREE(double);
+    Tree_2_3 *left = NULL, *right = NULL;
+    bool *alive = malloc(sizeof(bool) * count_vals);
+    double key = 321, result;
+
+
+    tree_set_aggregate(tree, value_double, tree_aggregate_sum, 0);
+
+    for (int i = 0; i < count_vals; i++)
+    {
+        double val = i;
+        ck_assert(tree_insert_key(tree, &val));
+        alive[i] = true;
+    }
+
+    ck_assert(tree_split(tree, &key, &left, &right));
+    ck_assert(tree_range_aggregate(left, NULL, NULL, &result));
+    ck_assert_double_eq(result, 321 * 320 / 2);
+    ck_assert(tree_range_aggregate(right, NULL, NULL, &result));
+    ck_assert_double_eq(result, (count_vals - 1) * count_vals / 2 - 321 * 320 / 2);
+
+    /* aggregates of right are counted by functions of left */
+    tree_set_aggregate(right, value_double, tree_aggregate_max, -INFINITY);
+    ck_assert(tree_join(left, &right));
+    assert_range_aggregates(left, alive, count_vals);
+
+    tree_destroy(&tree);
+    tree_destroy(&left);
+    free(alive);
+}
+END_TEST
+
+
+/* ========== STRINGS ====================================================== */
+
+#define URL_FORMAT  "https://example.com/catalog/category-%02d/products/item-%06d"
+
+/* Check that decoded keys go in ascending order */
+static bool visit_strings(TreeKey key, void *context)
+{
+    char *prev = context;
+    char buffer[128];
+
+    ck_assert_uint_lt(tree_string_decode(key, buffer, sizeof(buffer)), sizeof(buffer));
+    ck_assert_int_lt(strcmp(prev, buffer), 0);
+    strcpy(prev, buffer);
+
+    return true;
+}
+
+
+START_TEST(test_string_keys)
+{
+    const int count_vals = 2000;
+
+    Tree_2_3 *tree = tree_create_strings();
+    Tree_2_3 *left = NULL, *right = NULL;
+    TreeMemoryStats stats;
+    size_t plain_bytes = 0;
+    char url[128], buffer[128], prev[128] = "";
+
+
+    for (int i = 0; i < count_vals; i++)
+    {
+        snprintf(url, sizeof(url), URL_FORMAT, (i * 7) % 10, (i * 7919) % count_vals);
+        ck_assert(tree_insert_key(tree, url));
+        plain_bytes += strlen(url) + 1;
+    }
+
+    ck_assert(!tree_insert_key(tree, url));
+    ck_assert_int_eq(tree_count_elements(tree), count_vals);
+
+    /* keys are compared with C strings without decoding */
+    for (int i = 0; i < count_vals; i++)
+    {
+        snprintf(url, sizeof(url), URL_FORMAT, (i * 7) % 10, (i * 7919) % count_vals);
+        const Node_2_3 *leaf = tree_search_key(tree, url);
+
+        ck_assert_ptr_nonnull(leaf);
+        tree_string_decode(node_get_key(leaf), buffer, sizeof(buffer));
+        ck_assert_str_eq(buffer, url);
+    }
+
+    ck_assert_ptr_null(tree_search_key(tree, "https://example.com/catalog/"));
+    ck_assert_ptr_null(tree_search_key(tree, ""));
+
+    tree_foreach(tree, visit_strings, prev);
+
+    /* the common prefixes are stored once */
+    tree_memory_stats(tree, &stats);
+    ck_assert_uint_lt(stats.key_bytes * 2, plain_bytes);
+
+    /* size with NUL is returned, if buffer is small */
+    ck_assert_uint_eq(tree_string_decode(tree_get_min(tree), buffer, 4), strlen(prev) + 1);
+    ck_assert_uint_eq(tree_string_decode("abc", buffer, sizeof(buffer)), 4);
+
+    /* removed keys stay as bases of their neighbors */
+    for (int i = 0; i < count_vals; i += 2)
+    {
+        snprintf(url, sizeof(url), URL_FORMAT, (i * 7) % 10, (i * 7919) % count_vals);
+        ck_assert(tree_remove_key(tree, url));
+    }
+
+    for (int i = 0; i < count_vals; i++)
+    {
+        snprintf(url, sizeof(url), URL_FORMAT, (i * 7) % 10, (i * 7919) % count_vals);
+        ck_assert((tree_search_key(tree, url) != NULL) == (i % 2 == 1));
+    }
+
+    snprintf(url, sizeof(url), URL_FORMAT, 5, 0);
+    ck_assert(tree_split(tree, url, &left, &right));
+    ck_assert(tree_join(left, &right));
+    ck_assert_int_eq(tree_count_elements(left), count_vals / 2);
+
+    strcpy(prev, "");
+    tree_foreach(left, visit_strings, prev);
 
     tree_destroy(&tree);
+    tree_destroy(&left);
 }
 END_TEST
 
@@ -601,6 +2401,14 @@ static Suite* make_suite_create(void)
     tcase_add_test(tc_create, test_create_empty_tree);
     suite_add_tcase(s, tc_create);
 
+    TCase* tc_create_allocator = tcase_create("Create tree with allocator");
+    tcase_add_test(tc_create_allocator, test_create_with_allocator);
+    suite_add_tcase(s, tc_create_allocator);
+
+    TCase* tc_create_intrusive = tcase_create("Create intrusive tree");
+    tcase_add_test(tc_create_intrusive, test_create_intrusive_tree);
+    suite_add_tcase(s, tc_create_intrusive);
+
     return s;
 }
 
@@ -654,6 +2462,25 @@ static Suite* make_suite_insert(void)
     tcase_add_test(tc_insert_duplicate, test_insert_duplicate);
     suite_add_tcase(s, tc_insert_duplicate);
 
+    TCase* tc_append_sorted = tcase_create("Append sorted keys without descent");
+    tcase_add_test(tc_append_sorted, test_append_sorted_keys);
+    suite_add_tcase(s, tc_append_sorted);
+
+    TCase* tc_insert_hint = tcase_create("Insert keys next to hint");
+    tcase_add_checked_fixture(tc_insert_hint, setup, teardown);
+    tcase_add_test(tc_insert_hint, test_insert_hint);
+    tcase_add_test(tc_insert_hint, test_insert_hint_middle);
+    suite_add_tcase(s, tc_insert_hint);
+
+    TCase* tc_find_or_insert = tcase_create("Find or insert key");
+    tcase_add_checked_fixture(tc_find_or_insert, setup, teardown);
+    tcase_add_test(tc_find_or_insert, test_find_or_insert);
+    suite_add_tcase(s, tc_find_or_insert);
+
+    TCase* tc_replace = tcase_create("Replace stored key");
+    tcase_add_test(tc_replace, test_replace_key);
+    suite_add_tcase(s, tc_replace);
+
     return s;
 }
 
@@ -692,6 +2519,23 @@ static Suite* make_suite_remove(void)
     tcase_add_test(tc_remove_random_element, test_remove_random_element);
     suite_add_tcase(s, tc_remove_random_element);
 
+    TCase* tc_lazy_remove = tcase_create("Lazy remove marks leafs as dead");
+    tcase_add_checked_fixture(tc_lazy_remove, setup, teardown);
+    tcase_add_test(tc_lazy_remove, test_lazy_remove);
+    suite_add_tcase(s, tc_lazy_remove);
+
+    TCase* tc_lazy_compaction = tcase_create("Compaction of dead leafs");
+    tcase_add_test(tc_lazy_compaction, test_lazy_remove_compaction);
+    suite_add_tcase(s, tc_lazy_compaction);
+
+    TCase* tc_pop = tcase_create("Pop minimal and maximal keys");
+    tcase_add_test(tc_pop, test_pop_min_max);
+    suite_add_tcase(s, tc_pop);
+
+    TCase* tc_remove_node = tcase_create("Remove leaf by handle");
+    tcase_add_test(tc_remove_node, test_remove_node);
+    suite_add_tcase(s, tc_remove_node);
+
     return s;
 }
 
@@ -715,6 +2559,28 @@ static Suite* make_suite_search(void)
     tcase_add_test(tc_search_random, tesr_search_random_key);
     suite_add_tcase(s, tc_search_random);
 
+    TCase* tc_search_bloom = tcase_create("Search with Bloom filter");
+    tcase_add_test(tc_search_bloom, test_search_with_bloom_filter);
+    suite_add_tcase(s, tc_search_bloom);
+
+    TCase* tc_search_batch = tcase_create("Search batch of keys");
+    tcase_add_test(tc_search_batch, test_search_batch);
+    suite_add_tcase(s, tc_search_batch);
+
+    TCase* tc_search_cache = tcase_create("Search with lookup cache");
+    tcase_add_test(tc_search_cache, test_search_with_lookup_cache);
+    suite_add_tcase(s, tc_search_cache);
+
+    TCase* tc_neighbors = tcase_create("Neighbors of keys");
+    tcase_add_checked_fixture(tc_neighbors, setup, teardown);
+    tcase_add_test(tc_neighbors, test_neighbors_of_keys);
+    suite_add_tcase(s, tc_neighbors);
+
+    TCase* tc_neighbors_empty = tcase_create("Neighbors in empty tree");
+    tcase_add_checked_fixture(tc_neighbors_empty, setup, teardown);
+    tcase_add_test(tc_neighbors_empty, test_neighbors_in_empty_tree);
+    suite_add_tcase(s, tc_neighbors_empty);
+
     return s;
 }
 
@@ -745,6 +2611,291 @@ static Suite* make_suite_height(void)
     tcase_set_timeout(tc_height_bounds, 60.0);
     suite_add_tcase(s, tc_height_bounds);
 
+    TCase* tc_invariants = tcase_create("Invariants after mutations");
+    tcase_add_test(tc_invariants, test_invariants_after_mutations);
+    suite_add_tcase(s, tc_invariants);
+
+    TCase* tc_memory = tcase_create("Memory stats of tree");
+    tcase_add_test(tc_memory, test_memory_stats);
+    suite_add_tcase(s, tc_memory);
+
+    TCase* tc_op_stats = tcase_create("Operation stats of tree");
+    tcase_add_test(tc_op_stats, test_op_stats);
+    suite_add_tcase(s, tc_op_stats);
+
+    return s;
+}
+
+
+static Suite* make_suite_split_join(void)
+{
+    Suite* s = suite_create("Split/Join");
+
+    TCase* tc_split_middle = tcase_create("Split tree by middle key");
+    tcase_add_test(tc_split_middle, test_split_by_middle_key);
+    suite_add_tcase(s, tc_split_middle);
+
+    TCase* tc_split_out_of_range = tcase_create("Split tree by key out of range");
+    tcase_add_checked_fixture(tc_split_out_of_range, setup, teardown);
+    tcase_add_test(tc_split_out_of_range, test_split_out_of_range_key);
+    suite_add_tcase(s, tc_split_out_of_range);
+
+    TCase* tc_join = tcase_create("Join splitted trees");
+    tcase_add_checked_fixture(tc_join, setup, teardown);
+    tcase_add_test(tc_join, test_join_trees);
+    suite_add_tcase(s, tc_join);
+
+    return s;
+}
+
+START_TEST(test_set_operations_borrow_keys)
+{
+    const double vals_a[] = { 1, 2, 3, 4 };
+    const double vals_b[] = { 3, 4, 5 };
+
+    Tree_2_3 *a = tree_create(cmp_double, NULL, free_double);
+    Tree_2_3 *b = tree_create(cmp_double, NULL, free_double);
+    Tree_2_3 *copying = MAKE_TREE(double);
+    g_memory_counter = &(struct memory_counter){0};
+
+
+    /* trees own the keys given to them, but can't copy them */
+    for (size_t i = 0; i < SIZE_ARR(vals_a); i++)
+        ck_assert(tree_insert_key(a, copy_double(&vals_a[i])));
+
+    for (size_t i = 0; i < SIZE_ARR(vals_b); i++)
+        ck_assert(tree_insert_key(b, copy_double(&vals_b[i])));
+
+    tree_set_lazy_delete(a, true, 0.5);
+
+    Tree_2_3 *all = tree_union(a, b);
+    Tree_2_3 *both = tree_intersection(a, b);
+
+    ck_assert_int_eq(tree_count_elements(all), 5);
+    ck_assert_int_eq(tree_count_elements(both), 2);
+
+    /* lazy deletion of <a> is kept by the result */
+    TreeMemoryStats stats;
+    ck_assert(tree_remove_key(all, &vals_a[0]));
+    tree_memory_stats(all, &stats);
+    ck_assert_int_eq(stats.dead, 1);
+
+    /* results borrow keys, nothing is freed with them */
+    tree_destroy(&all);
+    tree_destroy(&both);
+    ck_assert_int_eq(g_memory_counter->free, 0);
+
+    /* trees which treat keys differently aren't combined */
+    ck_assert_ptr_null(tree_union(a, copying));
+    ck_assert_ptr_null(tree_difference(copying, b));
+
+    tree_destroy(&a);
+    tree_destroy(&b);
+    tree_destroy(&copying);
+
+    ck_assert_int_eq(g_memory_counter->free, g_memory_counter->alloc);
+
+    g_memory_counter = NULL;
+}
+END_TEST
+
+
+
+static Suite* make_suite_set_operations(void)
+{
+    Suite* s = suite_create("Set operations");
+
+    TCase* tc_union = tcase_create("Union of trees");
+    tcase_add_checked_fixture(tc_union, setup_sets, teardown_sets);
+    tcase_add_test(tc_union, test_union_of_trees);
+    suite_add_tcase(s, tc_union);
+
+    TCase* tc_intersection = tcase_create("Intersection of trees");
+    tcase_add_checked_fixture(tc_intersection, setup_sets, teardown_sets);
+    tcase_add_test(tc_intersection, test_intersection_of_trees);
+    suite_add_tcase(s, tc_intersection);
+
+    TCase* tc_difference = tcase_create("Difference of trees");
+    tcase_add_checked_fixture(tc_difference, setup_sets, teardown_sets);
+    tcase_add_test(tc_difference, test_difference_of_trees);
+    suite_add_tcase(s, tc_difference);
+
+    TCase* tc_gallop = tcase_create("Set operations over small and big trees");
+    tcase_add_test(tc_gallop, test_set_operations_small_and_big_tree);
+    suite_add_tcase(s, tc_gallop);
+
+    TCase* tc_borrow = tcase_create("Set operations over trees without copy function");
+    tcase_add_test(tc_borrow, test_set_operations_borrow_keys);
+    suite_add_tcase(s, tc_borrow);
+
+    return s;
+}
+
+
+static Suite* make_suite_freeze(void)
+{
+    Suite* s = suite_create("Freeze");
+
+    TCase* tc_freeze = tcase_create("Freeze and thaw tree");
+    tcase_add_test(tc_freeze, test_freeze_and_thaw);
+    tcase_add_test(tc_freeze, test_thaw_keeps_settings);
+    suite_add_tcase(s, tc_freeze);
+
+    TCase* tc_freeze_empty = tcase_create("Freeze empty tree");
+    tcase_add_test(tc_freeze_empty, test_freeze_empty_tree);
+    suite_add_tcase(s, tc_freeze_empty);
+
+    return s;
+}
+
+
+static Suite* make_suite_aggregate(void)
+{
+    Suite* s = suite_create("Aggregate");
+
+    TCase* tc_range = tcase_create("Aggregate over range of keys");
+    tcase_add_test(tc_range, test_range_aggregate);
+    suite_add_tcase(s, tc_range);
+
+    TCase* tc_split_join = tcase_create("Aggregate after split and join");
+    tcase_add_test(tc_split_join, test_aggregate_after_split_join);
+    suite_add_tcase(s, tc_split_join);
+
+    return s;
+}
+
+
+static int cmp_cstring(TreeKey a, TreeKey b)
+{
+    return strcmp(a, b);
+}
+
+
+/* Prefix scan state: keys must go in ascending order and start with prefix */
+struct prefix_visit
+{
+    const char *prefix;
+    char prev[64];
+    int count;
+    int limit;      /* stop after <limit> keys, 0 - no limit */
+};
+
+
+static bool visit_prefix(TreeKey key, void *context)
+{
+    struct prefix_visit *scan = context;
+    char buffer[64];
+
+    tree_string_decode(key, buffer, sizeof(buffer));
+
+    ck_assert_int_eq(strncmp(buffer, scan->prefix, strlen(scan->prefix)), 0);
+    ck_assert_int_lt(strcmp(scan->prev, buffer), 0);
+    strcpy(scan->prev, buffer);
+
+    return ++scan->count != scan->limit;
+}
+
+
+START_TEST(test_prefix_foreach)
+{
+    const char *prefixes[] = { "/api/v2/", "/api/", "/api/v1/users/", "", "/api/v2/users/17", "/zzz", "/" };
+    const char *sections[] = { "/api/v1/users/", "/api/v2/users/", "/api/v2/orders/", "/static/" };
+    const int count_vals = 1000;
+
+    static char paths[1000][64];
+    Tree_2_3 *trees[] = { tree_create_strings(), tree_create(cmp_cstring, NULL, NULL) };
+
+
+    for (int i = 0; i < count_vals; i++)
+    {
+        snprintf(paths[i], sizeof(paths[i]), "%s%d", sections[i % SIZE_ARR(sections)], i * 7 % count_vals);
+
+        for (size_t t = 0; t < SIZE_ARR(trees); t++)
+            ck_assert(tree_insert_key(trees[t], paths[i]));
+    }
+
+    for (size_t t = 0; t < SIZE_ARR(trees); t++)
+    for (size_t p = 0; p < SIZE_ARR(prefixes); p++)
+    {
+        struct prefix_visit scan = { .prefix = prefixes[p] };
+        int expected = 0;
+
+        for (int i = 0; i < count_vals; i++)
+            expected += strncmp(paths[i], prefixes[p], strlen(prefixes[p])) == 0;
+
+        tree_prefix_foreach(trees[t], prefixes[p], strlen(prefixes[p]), visit_prefix, &scan);
+        ck_assert_int_eq(scan.count, expected);
+    }
+
+    /* only <len> bytes of prefix are used, the visitor can stop the scan */
+    struct prefix_visit scan = { .prefix = "/api/v1/", .limit = 3 };
+
+    tree_prefix_foreach(trees[0], "/api/v1/users/", 8, visit_prefix, &scan);
+    ck_assert_int_eq(scan.count, 3);
+
+    /* keys have no NUL inside, such prefix matches nothing */
+    struct prefix_visit nul_scan = { .prefix = "/api" };
+
+    tree_prefix_foreach(trees[0], "/api\0v1", 7, visit_prefix, &nul_scan);
+    ck_assert_int_eq(nul_scan.count, 0);
+
+    for (size_t t = 0; t < SIZE_ARR(trees); t++)
+        tree_destroy(&trees[t]);
+}
+END_TEST
+
+
+START_TEST(test_string_keys_tag_byte)
+{
+    const char *tagged = "\xFF" "abcdef";
+
+    Tree_2_3 *tree = tree_create_strings();
+    Tree_2_3 *plain = tree_create(cmp_cstring, NULL, NULL);
+    Tree_2_3 *left = NULL, *right = NULL;
+    struct prefix_visit scan = { .prefix = tagged };
+
+
+    ck_assert(tree_insert_key(tree, "abc"));
+    ck_assert(tree_insert_key(tree, "abd"));
+
+    /* C string starting with the byte of stored keys is refused, not read as stored key */
+    ck_assert(!tree_insert_key(tree, tagged));
+    ck_assert_ptr_null(tree_insert_hint(tree, tagged, NULL));
+    ck_assert_ptr_null(tree_find_or_insert(tree, tagged, NULL));
+    ck_assert_ptr_null(tree_search_key(tree, tagged));
+    ck_assert_ptr_null(tree_lower_bound(tree, tagged));
+    ck_assert_ptr_null(tree_predecessor(tree, tagged));
+    ck_assert(!tree_replace_key(tree, tagged));
+    ck_assert(!tree_remove_key(tree, tagged));
+    ck_assert(!tree_split(tree, tagged, &left, &right));
+
+    tree_prefix_foreach(tree, tagged, 1, visit_prefix, &scan);
+    ck_assert_int_eq(scan.count, 0);
+    ck_assert_int_eq(tree_count_elements(tree), 2);
+
+    /* other trees take such keys as usual */
+    ck_assert(tree_insert_key(plain, tagged));
+    ck_assert_ptr_nonnull(tree_search_key(plain, tagged));
+
+    tree_destroy(&tree);
+    tree_destroy(&plain);
+}
+END_TEST
+
+
+static Suite* make_suite_strings(void)
+{
+    Suite* s = suite_create("Strings");
+
+    TCase* tc_strings = tcase_create("Front-coded string keys");
+    tcase_add_test(tc_strings, test_string_keys);
+    tcase_add_test(tc_strings, test_string_keys_tag_byte);
+    suite_add_tcase(s, tc_strings);
+
+    TCase* tc_prefix = tcase_create("Scan keys with prefix");
+    tcase_add_test(tc_prefix, test_prefix_foreach);
+    suite_add_tcase(s, tc_prefix);
+
     return s;
 }
 
@@ -765,7 +2916,12 @@ int main(void)
         * suite_remove_key   = make_suite_remove(),
         * suite_search_key   = make_suite_search(),
         * suite_copy_key     = make_suite_copy(),
-        * suite_height_tree  = make_suite_height();
+        * suite_height_tree  = make_suite_height(),
+        * suite_split_join   = make_suite_split_join(),
+        * suite_set_ops      = make_suite_set_operations(),
+        * suite_freeze       = make_suite_freeze(),
+        * suite_aggregate    = make_suite_aggregate(),
+        * suite_strings      = make_suite_strings();
 
     SRunner* sr = srunner_create(suite_create("Test Tree_2_3"));
     srunner_add_suite(sr, suite_create_tree);
@@ -775,6 +2931,11 @@ int main(void)
     srunner_add_suite(sr, suite_search_key);
     srunner_add_suite(sr, suite_copy_key);
     srunner_add_suite(sr, suite_height_tree);
+    srunner_add_suite(sr, suite_split_join);
+    srunner_add_suite(sr, suite_set_ops);
+    srunner_add_suite(sr, suite_freeze);
+    srunner_add_suite(sr, suite_aggregate);
+    srunner_add_suite(sr, suite_strings);
 
 
     // srunner_set_fork_status(sr, CK_NOFORK);
@@ -0,0 +1,413 @@
+/* A program for testing snapshots of 2-3 trees */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <check.h>
+
+#include "tree_2_3/tree_2_3.h"
+#include "tree_2_3/tree_snapshot.h"
+#include "log/log.h"
+
+
+#define SIZE_ARR(arr)   (sizeof(arr)/sizeof(*arr))
+
+#define SNAPSHOT_PATH   "./test_tree_snapshot.bin"
+
+
+static Tree_2_3 *_tree;  /* global object for test cases */
+
+
+
+/* ---------- double functions --------------------------------------------- */
+
+static int cmp_double(TreeKey a, TreeKey b)
+{
+    double x = *(const double*)a;
+    double y = *(const double*)b;
+
+    return (x > y) - (x < y);
+}
+
+
+static size_t save_double(TreeKey key, void *buffer, size_t size)
+{
+    if (size >= sizeof(double))
+        memcpy(buffer, key, sizeof(double));
+
+    return sizeof(double);
+}
+
+
+/* ----------- string functions -------------------------------------------- */
+
+static int cmp_string(TreeKey a, TreeKey b)
+{
+    return strcmp((const char*)a, (const char*)b);
+}
+
+
+static size_t save_string(TreeKey key, void *buffer, size_t size)
+{
+    size_t len = strlen((const char*)key) + 1;
+
+    if (size >= len)
+        memcpy(buffer, key, len);
+
+    return len;
+}
+
+
+/* ---------- auxiliary functions ------------------------------------------ */
+
+/* collect visited keys to array of doubles */
+struct visit_context
+{
+    double keys[64];
+    int count;
+    int limit;
+};
+
+
+static bool visit_double(TreeKey key, void *context)
+{
+    struct visit_context *ctx = context;
+
+    ctx->keys[ctx->count++] = *(const double*)key;
+
+    return ctx->count < ctx->limit;
+}
+
+
+static void setup(void)
+{
+    log_trace("%s", __func__);
+
+    _tree = tree_create(cmp_double, NULL, NULL);
+    ck_assert_ptr_nonnull(_tree);
+}
+
+
+static void teardown(void)
+{
+    log_trace("%s", __func__);
+
+    tree_destroy(&_tree);
+    ck_assert_ptr_null(_tree);
+
+    remove(SNAPSHOT_PATH);
+}
+
+
+/* ---------- test cases --------------------------------------------------- */
+
+/* ========== SAVE / OPEN ================================================== */
+
+/* using fixtures - setup/teardown callbacks */
+START_TEST(test_save_and_open_empty_tree)
+{
+    const double key = 1;
+
+
+    ck_assert(tree_save(_tree, SNAPSHOT_PATH, save_double));
+
+    TreeImage *image = tree_open_mmap(SNAPSHOT_PATH, cmp_double);
+    ck_assert_ptr_nonnull(image);
+
+    ck_assert(tree_image_verify(image));
+    ck_assert_int_eq(tree_image_count_elements(image), 0);
+    ck_assert_int_eq(tree_image_height(image), 0);
+    ck_assert_ptr_null(tree_image_get_min(image));
+    ck_assert_ptr_null(tree_image_get_max(image));
+    ck_assert_ptr_null(tree_image_search_key(image, &key));
+
+    tree_image_close(&image);
+    ck_assert_ptr_null(image);
+}
+END_TEST
+
+
+/* using fixtures - setup/teardown callbacks */
+START_TEST(test_search_in_image)
+{
+    const int count_vals = 1000;
+    double *vals = malloc(sizeof(double) * count_vals);
+
+
+    for (int i = 0; i < count_vals; i++)
+    {
+        vals[i] = i * 2;
+        ck_assert(tree_insert_key(_tree, &vals[i]));
+    }
+
+    ck_assert(tree_save(_tree, SNAPSHOT_PATH, save_double));
+
+    TreeImage *image = tree_open_mmap(SNAPSHOT_PATH, cmp_double);
+    ck_assert_ptr_nonnull(image);
+
+    ck_assert_int_eq(tree_image_count_elements(image), count_vals);
+    /* index is packed bottom-up, so it is never higher than the tree */
+    ck_assert_int_gt(tree_image_height(image), 0);
+    ck_assert_int_le(tree_image_height(image), tree_height(_tree));
+    ck_assert_double_eq(*(const double*)tree_image_get_min(image), 0);
+    ck_assert_double_eq(*(const double*)tree_image_get_max(image), (count_vals - 1) * 2);
+
+    for (int i = 0; i < count_vals; i++)
+    {
+        double missing = vals[i] + 1;
+        TreeKey finded = tree_image_search_key(image, &vals[i]);
+
+        ck_assert_ptr_nonnull(finded);
+        ck_assert_double_eq(*(const double*)finded, vals[i]);
+        ck_assert_ptr_null(tree_image_search_key(image, &missing));
+    }
+
+    tree_image_close(&image);
+    free(vals);
+}
+END_TEST
+
+
+/* using fixtures - setup/teardown callbacks */
+START_TEST(test_foreach_in_image)
+{
+    const double vals[] = { 5, 3, 9, 1, 7 };
+    const double sorted[] = { 1, 3, 5, 7, 9 };
+    struct visit_context all = { .limit = 64 };
+    struct visit_context first_two = { .limit = 2 };
+
+
+    for (size_t i = 0; i < SIZE_ARR(vals); i++)
+    {
+        ck_assert(tree_insert_key(_tree, &vals[i]));
+    }
+
+    ck_assert(tree_save(_tree, SNAPSHOT_PATH, save_double));
+
+    TreeImage *image = tree_open_mmap(SNAPSHOT_PATH, cmp_double);
+    ck_assert_ptr_nonnull(image);
+
+    tree_image_foreach(image, visit_double, &all);
+    ck_assert_int_eq(all.count, SIZE_ARR(sorted));
+
+    for (size_t i = 0; i < SIZE_ARR(sorted); i++)
+    {
+        ck_assert_double_eq(all.keys[i], sorted[i]);
+    }
+
+    tree_image_foreach(image, visit_double, &first_two);
+    ck_assert_int_eq(first_two.count, 2);
+
+    tree_image_close(&image);
+}
+END_TEST
+
+
+START_TEST(test_image_with_variable_size_keys)
+{
+    const char *vals[] = { "/api/v2/users", "/api", "/api/v2/users/42/profile", "/", "/static/main.css" };
+    const char *missing = "/api/v2";
+
+    Tree_2_3 *tree = tree_create(cmp_string, NULL, NULL);
+
+
+    for (size_t i = 0; i < SIZE_ARR(vals); i++)
+    {
+        ck_assert(tree_insert_key(tree, vals[i]));
+    }
+
+    ck_assert(tree_save(tree, SNAPSHOT_PATH, save_string));
+    tree_destroy(&tree);
+
+    TreeImage *image = tree_open_mmap(SNAPSHOT_PATH, cmp_string);
+    ck_assert_ptr_nonnull(image);
+
+    for (size_t i = 0; i < SIZE_ARR(vals); i++)
+    {
+        TreeKey finded = tree_image_search_key(image, vals[i]);
+
+        ck_assert_ptr_nonnull(finded);
+        ck_assert_str_eq((const char*)finded, vals[i]);
+    }
+
+    ck_assert_ptr_null(tree_image_search_key(image, missing));
+    ck_assert_str_eq((const char*)tree_image_get_min(image), "/");
+    ck_assert_str_eq((const char*)tree_image_get_max(image), "/static/main.css");
+
+    tree_image_close(&image);
+    remove(SNAPSHOT_PATH);
+}
+END_TEST
+
+
+/* ========== CORRUPTION =================================================== */
+
+/* using fixtures - setup/teardown callbacks */
+START_TEST(test_open_missing_or_invalid_file)
+{
+    ck_assert_ptr_null(tree_open_mmap("./not_existing_snapshot.bin", cmp_double));
+
+    FILE *file = fopen(SNAPSHOT_PATH, "wb");
+    ck_assert_ptr_nonnull(file);
+    fputs("definitely not a snapshot of tree, but long enough to have a header", file);
+    fclose(file);
+
+    ck_assert_ptr_null(tree_open_mmap(SNAPSHOT_PATH, cmp_double));
+}
+END_TEST
+
+
+/* using fixtures - setup/teardown callbacks */
+START_TEST(test_verify_corrupted_data)
+{
+    const double vals[] = { 1, 2, 3, 4, 5, 6, 7 };
+
+
+    for (size_t i = 0; i < SIZE_ARR(vals); i++)
+    {
+        ck_assert(tree_insert_key(_tree, &vals[i]));
+    }
+
+    ck_assert(tree_save(_tree, SNAPSHOT_PATH, save_double));
+
+    /* flip the last byte of data */
+    FILE *file = fopen(SNAPSHOT_PATH, "r+b");
+    ck_assert_ptr_nonnull(file);
+    ck_assert_int_eq(fseek(file, -1, SEEK_END), 0);
+    int byte = fgetc(file);
+    ck_assert_int_eq(fseek(file, -1, SEEK_END), 0);
+    fputc(byte ^ 0xFF, file);
+    fclose(file);
+
+    TreeImage *image = tree_open_mmap(SNAPSHOT_PATH, cmp_double);
+    ck_assert_ptr_nonnull(image);
+    ck_assert(!tree_image_verify(image));
+
+    tree_image_close(&image);
+}
+END_TEST
+
+
+/* using fixtures - setup/teardown callbacks */
+START_TEST(test_read_corrupted_data)
+{
+    enum { count_vals = 100 };
+    const long intact = 256;    /* header and the first keys */
+    static double vals[count_vals];
+    struct visit_context ctx = { .limit = SIZE_ARR(ctx.keys) };
+
+
+    for (int i = 0; i < count_vals; i++)
+    {
+        vals[i] = i;
+        ck_assert(tree_insert_key(_tree, &vals[i]));
+    }
+
+    ck_assert(tree_save(_tree, SNAPSHOT_PATH, save_double));
+
+    /* offsets and sizes after the first bytes point out of file */
+    FILE *file = fopen(SNAPSHOT_PATH, "r+b");
+    ck_assert_ptr_nonnull(file);
+    ck_assert_int_eq(fseek(file, 0, SEEK_END), 0);
+    long size = ftell(file);
+    ck_assert_int_gt(size, intact);
+    ck_assert_int_eq(fseek(file, intact, SEEK_SET), 0);
+
+    for (long i = intact; i < size; i++)
+        fputc(0xFF, file);
+
+    fclose(file);
+
+    /* header is valid, the data is read without verify, but within the mapping */
+    TreeImage *image = tree_open_mmap(SNAPSHOT_PATH, cmp_double);
+    ck_assert_ptr_nonnull(image);
+
+    for (int i = 0; i < count_vals; i++)
+    {
+        ck_assert_ptr_null(tree_image_search_key(image, &vals[i]));
+    }
+
+    ck_assert_ptr_null(tree_image_get_max(image));
+
+    tree_image_foreach(image, visit_double, &ctx);
+    ck_assert_int_gt(ctx.count, 0);
+    ck_assert_int_lt(ctx.count, count_vals);
+    ck_assert_double_eq(ctx.keys[0], 0);
+
+    ck_assert(!tree_image_verify(image));
+    tree_image_close(&image);
+}
+END_TEST
+
+
+/* ---------- suites ------------------------------------------------------- */
+
+static Suite* make_suite_snapshot(void)
+{
+    Suite* s = suite_create("Snapshot");
+
+    TCase* tc_empty = tcase_create("Save and open empty tree");
+    tcase_add_checked_fixture(tc_empty, setup, teardown);
+    tcase_add_test(tc_empty, test_save_and_open_empty_tree);
+    suite_add_tcase(s, tc_empty);
+
+    TCase* tc_search = tcase_create("Search keys in mapped snapshot");
+    tcase_add_checked_fixture(tc_search, setup, teardown);
+    tcase_add_test(tc_search, test_search_in_image);
+    suite_add_tcase(s, tc_search);
+
+    TCase* tc_foreach = tcase_create("Iterate keys of mapped snapshot");
+    tcase_add_checked_fixture(tc_foreach, setup, teardown);
+    tcase_add_test(tc_foreach, test_foreach_in_image);
+    suite_add_tcase(s, tc_foreach);
+
+    TCase* tc_strings = tcase_create("Snapshot with variable size keys");
+    tcase_add_test(tc_strings, test_image_with_variable_size_keys);
+    suite_add_tcase(s, tc_strings);
+
+    return s;
+}
+
+
+static Suite* make_suite_corruption(void)
+{
+    Suite* s = suite_create("Corruption");
+
+    TCase* tc_invalid = tcase_create("Open missing or invalid file");
+    tcase_add_checked_fixture(tc_invalid, setup, teardown);
+    tcase_add_test(tc_invalid, test_open_missing_or_invalid_file);
+    suite_add_tcase(s, tc_invalid);
+
+    TCase* tc_corrupted = tcase_create("Verify corrupted data");
+    tcase_add_checked_fixture(tc_corrupted, setup, teardown);
+    tcase_add_test(tc_corrupted, test_verify_corrupted_data);
+    tcase_add_test(tc_corrupted, test_read_corrupted_data);
+    suite_add_tcase(s, tc_corrupted);
+
+    return s;
+}
+
+
+/* ---------- test --------------------------------------------------------- */
+
+int main(void)
+{
+    log_set_level(LOG_LEVEL);
+    log_info("Test tree_snapshot was starting!");
+
+    Suite
+        * suite_snapshot   = make_suite_snapshot(),
+        * suite_corruption = make_suite_corruption();
+
+    SRunner* sr = srunner_create(suite_create("Test TreeImage"));
+    srunner_add_suite(sr, suite_snapshot);
+    srunner_add_suite(sr, suite_corruption);
+
+    srunner_run_all(sr, CK_NORMAL);
+    int nf = srunner_ntests_failed(sr);
+
+    srunner_free(sr);
+
+    return nf == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
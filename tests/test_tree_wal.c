@@ -0,0 +1,441 @@
+/* A program for testing write-ahead log of 2-3 trees */
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <signal.h>
+
+#include <sys/resource.h>
+#include <sys/stat.h>
+
+#include <check.h>
+
+#include "tree_2_3/tree_2_3.h"
+#include "tree_2_3/tree_wal.h"
+#include "log/log.h"
+
+
+#define SIZE_ARR(arr)   (sizeof(arr)/sizeof(*arr))
+
+#define WAL_PATH        "./test_tree_wal.log"
+#define CKPT_PATH       WAL_PATH ".ckpt"
+
+
+static Tree_2_3 *_tree;  /* global object for test cases */
+
+
+
+/* ---------- double functions --------------------------------------------- */
+
+static int cmp_double(TreeKey a, TreeKey b)
+{
+    double x = *(const double*)a;
+    double y = *(const double*)b;
+
+    return (x > y) - (x < y);
+}
+
+
+static TreeKey copy_double(TreeKey key)
+{
+    double *copy = malloc(sizeof(double));
+
+    ck_assert_ptr_nonnull(copy);
+    *copy = *(const double*)key;
+
+    return copy;
+}
+
+
+static void free_double(TreeKey key)
+{
+    free((void*)key);
+}
+
+
+static size_t save_double(TreeKey key, void *buffer, size_t size)
+{
+    if (size >= sizeof(double))
+        memcpy(buffer, key, sizeof(double));
+
+    return sizeof(double);
+}
+
+
+/* ---------- auxiliary functions ------------------------------------------ */
+
+static Tree_2_3 * new_tree(void)
+{
+    return tree_create(cmp_double, copy_double, free_double);
+}
+
+
+/* Check that tree has only keys from <vals> */
+static void assert_tree_keys(const Tree_2_3 *tree, const double *vals, int count)
+{
+    ck_assert_int_eq(tree_count_elements(tree), count);
+
+    for (int i = 0; i < count; i++)
+    {
+        ck_assert_ptr_nonnull(tree_search_key(tree, &vals[i]));
+    }
+}
+
+
+static void setup(void)
+{
+    log_trace("%s", __func__);
+
+    remove(WAL_PATH);
+    remove(CKPT_PATH);
+
+    _tree = new_tree();
+    ck_assert_ptr_nonnull(_tree);
+}
+
+
+static void teardown(void)
+{
+    log_trace("%s", __func__);
+
+    tree_destroy(&_tree);
+    ck_assert_ptr_null(_tree);
+
+    remove(WAL_PATH);
+    remove(CKPT_PATH);
+}
+
+
+/* ---------- test cases --------------------------------------------------- */
+
+/* ========== REPLAY ======================================================= */
+
+/* using fixtures - setup/teardown callbacks */
+START_TEST(test_replay_after_close)
+{
+    const enum wal_durability levels[] = { WAL_BUFFERED, WAL_GROUP, WAL_SYNC };
+    const double vals[] = { 5, 3, 9, 1, 7, 4 };
+    const double rest[] = { 5, 9, 1, 4 };
+
+
+    for (size_t l = 0; l < SIZE_ARR(levels); l++)
+    {
+        TreeWal *wal = tree_wal_open(WAL_PATH, _tree, save_double, levels[l], 4);
+        ck_assert_ptr_nonnull(wal);
+
+        for (size_t i = 0; i < SIZE_ARR(vals); i++)
+        {
+            ck_assert(tree_wal_insert_key(wal, &vals[i]));
+        }
+
+        ck_assert(!tree_wal_insert_key(wal, &vals[0]));  // duplicate isn't logged
+        ck_assert(tree_wal_remove_key(wal, &vals[1]));
+        ck_assert(tree_wal_remove_key(wal, &vals[4]));
+        ck_assert(!tree_wal_remove_key(wal, &vals[4]));  // missing isn't logged
+
+        ck_assert_int_eq(tree_wal_count_records(wal), 8);
+        ck_assert(tree_wal_close(&wal));
+        ck_assert_ptr_null(wal);
+
+        Tree_2_3 *restored = new_tree();
+        wal = tree_wal_open(WAL_PATH, restored, save_double, levels[l], 4);
+        ck_assert_ptr_nonnull(wal);
+
+        ck_assert_int_eq(tree_wal_count_replayed(wal), 8);
+        assert_tree_keys(restored, rest, SIZE_ARR(rest));
+
+        tree_wal_close(&wal);
+        tree_destroy(&restored);
+        tree_make_empty(_tree);
+        remove(WAL_PATH);
+    }
+}
+END_TEST
+
+
+/* using fixtures - setup/teardown callbacks */
+START_TEST(test_replay_synced_without_close)
+{
+    const double vals[] = { 10, 20, 30, 40, 50 };
+
+
+    /* sync: every record is on disk */
+    TreeWal *wal = tree_wal_open(WAL_PATH, _tree, save_double, WAL_SYNC, 0);
+    ck_assert_ptr_nonnull(wal);
+
+    for (size_t i = 0; i < SIZE_ARR(vals); i++)
+    {
+        ck_assert(tree_wal_insert_key(wal, &vals[i]));
+    }
+
+    Tree_2_3 *restored = new_tree();
+    TreeWal *reader = tree_wal_open(WAL_PATH, restored, save_double, WAL_SYNC, 0);
+    ck_assert_ptr_nonnull(reader);
+    assert_tree_keys(restored, vals, SIZE_ARR(vals));
+
+    tree_wal_close(&reader);
+    tree_destroy(&restored);
+    tree_wal_close(&wal);
+    tree_make_empty(_tree);
+    remove(WAL_PATH);
+
+    /* group: only full groups are on disk */
+    wal = tree_wal_open(WAL_PATH, _tree, save_double, WAL_GROUP, 2);
+    ck_assert_ptr_nonnull(wal);
+
+    for (size_t i = 0; i < SIZE_ARR(vals); i++)
+    {
+        ck_assert(tree_wal_insert_key(wal, &vals[i]));
+    }
+
+    restored = new_tree();
+    reader = tree_wal_open(WAL_PATH, restored, save_double, WAL_GROUP, 2);
+    ck_assert_ptr_nonnull(reader);
+    assert_tree_keys(restored, vals, 4);
+
+    tree_wal_close(&reader);
+    tree_destroy(&restored);
+    tree_wal_close(&wal);
+}
+END_TEST
+
+
+/* ========== CHECKPOINT =================================================== */
+
+/* using fixtures - setup/teardown callbacks */
+START_TEST(test_checkpoint_truncates_log)
+{
+    const double vals[] = { 1, 2, 3, 4, 5, 6, 7, 8 };
+    const double rest[] = { 1, 2, 3, 5, 6, 7, 8, 100 };
+    const double added = 100;
+
+
+    TreeWal *wal = tree_wal_open(WAL_PATH, _tree, save_double, WAL_GROUP, 0);
+    ck_assert_ptr_nonnull(wal);
+
+    for (size_t i = 0; i < SIZE_ARR(vals); i++)
+    {
+        ck_assert(tree_wal_insert_key(wal, &vals[i]));
+    }
+
+    ck_assert(tree_wal_checkpoint(wal));
+    ck_assert_int_eq(tree_wal_count_records(wal), 0);
+
+    /* operations after checkpoint are replayed on top of it */
+    ck_assert(tree_wal_remove_key(wal, &vals[3]));
+    ck_assert(tree_wal_insert_key(wal, &added));
+    ck_assert(tree_wal_close(&wal));
+
+    Tree_2_3 *restored = new_tree();
+    wal = tree_wal_open(WAL_PATH, restored, save_double, WAL_GROUP, 0);
+    ck_assert_ptr_nonnull(wal);
+
+    ck_assert_int_eq(tree_wal_count_replayed(wal), 2);
+    assert_tree_keys(restored, rest, SIZE_ARR(rest));
+
+    tree_wal_close(&wal);
+    tree_destroy(&restored);
+}
+END_TEST
+
+
+/* ========== CORRUPTION =================================================== */
+
+/* using fixtures - setup/teardown callbacks */
+START_TEST(test_torn_tail_is_dropped)
+{
+    const double vals[] = { 1, 2, 3 };
+    const double added = 4;
+
+
+    TreeWal *wal = tree_wal_open(WAL_PATH, _tree, save_double, WAL_SYNC, 0);
+    ck_assert_ptr_nonnull(wal);
+
+    for (size_t i = 0; i < SIZE_ARR(vals); i++)
+    {
+        ck_assert(tree_wal_insert_key(wal, &vals[i]));
+    }
+
+    tree_wal_close(&wal);
+
+    /* half of the record header, as after crash in write */
+    FILE *file = fopen(WAL_PATH, "ab");
+    ck_assert_ptr_nonnull(file);
+    fwrite("torn", 1, 4, file);
+    fclose(file);
+
+    Tree_2_3 *restored = new_tree();
+    wal = tree_wal_open(WAL_PATH, restored, save_double, WAL_SYNC, 0);
+    ck_assert_ptr_nonnull(wal);
+    assert_tree_keys(restored, vals, SIZE_ARR(vals));
+
+    /* new records follow the valid part */
+    ck_assert(tree_wal_insert_key(wal, &added));
+    tree_wal_close(&wal);
+    tree_destroy(&restored);
+
+    restored = new_tree();
+    wal = tree_wal_open(WAL_PATH, restored, save_double, WAL_SYNC, 0);
+    ck_assert_ptr_nonnull(wal);
+    ck_assert_int_eq(tree_wal_count_replayed(wal), 4);
+
+    tree_wal_close(&wal);
+    tree_destroy(&restored);
+}
+END_TEST
+
+
+/* using fixtures - setup/teardown callbacks */
+START_TEST(test_open_invalid_log)
+{
+    const double key = 1;
+
+
+    ck_assert_ptr_null(tree_wal_open(NULL, _tree, save_double, WAL_SYNC, 0));
+    ck_assert_ptr_null(tree_wal_open(WAL_PATH, _tree, NULL, WAL_SYNC, 0));
+
+    /* not empty tree */
+    ck_assert(tree_insert_key(_tree, &key));
+    ck_assert_ptr_null(tree_wal_open(WAL_PATH, _tree, save_double, WAL_SYNC, 0));
+    tree_make_empty(_tree);
+
+    FILE *file = fopen(WAL_PATH, "wb");
+    ck_assert_ptr_nonnull(file);
+    fputs("definitely not a log of tree", file);
+    fclose(file);
+
+    ck_assert_ptr_null(tree_wal_open(WAL_PATH, _tree, save_double, WAL_SYNC, 0));
+    ck_assert(tree_is_empty(_tree));
+}
+END_TEST
+
+
+/* using fixtures - setup/teardown callbacks */
+START_TEST(test_failed_write_keeps_tree)
+{
+    const double vals[] = { 1, 2, 3 };
+    const double all[] = { 1, 2, 3, 4 };
+    const double added = 4;
+    struct rlimit limit, old_limit;
+    struct stat info;
+
+
+    TreeWal *wal = tree_wal_open(WAL_PATH, _tree, save_double, WAL_SYNC, 0);
+    ck_assert_ptr_nonnull(wal);
+
+    for (size_t i = 0; i < SIZE_ARR(vals); i++)
+    {
+        ck_assert(tree_wal_insert_key(wal, &vals[i]));
+    }
+
+    ck_assert_int_eq(stat(WAL_PATH, &info), 0);
+    off_t size = info.st_size;
+
+    /* the file can grow only by a part of record */
+    void (*old_handler)(int) = signal(SIGXFSZ, SIG_IGN);
+    ck_assert_int_eq(getrlimit(RLIMIT_FSIZE, &old_limit), 0);
+    limit = old_limit;
+    limit.rlim_cur = size + 10;
+    ck_assert_int_eq(setrlimit(RLIMIT_FSIZE, &limit), 0);
+
+    ck_assert(!tree_wal_insert_key(wal, &added));
+    ck_assert_ptr_null(tree_search_key(_tree, &added));
+    ck_assert(!tree_wal_remove_key(wal, &vals[0]));
+    ck_assert_ptr_nonnull(tree_search_key(_tree, &vals[0]));
+    ck_assert_int_eq(tree_wal_count_records(wal), SIZE_ARR(vals));
+
+    /* torn part of record is cut */
+    ck_assert_int_eq(stat(WAL_PATH, &info), 0);
+    ck_assert_int_eq(info.st_size, size);
+
+    ck_assert_int_eq(setrlimit(RLIMIT_FSIZE, &old_limit), 0);
+    signal(SIGXFSZ, old_handler);
+
+    /* the log works again and matches the tree */
+    ck_assert(tree_wal_insert_key(wal, &added));
+    tree_wal_close(&wal);
+
+    Tree_2_3 *restored = new_tree();
+    wal = tree_wal_open(WAL_PATH, restored, save_double, WAL_SYNC, 0);
+    ck_assert_ptr_nonnull(wal);
+    ck_assert_int_eq(tree_wal_count_replayed(wal), SIZE_ARR(all));
+    assert_tree_keys(restored, all, SIZE_ARR(all));
+
+    tree_wal_close(&wal);
+    tree_destroy(&restored);
+}
+END_TEST
+
+
+/* ---------- suites ------------------------------------------------------- */
+
+static Suite* make_suite_replay(void)
+{
+    Suite* s = suite_create("Replay");
+
+    TCase* tc_close = tcase_create("Replay log after close");
+    tcase_add_checked_fixture(tc_close, setup, teardown);
+    tcase_add_test(tc_close, test_replay_after_close);
+    suite_add_tcase(s, tc_close);
+
+    TCase* tc_synced = tcase_create("Replay synced records without close");
+    tcase_add_checked_fixture(tc_synced, setup, teardown);
+    tcase_add_test(tc_synced, test_replay_synced_without_close);
+    suite_add_tcase(s, tc_synced);
+
+    TCase* tc_checkpoint = tcase_create("Checkpoint truncates log");
+    tcase_add_checked_fixture(tc_checkpoint, setup, teardown);
+    tcase_add_test(tc_checkpoint, test_checkpoint_truncates_log);
+    suite_add_tcase(s, tc_checkpoint);
+
+    return s;
+}
+
+
+static Suite* make_suite_corruption(void)
+{
+    Suite* s = suite_create("Corruption");
+
+    TCase* tc_torn = tcase_create("Drop torn tail of log");
+    tcase_add_checked_fixture(tc_torn, setup, teardown);
+    tcase_add_test(tc_torn, test_torn_tail_is_dropped);
+    suite_add_tcase(s, tc_torn);
+
+    TCase* tc_invalid = tcase_create("Open invalid log");
+    tcase_add_checked_fixture(tc_invalid, setup, teardown);
+    tcase_add_test(tc_invalid, test_open_invalid_log);
+    suite_add_tcase(s, tc_invalid);
+
+    TCase* tc_failed = tcase_create("Failed write keeps tree and log the same");
+    tcase_add_checked_fixture(tc_failed, setup, teardown);
+    tcase_add_test(tc_failed, test_failed_write_keeps_tree);
+    suite_add_tcase(s, tc_failed);
+
+    return s;
+}
+
+
+/* ---------- test --------------------------------------------------------- */
+
+int main(void)
+{
+    log_set_level(LOG_LEVEL);
+    log_info("Test tree_wal was starting!");
+
+    Suite
+        * suite_replay     = make_suite_replay(),
+        * suite_corruption = make_suite_corruption();
+
+    SRunner* sr = srunner_create(suite_create("Test TreeWal"));
+    srunner_add_suite(sr, suite_replay);
+    srunner_add_suite(sr, suite_corruption);
+
+    srunner_run_all(sr, CK_NORMAL);
+    int nf = srunner_ntests_failed(sr);
+
+    srunner_free(sr);
+
+    return nf == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}